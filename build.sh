@@ -130,6 +130,10 @@ rm -rf  Makefile                \
         src/opcua-tsn/.deps/    \
         tsq                     \
         txrx-tsn                \
+        tsn-analyze             \
+        tsn-compare             \
+        tsn-telemetry           \
+        txrx-bench              \
         opcua-server            \
         *.png
 
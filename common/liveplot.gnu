@@ -28,6 +28,8 @@
 #  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 #  POSSIBILITY OF SUCH DAMAGE.
 # *****************************************************************************/
+# filename may also be a pipe from the shared memory telemetry, e.g.
+#   filename='< ./tsn-telemetry -g -c 100 NAME'
 set xrange[0:100]
 set yrange[-YMAX:YMAX]
 
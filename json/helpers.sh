@@ -32,6 +32,9 @@
 
 # Helper functions. This script executes nothing.
 
+# Compiled single-pass result analyzer, awk pipelines are used if missing
+TSN_ANALYZE=${TSN_ANALYZE:-./tsn-analyze}
+
 ###############################################################################
 # PHASE: Init
 
@@ -262,6 +265,15 @@ calc_rx_u2u(){
         local RX_FILENAME=$1 #*-rxtstamps.txt
         SHORTNAME=$(echo $RX_FILENAME | awk -F"-" '{print $1}')
 
+        rm -f saved_pct.txt
+        if [ -x "$TSN_ANALYZE" ]; then
+                $TSN_ANALYZE -m u2u,pct -o $SHORTNAME-traffic.txt $RX_FILENAME > temp0.txt
+                head -2 temp0.txt | column -t > saved1.txt
+                tail -2 temp0.txt | column -t > saved_pct.txt
+                rm temp*.txt
+                return
+        fi
+
         #U2U stats
         cat $RX_FILENAME | \
                 awk '{ print $1 "\t" $2}' | \
@@ -290,6 +302,16 @@ calc_return_u2u(){
         local RX_FILENAME=$1 #*-rxtstamps.txt
         SHORTNAME=$(echo $RX_FILENAME | awk -F"-" '{print $1}')
 
+        rm -f saved_pct.txt
+        if [ -x "$TSN_ANALYZE" ]; then
+                $TSN_ANALYZE -m u2u,pct -l 14 -s 9 -p 2 -o $SHORTNAME-traffic.txt \
+                        $RX_FILENAME > temp0.txt
+                head -2 temp0.txt | column -t > saved1.txt
+                tail -2 temp0.txt | column -t > saved_pct.txt
+                rm temp*.txt
+                return
+        fi
+
         #U2U stats
         cat $RX_FILENAME | \
                 awk '{ print $14 "\t" $9}' | \
@@ -320,7 +342,19 @@ calc_stddev_u2u(){
         local RETURN_TRAFFIC=$1
         local RX_FILENAME=$2 #*-rxtstamps.txt
 
-        if [[ RETURN_TRAFFIC == "YES" ]]; then
+        if [ -x "$TSN_ANALYZE" ]; then
+                if [[ "$RETURN_TRAFFIC" == "YES" ]]; then
+                        $TSN_ANALYZE -m stddev -l 14 -s 9 $RX_FILENAME > temp0.txt
+                else
+                        $TSN_ANALYZE -m stddev $RX_FILENAME > temp0.txt
+                fi
+                paste saved1.txt temp0.txt | column -t > temp1.txt
+                cat temp1.txt > saved1.txt
+                rm temp*.txt
+                return
+        fi
+
+        if [[ "$RETURN_TRAFFIC" == "YES" ]]; then
            STDDEV_U2U=$(cat $RX_FILENAME | \
                         awk '{ print $14 }' | \
                         awk '{sum+=$1; array[NR]=$1}
@@ -363,6 +397,14 @@ calc_rx_duploss(){
         # Packet count from json file
         PACKET_COUNT=$(grep -s packet_count $JSON_FILE | awk '{print $2}' | sed 's/,//')
 
+        if [ -x "$TSN_ANALYZE" ]; then
+                $TSN_ANALYZE -m duploss -n $PACKET_COUNT $XDP_TX_FILENAME > temp0.txt
+                paste saved1.txt temp0.txt | column -t
+                [ -f saved_pct.txt ] && cat saved_pct.txt
+                rm temp*.txt
+                return
+        fi
+
         # Total packets received
         PACKET_RX=$(cat $XDP_TX_FILENAME \
                 | awk '{print $2}' \
@@ -395,17 +437,22 @@ calc_return_duploss(){
         # Packet count from json file
         PACKET_COUNT=$(grep -s packet_count $JSON_FILE | awk '{print $2}' | sed 's/,//')
 
-        # Total packets received
-        PACKET_RX=$(cat $XDP_TX_FILENAME \
-                | awk '{print $9}' \
-                | grep -x -E '[0-9]+' \
-                | wc -l)
-
-        # Total duplicate
-        PACKET_DUPL=$(cat $XDP_TX_FILENAME \
-                | awk '{print $2}' \
-                | uniq -D \
-                | wc -l)
+        if [ -x "$TSN_ANALYZE" ]; then
+                read PACKET_RX PACKET_DUPL <<< $($TSN_ANALYZE -m duploss -s 2 -r 9 \
+                        $XDP_TX_FILENAME | awk 'NR==2 {print $2, $3}')
+        else
+                # Total packets received
+                PACKET_RX=$(cat $XDP_TX_FILENAME \
+                        | awk '{print $9}' \
+                        | grep -x -E '[0-9]+' \
+                        | wc -l)
+
+                # Total duplicate
+                PACKET_DUPL=$(cat $XDP_TX_FILENAME \
+                        | awk '{print $2}' \
+                        | uniq -D \
+                        | wc -l)
+        fi
 
         # Total fwd errors: duplicate, failed, empty
         PACKET_ERR=$(cat $XDP_TX_FILENAME \
@@ -424,6 +471,7 @@ calc_return_duploss(){
                         "$PACKET_COUNT\t$PACKET_RX\t$PACKET_DUPL\t$PACKET_LOSS" > temp0.txt
         fi
         paste saved1.txt temp0.txt | column -t
+        [ -f saved_pct.txt ] && cat saved_pct.txt
         rm temp*.txt
 }
 
@@ -436,6 +484,13 @@ calc_tbs_stddev(){
         local RX_FILENAME=$1 #*-rxtstamps.txt
         local TIME_DELTA_FILE=time_delta.txt
 
+        if [ -x "$TSN_ANALYZE" ]; then
+                echo "---------------------------------------------------------------------------------------"
+                $TSN_ANALYZE -m tbs -t 6 $RX_FILENAME > saved_tbs.txt
+                cat saved_tbs.txt
+                return
+        fi
+
         [[ -f $TIME_DELTA_FILE ]] && rm -f $TIME_DELTA_FILE
 
         #time delta stats
@@ -497,6 +552,25 @@ stop_if_empty(){
         echo "$1 has $COUNT lines"
 }
 
+save_profile(){
+        # Latency histogram plus run metadata, for comparing runs with
+        # tsn-compare. Extra args go to tsn-analyze (columns, -M key=val).
+        local RX_FILENAME=$1
+        local PROFILE=$2
+        shift 2
+
+        if [ ! -x "$TSN_ANALYZE" ] || [ ! -s "$RX_FILENAME" ]; then
+                return
+        fi
+
+        $TSN_ANALYZE -m pct -H $PROFILE \
+                -M "kernel=$(uname -r)" \
+                -M "cmdline=$(cat /proc/cmdline)" \
+                -M "bios=$(cat /sys/class/dmi/id/bios_version 2> /dev/null)" \
+                -M "platform=$PLAT" -M "config=$CONFIG" \
+                "$@" $RX_FILENAME > /dev/null
+}
+
 save_result_files(){
 
         ID=$(date +%Y%m%d)
@@ -513,13 +587,32 @@ save_result_files(){
         NUMPKTS=$(grep -s packet_count $JSON_FILE | awk '{print $2}' | sed 's/,//')
         INTERVAL=$(grep -s cycle_time_ns $JSON_FILE | awk '{print $2}' | sed 's/,//')
 
+        # Offsets from json file, for the run profile
+        META="-M packets=$NUMPKTS -M cycle_time_ns=$INTERVAL"
+        for KEY in publish_offset_ns early_offset_ns offset_ns; do
+                VAL=$(grep -s "\"$KEY\"" $JSON_FILE | head -1 | awk '{print $2}' | sed 's/,//')
+                META="$META -M $KEY=$VAL"
+        done
+
+        # Return configs (2x, 3x) log the round trip in column 14
+        COLS=""
+        if [ "$(echo $CONFIG | cut -c 10)" -ge 2 ] 2> /dev/null; then
+                COLS="-l 14 -s 9"
+        fi
+
         case "$CONFIG" in
 
         opcua-pkt0b | opcua-pkt1b | opcua-pkt2a | opcua-pkt2b | opcua-pkt3a | opcua-pkt3b)
                 cp afpkt-rxtstamps.txt results-$ID/$PLAT-afpkt-$CONFIG-$KERNEL_VER-$NUMPKTS-$INTERVAL-rxtstamps-$IDD.txt
+                save_profile afpkt-rxtstamps.txt \
+                        results-$ID/$PLAT-afpkt-$CONFIG-$KERNEL_VER-$NUMPKTS-$INTERVAL-profile-$IDD.txt \
+                        -M mode=afpkt $META $COLS
         ;;
         opcua-xdp0b | opcua-xdp1b | opcua-xdp2a | opcua-xdp2b | opcua-xdp3a | opcua-xdp3b)
                 cp afxdp-rxtstamps.txt results-$ID/$PLAT-afxdp-$CONFIG-$KERNEL_VER-$NUMPKTS-$INTERVAL-rxtstamps-$IDD.txt
+                save_profile afxdp-rxtstamps.txt \
+                        results-$ID/$PLAT-afxdp-$CONFIG-$KERNEL_VER-$NUMPKTS-$INTERVAL-profile-$IDD.txt \
+                        -M mode=afxdp $META $COLS
         ;;
         *)
                 echo "Error: save_results_files() invalid config: $CONFIG"
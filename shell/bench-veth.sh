@@ -0,0 +1,73 @@
+#!/bin/bash
+#/******************************************************************************
+#  Copyright (c) 2020, Intel Corporation
+#  All rights reserved.
+
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+
+#   1. Redistributions of source code must retain the above copyright notice,
+#      this list of conditions and the following disclaimer.
+
+#   2. Redistributions in binary form must reproduce the above copyright
+#      notice, this list of conditions and the following disclaimer in the
+#      documentation and/or other materials provided with the distribution.
+
+#   3. Neither the name of the copyright holder nor the names of its
+#      contributors may be used to endorse or promote products derived from
+#      this software without specific prior written permission.
+
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+#  POSSIBILITY OF SUCH DAMAGE.
+# End-to-end latency benchmark over a veth pair, run by `make bench`.
+# Runs txrx-tsn in single-host loopback mode (-L) and prints one JSON line.
+#
+# Usage: bench-veth.sh [txrx-tsn binary] [frames] [cycle_ns]
+
+TXRX=${1:-./txrx-tsn}
+FRAMES=${2:-20000}
+CYCLE=${3:-100000}
+VETH_TX=tsnbench0
+VETH_RX=tsnbench1
+OUT=$(mktemp /tmp/tsn-bench.XXXXXX)
+
+if [ "$(id -u)" -ne 0 ]; then
+        echo '{"bench":"veth_e2e","skipped":"needs root"}'
+        exit 0
+fi
+
+cleanup() {
+        ip link del $VETH_TX 2> /dev/null
+        rm -f $OUT
+}
+trap cleanup EXIT
+
+ip link add $VETH_TX type veth peer name $VETH_RX || exit 1
+ip link set $VETH_TX up
+ip link set $VETH_RX up
+sleep 1
+
+$TXRX -P -i $VETH_TX -L $VETH_RX -n $FRAMES -y $CYCLE > $OUT 2> /dev/null
+
+# Column 1 is the user-space to user-space latency in ns
+cut -f 1 $OUT | sort -n | awk -v frames=$FRAMES -v cycle=$CYCLE '
+        { lat[NR] = $1; sum += $1 }
+        END {
+                if (NR == 0) {
+                        printf("{\"bench\":\"veth_e2e\",\"error\":\"no packets received\"}\n");
+                        exit 1;
+                }
+                printf("{\"bench\":\"veth_e2e\",\"frames\":%d,\"cycle_ns\":%d,", frames, cycle);
+                printf("\"received\":%d,\"lost\":%d,", NR, frames - NR);
+                printf("\"latency_ns\":{\"min\":%d,\"mean\":%.0f,\"p50\":%d,", lat[1], sum / NR, lat[int(NR * 0.50) + 1]);
+                printf("\"p99\":%d,\"p999\":%d,\"max\":%d}}\n", lat[int(NR * 0.99) + 1], lat[int(NR * 0.999) + 1], lat[NR]);
+        }'
@@ -34,6 +34,8 @@
 ###############################################################################
 # Defines and defaults
 SEC_IN_NSEC=1000000000
+# Compiled single-pass result analyzer, awk pipelines are used if missing
+TSN_ANALYZE=${TSN_ANALYZE:-./tsn-analyze}
 
 ###############################################################################
 # PHASE: Iniatialization
@@ -472,6 +474,15 @@ calc_rx_u2u(){
         local RX_FILENAME=$1 #*-rxtstamps.txt
         SHORTNAME=$(echo $RX_FILENAME | awk -F"-" '{print $1}')
 
+        rm -f saved_pct.txt
+        if [ -x "$TSN_ANALYZE" ]; then
+                $TSN_ANALYZE -m u2u,pct -o $SHORTNAME-traffic.txt $RX_FILENAME > temp0.txt
+                head -2 temp0.txt | column -t > saved1.txt
+                tail -2 temp0.txt | column -t > saved_pct.txt
+                rm temp*.txt
+                return
+        fi
+
         #U2U stats
         cat $RX_FILENAME | \
                 awk '{ print $1 "\t" $2}' | \
@@ -496,6 +507,14 @@ calc_rx_duploss(){
         local XDP_RX_FILENAME=$1 #*-txtstamps.txt
         local PACKET_COUNT=$2 #Number of packets
 
+        if [ -x "$TSN_ANALYZE" ]; then
+                $TSN_ANALYZE -m duploss -n $PACKET_COUNT $XDP_RX_FILENAME > temp0.txt
+                paste saved1.txt temp0.txt | column -t
+                [ -f saved_pct.txt ] && cat saved_pct.txt
+                rm temp*.txt
+                return
+        fi
+
         # Total packets received
         PACKET_RX=$(cat $XDP_RX_FILENAME \
                 | awk '{print $2}' \
@@ -518,6 +537,20 @@ calc_rx_duploss(){
         rm temp*.txt
 }
 
+calc_tx_launch(){
+        # Launch time accuracy from a txrx-tsn TX log:
+        # seq, user txtime, hw txtime, launch txtime, queue
+        # hw txtime needs -h on the TX side, NoHWTS counts rows without it.
+        local TX_FILENAME=$1 #*-txtstamps.txt
+
+        if [ ! -x "$TSN_ANALYZE" ] || [ ! -s "$TX_FILENAME" ]; then
+                return
+        fi
+
+        echo "Launch time error (hw txtime - launch txtime, ns): $TX_FILENAME"
+        $TSN_ANALYZE -m launch $TX_FILENAME | column -t | tee saved_launch.txt
+}
+
 stop_if_empty(){
         wc -l $1 > /dev/null
         if [ $? -gt 0 ]; then
@@ -533,6 +566,25 @@ stop_if_empty(){
         echo "$1 has $COUNT lines"
 }
 
+save_profile(){
+        # Latency histogram plus run metadata, for comparing runs with
+        # tsn-compare. Extra args go to tsn-analyze (columns, -M key=val).
+        local RX_FILENAME=$1
+        local PROFILE=$2
+        shift 2
+
+        if [ ! -x "$TSN_ANALYZE" ] || [ ! -s "$RX_FILENAME" ]; then
+                return
+        fi
+
+        $TSN_ANALYZE -m pct -H $PROFILE \
+                -M "kernel=$(uname -r)" \
+                -M "cmdline=$(cat /proc/cmdline)" \
+                -M "bios=$(cat /sys/class/dmi/id/bios_version 2> /dev/null)" \
+                -M "platform=$PLAT" -M "config=$CONFIG" \
+                "$@" $RX_FILENAME > /dev/null
+}
+
 save_result_files(){
 
         ID=$(date +%Y%m%d)
@@ -554,8 +606,16 @@ save_result_files(){
         vs1b)
                 if [[ "$XDP_MODE" != "NA" ]]; then
                     cp afxdp-rxtstamps.txt results-$ID/$PLAT-afxdp-$CONFIG-$KERNEL_VER-$NUMPKTS-$SIZE-$XDP_INTERVAL-rxtstamps-$IDD.txt
+                    save_profile afxdp-rxtstamps.txt \
+                        results-$ID/$PLAT-afxdp-$CONFIG-$KERNEL_VER-$NUMPKTS-$SIZE-$XDP_INTERVAL-profile-$IDD.txt \
+                        -M mode=afxdp -M xdp_mode=$XDP_MODE -M packets=$NUMPKTS -M size=$SIZE \
+                        -M interval=$XDP_INTERVAL -M early_offset=$XDP_EARLY_OFFSET
                 fi
                 cp afpkt-rxtstamps.txt results-$ID/$PLAT-afpkt-$CONFIG-$KERNEL_VER-$NUMPKTS-$SIZE-$INTERVAL-rxtstamps-$IDD.txt
+                save_profile afpkt-rxtstamps.txt \
+                        results-$ID/$PLAT-afpkt-$CONFIG-$KERNEL_VER-$NUMPKTS-$SIZE-$INTERVAL-profile-$IDD.txt \
+                        -M mode=afpkt -M packets=$NUMPKTS -M size=$SIZE -M interval=$INTERVAL \
+                        -M early_offset=$EARLY_OFFSET -M txtime_offset=$TXTIME_OFFSET
         ;;
 
         *)
@@ -73,9 +73,17 @@ if [ "$AFP_PACKET_TEST" = "y" ]; then
         fi
         sleep 5
 
-        echo "CMD: ./txrx-tsn -i $IFACE -PtTq $TX_PKT_Q -n $NUMPKTS -l $SIZE -y $INTERVAL -e $EARLY_OFFSET -o $TXTIME_OFFSET"
+        # TX_LAUNCH_REPORT=y: per-packet lines with hw tx timestamps for
+        # calc_tx_launch. Reading the error queue and printing every packet
+        # changes TX timing, so the numbers are not comparable to a plain run.
+        TX_LAUNCH_OPTS=""
+        if [ "$TX_LAUNCH_REPORT" = "y" ]; then
+                TX_LAUNCH_OPTS="-v -h"
+        fi
+
+        echo "CMD: ./txrx-tsn -i $IFACE -PtTq $TX_PKT_Q -n $NUMPKTS -l $SIZE -y $INTERVAL -e $EARLY_OFFSET -o $TXTIME_OFFSET $TX_LAUNCH_OPTS"
         ./txrx-tsn -i $IFACE -PtTq $TX_PKT_Q -n $NUMPKTS -l $SIZE -y $INTERVAL \
-                        -e $EARLY_OFFSET -o $TXTIME_OFFSET > afpkt-txtstamps.txt &
+                        -e $EARLY_OFFSET -o $TXTIME_OFFSET $TX_LAUNCH_OPTS > afpkt-txtstamps.txt &
         TXRX_PID=$!
 
         if ! ps -p $TXRX_PID > /dev/null; then
@@ -91,6 +99,9 @@ if [ "$AFP_PACKET_TEST" = "y" ]; then
         sleep $SLEEP_SEC
         pkill iperf3
         pkill txrx-tsn
+        if [ "$TX_LAUNCH_REPORT" = "y" ]; then
+                calc_tx_launch afpkt-txtstamps.txt
+        fi
 else
         echo "PHASE 1: AF_PACKET is not configured to run."
 fi
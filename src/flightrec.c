@@ -0,0 +1,219 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "flightrec.h"
+
+#define FLIGHTREC_IDLE_NS	10000000
+
+static const char *chan_names[FR_CHANNELS] = { "tx", "rx" };
+
+/* One block per trigger, oldest record first, the trigger marked with '*' */
+static void write_dump(FILE *fp, int chan, struct fr_channel *ch)
+{
+	uint64_t first, i;
+	struct fr_record *r;
+
+	first = ch->frozen_head > FR_RECORDS ? ch->frozen_head - FR_RECORDS : 0;
+	r = &ch->frozen[ch->frozen_trigger & (FR_RECORDS - 1)];
+
+	fprintf(fp, "# dump %s %u: seq=%lu latency=%ld wake=%ld flags=0x%x "
+		"records=%lu\n", chan_names[chan], ch->dumps, r->seq,
+		r->latency, r->wake, r->flags, ch->frozen_head - first);
+	fprintf(fp, "#\tseq\tuser_tx\tlaunch\thw_tx\thw_rx\tuser_rx"
+		"\tlatency\twake\tring\tqueue\tflags\n");
+
+	for (i = first; i < ch->frozen_head; i++) {
+		r = &ch->frozen[i & (FR_RECORDS - 1)];
+		fprintf(fp, "%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%ld\t%ld\t%u\t%u\t0x%x\n",
+			i == ch->frozen_trigger ? "*" : "",
+			r->seq, r->user_tx, r->launch, r->hw_tx, r->hw_rx,
+			r->user_rx, r->latency, r->wake, r->ring, r->queue,
+			r->flags);
+	}
+	fflush(fp);
+}
+
+static void *flightrec_writer_thread(void *arg)
+{
+	struct flightrec *fr = (struct flightrec *)arg;
+	struct timespec idle = { 0, FLIGHTREC_IDLE_NS };
+	struct fr_channel *ch;
+	int busy, stop, c;
+
+	while (1) {
+		stop = __atomic_load_n(&fr->stop, __ATOMIC_ACQUIRE);
+		busy = 0;
+
+		for (c = 0; c < FR_CHANNELS; c++) {
+			ch = &fr->chan[c];
+			if (!__atomic_load_n(&ch->pending, __ATOMIC_ACQUIRE))
+				continue;
+			write_dump(fr->fp, c, ch);
+			__atomic_store_n(&ch->pending, 0, __ATOMIC_RELEASE);
+			busy = 1;
+		}
+
+		if (stop)
+			break;
+		if (!busy)
+			nanosleep(&idle, NULL);
+	}
+
+	return NULL;
+}
+
+struct flightrec *flightrec_open(const char *path, int64_t threshold_ns,
+				 const char *info)
+{
+	struct flightrec *fr;
+	int c;
+
+	fr = calloc(1, sizeof(*fr));
+	if (!fr)
+		return NULL;
+
+	fr->fp = fopen(path, "w");
+	if (!fr->fp) {
+		free(fr);
+		return NULL;
+	}
+
+	/* Fault in both rings of every channel now rather than on trigger */
+	mlock(fr, sizeof(*fr));
+	fr->threshold_ns = threshold_ns;
+	for (c = 0; c < FR_CHANNELS; c++)
+		fr->chan[c].active = fr->chan[c].ring[0];
+
+	fprintf(fr->fp, "# txrx-tsn flight recorder v1 records=%d post=%d "
+		"threshold_ns=%ld %s\n", FR_RECORDS, FR_POST, threshold_ns,
+		info ? info : "");
+	fflush(fr->fp);
+
+	if (pthread_create(&fr->thread, NULL, flightrec_writer_thread, fr)) {
+		fclose(fr->fp);
+		free(fr);
+		return NULL;
+	}
+
+	return fr;
+}
+
+/* Hand the active ring to the writer and continue in the spare one */
+static void flightrec_freeze(struct fr_channel *ch)
+{
+	ch->frozen = ch->active;
+	ch->frozen_head = ch->head;
+	ch->frozen_trigger = ch->trigger;
+	ch->dumps++;
+	__atomic_store_n(&ch->pending, 1, __ATOMIC_RELEASE);
+
+	ch->active = ch->active == ch->ring[0] ? ch->ring[1] : ch->ring[0];
+	ch->head = 0;
+	ch->post_left = 0;
+}
+
+/* RT side, one thread per channel */
+void flightrec_record(struct flightrec *fr, int chan, struct fr_record *rec)
+{
+	struct fr_channel *ch = &fr->chan[chan];
+
+	if (chan == FR_RX) {
+		if (fr->threshold_ns && rec->latency > fr->threshold_ns)
+			rec->flags |= FR_F_LATENCY;
+		if (ch->records && rec->seq > ch->last_seq + 1)
+			rec->flags |= FR_F_GAP;
+		ch->last_seq = rec->seq;
+	}
+
+	ch->active[ch->head & (FR_RECORDS - 1)] = *rec;
+	ch->head++;
+	ch->records++;
+	if (rec->flags & FR_F_TRIGGER)
+		ch->triggers++;
+
+	/* Triggers inside a window only show up in its flags column */
+	if (ch->post_left) {
+		if (!--ch->post_left)
+			flightrec_freeze(ch);
+		return;
+	}
+
+	if (!(rec->flags & FR_F_TRIGGER))
+		return;
+
+	if (ch->dumps >= FR_MAX_DUMPS ||
+	    __atomic_load_n(&ch->pending, __ATOMIC_ACQUIRE)) {
+		ch->suppressed++;
+		return;
+	}
+
+	ch->trigger = ch->head - 1;
+	ch->post_left = FR_POST;
+}
+
+/* Dump a window still collecting post-trigger records, then stop */
+void flightrec_close(struct flightrec *fr)
+{
+	struct fr_channel *ch;
+	int c;
+
+	if (!fr)
+		return;
+
+	for (c = 0; c < FR_CHANNELS; c++) {
+		ch = &fr->chan[c];
+		if (ch->post_left &&
+		    !__atomic_load_n(&ch->pending, __ATOMIC_ACQUIRE))
+			flightrec_freeze(ch);
+	}
+
+	__atomic_store_n(&fr->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(fr->thread, NULL);
+
+	for (c = 0; c < FR_CHANNELS; c++) {
+		ch = &fr->chan[c];
+		if (!ch->records)
+			continue;
+		fprintf(fr->fp, "# total %s records=%lu triggers=%lu dumps=%u "
+			"suppressed=%lu\n", chan_names[c], ch->records,
+			ch->triggers, ch->dumps, ch->suppressed);
+	}
+	fclose(fr->fp);
+	free(fr);
+}
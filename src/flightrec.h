@@ -0,0 +1,162 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef FLIGHTREC_HEADER
+#define FLIGHTREC_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* Latency-spike flight recorder. Each RT thread keeps its last
+ * FR_RECORDS per-packet records in a channel. A trigger (u2u latency over
+ * the threshold, a sequence gap or a TX deadline miss) lets FR_POST more
+ * records in, then the ring is frozen and swapped for a spare one, and a
+ * writer thread dumps the frozen window to the file. Nothing is written
+ * while no trigger fires.
+ */
+#define FR_RECORDS	1024	//Must be a power of two
+#define FR_POST		256	//Records kept after the trigger
+#define FR_MAX_DUMPS	64	//Per channel, later triggers are only counted
+
+#define FR_TX		0
+#define FR_RX		1
+#define FR_CHANNELS	2
+
+/* Record flags */
+#define FR_F_MISS	(1 << 0)	//TX deadline miss, set by the caller
+#define FR_F_LATENCY	(1 << 1)	//RX latency over the threshold
+#define FR_F_GAP	(1 << 2)	//RX sequence gap
+#define FR_F_TRIGGER	(FR_F_MISS | FR_F_LATENCY | FR_F_GAP)
+
+/* All times in clock domain ns, 0 if not available on this path. wake is
+ * the wakeup delay: user txtime - scheduled wakeup on TX, user rxtime -
+ * hw rxtime on RX. ring is the socket ring occupancy (AF_XDP only).
+ */
+struct fr_record {
+	uint64_t seq;
+	uint64_t user_tx;
+	uint64_t launch;
+	uint64_t hw_tx;
+	uint64_t hw_rx;
+	uint64_t user_rx;
+	int64_t latency;
+	int64_t wake;
+	uint32_t ring;
+	uint16_t queue;
+	uint16_t flags;
+};
+
+struct fr_channel {
+	/* RT side */
+	struct fr_record *active;
+	uint64_t head;		//Records written to the active ring
+	uint64_t trigger;	//Index of the pending trigger in the active ring
+	int post_left;		//Records until freeze, 0 when armed
+	uint64_t last_seq;
+	uint64_t records;
+	uint64_t triggers;
+	uint64_t suppressed;	//Triggers while the previous dump was pending
+	uint32_t dumps;
+
+	/* Handed to the writer while pending is set */
+	int pending __attribute__((aligned(64)));
+	struct fr_record *frozen;
+	uint64_t frozen_head;
+	uint64_t frozen_trigger;
+
+	struct fr_record ring[2][FR_RECORDS];
+};
+
+struct flightrec {
+	FILE *fp;
+	pthread_t thread;
+	int stop;
+	int64_t threshold_ns;	//RX latency trigger, 0 to disable
+	struct fr_channel chan[FR_CHANNELS];
+};
+
+struct flightrec *flightrec_open(const char *path, int64_t threshold_ns,
+				 const char *info);
+void flightrec_record(struct flightrec *fr, int chan, struct fr_record *rec);
+void flightrec_close(struct flightrec *fr);
+
+static inline void flightrec_tx(struct flightrec *fr, uint64_t seq,
+				uint64_t wake, uint64_t user_tx,
+				uint64_t launch, uint64_t hw_tx,
+				uint32_t ring, uint16_t queue, int miss)
+{
+	struct fr_record rec;
+
+	if (!fr)
+		return;
+
+	rec.seq = seq;
+	rec.user_tx = user_tx;
+	rec.launch = launch;
+	rec.hw_tx = hw_tx;
+	rec.hw_rx = 0;
+	rec.user_rx = 0;
+	rec.latency = 0;
+	rec.wake = (int64_t)(user_tx - wake);
+	rec.ring = ring;
+	rec.queue = queue;
+	rec.flags = miss ? FR_F_MISS : 0;
+	flightrec_record(fr, FR_TX, &rec);
+}
+
+/* hw_tx is what the frame carries, the hw txtime of seq - 1 */
+static inline void flightrec_rx(struct flightrec *fr, uint64_t seq,
+				uint64_t user_tx, uint64_t launch,
+				uint64_t hw_tx, uint64_t hw_rx,
+				uint64_t user_rx, uint32_t ring, uint16_t queue)
+{
+	struct fr_record rec;
+
+	if (!fr)
+		return;
+
+	rec.seq = seq;
+	rec.user_tx = user_tx;
+	rec.launch = launch;
+	rec.hw_tx = hw_tx;
+	rec.hw_rx = hw_rx;
+	rec.user_rx = user_rx;
+	rec.latency = (int64_t)(user_rx - user_tx);
+	rec.wake = hw_rx ? (int64_t)(user_rx - hw_rx) : 0;
+	rec.ring = ring;
+	rec.queue = queue;
+	rec.flags = 0;
+	flightrec_record(fr, FR_RX, &rec);
+}
+
+#endif
@@ -0,0 +1,406 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef WITH_XDP
+#include <linux/if_xdp.h>
+#endif
+
+#include "metrics.h"
+
+#if defined(WITH_XDP) && !defined(SOL_XDP)
+#define SOL_XDP 283
+#endif
+
+#define METRICS_REQ_LEN		256
+#define METRICS_RESP_LEN	(64 * 1024)
+
+#ifdef WITH_XDP
+struct xdp_sock_ref {
+	char name[METRICS_NAME_LEN];
+	int fd;
+};
+
+static struct xdp_sock_ref xdp_socks[METRICS_MAX_XDP];
+static uint32_t xdp_count;
+#endif
+
+static struct metrics_block *blocks[METRICS_MAX_BLOCKS];
+static uint32_t block_count;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled;
+static char sock_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+int metrics_enabled(void)
+{
+	return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+/* Find or register the block for (name, stream_id). Registration takes a
+ * mutex and allocates, so it is only called during setup; RT threads keep
+ * the returned pointers (see metrics_rx_block()).
+ */
+struct metrics_block *metrics_get(const char *name, uint32_t stream_id)
+{
+	struct metrics_block *b = NULL;
+	uint32_t i;
+
+	if (!metrics_enabled())
+		return NULL;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (i = 0; i < block_count; i++) {
+		if (blocks[i]->stream_id == stream_id &&
+		    !strncmp(blocks[i]->name, name, METRICS_NAME_LEN - 1)) {
+			b = blocks[i];
+			goto out;
+		}
+	}
+
+	if (block_count == METRICS_MAX_BLOCKS)
+		goto out;
+
+	if (posix_memalign((void **)&b, 64, sizeof(*b))) {
+		b = NULL;
+		goto out;
+	}
+	memset(b, 0, sizeof(*b));
+	mlock(b, sizeof(*b));
+	strncpy(b->name, name, METRICS_NAME_LEN - 1);
+	b->stream_id = stream_id;
+
+	__atomic_store_n(&blocks[block_count], b, __ATOMIC_RELEASE);
+	__atomic_store_n(&block_count, block_count + 1, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&metrics_lock);
+	return b;
+}
+
+#ifdef WITH_XDP
+void metrics_add_xdp_socket(const char *name, int fd)
+{
+	if (!metrics_enabled())
+		return;
+
+	pthread_mutex_lock(&metrics_lock);
+	if (xdp_count < METRICS_MAX_XDP) {
+		strncpy(xdp_socks[xdp_count].name, name, METRICS_NAME_LEN - 1);
+		xdp_socks[xdp_count].fd = fd;
+		xdp_count++;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+}
+#endif
+
+/* Upper bound in ns of the bin holding the p-th fraction of samples */
+static int64_t hist_pct(const uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t sum = 0, target;
+	int i;
+
+	if (!total)
+		return 0;
+
+	target = (uint64_t)(p * total);
+	if (target >= total)
+		target = total - 1;
+
+	for (i = 0; i < METRICS_HIST_BINS; i++) {
+		sum += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+		if (sum > target)
+			break;
+	}
+	return (int64_t)(i + 1) * METRICS_BIN_NS;
+}
+
+struct block_view {
+	const char *name;
+	char stream[12];	//Stream id, or "other"
+	uint64_t packets;
+	uint64_t drops;
+	uint64_t deadline_misses;
+	uint64_t samples;
+	int64_t lat_max;
+	int64_t p50, p99, p999;
+};
+
+static void block_read(struct metrics_block *b, struct block_view *v)
+{
+	int i;
+
+	v->name = b->name;
+	if (b->stream_id == METRICS_STREAM_OTHER)
+		strcpy(v->stream, "other");
+	else
+		snprintf(v->stream, sizeof(v->stream), "%u", b->stream_id);
+	v->packets = __atomic_load_n(&b->packets, __ATOMIC_RELAXED);
+	v->drops = __atomic_load_n(&b->drops, __ATOMIC_RELAXED);
+	v->deadline_misses = __atomic_load_n(&b->deadline_misses, __ATOMIC_RELAXED);
+	v->lat_max = __atomic_load_n(&b->lat_max, __ATOMIC_RELAXED);
+
+	v->samples = 0;
+	for (i = 0; i < METRICS_HIST_BINS; i++)
+		v->samples += __atomic_load_n(&b->hist[i], __ATOMIC_RELAXED);
+
+	v->p50 = hist_pct(b->hist, v->samples, 0.50);
+	v->p99 = hist_pct(b->hist, v->samples, 0.99);
+	v->p999 = hist_pct(b->hist, v->samples, 0.999);
+}
+
+#ifdef WITH_XDP
+static int xdp_read(int fd, struct xdp_statistics *st)
+{
+	socklen_t len = sizeof(*st);
+
+	memset(st, 0, sizeof(*st));
+	return getsockopt(fd, SOL_XDP, XDP_STATISTICS, st, &len);
+}
+#endif
+
+#define APPEND(...)							\
+	do {								\
+		int _n = snprintf(buf + len, size - len, __VA_ARGS__);	\
+		if (_n > 0)						\
+			len += ((size_t)_n < size - len) ? (size_t)_n : size - len - 1; \
+	} while (0)
+
+static size_t format_prometheus(char *buf, size_t size)
+{
+	uint32_t i, n = __atomic_load_n(&block_count, __ATOMIC_ACQUIRE);
+#ifdef WITH_XDP
+	struct xdp_statistics st;
+#endif
+	struct block_view v;
+	size_t len = 0;
+
+	APPEND("# TYPE tsn_packets_total counter\n"
+	       "# TYPE tsn_drops_total counter\n"
+	       "# TYPE tsn_deadline_misses_total counter\n"
+	       "# TYPE tsn_latency_ns summary\n");
+
+	for (i = 0; i < n; i++) {
+		block_read(blocks[i], &v);
+#define LABELS "thread=\"%s\",stream=\"%s\""
+		APPEND("tsn_packets_total{" LABELS "} %lu\n", v.name, v.stream, v.packets);
+		APPEND("tsn_drops_total{" LABELS "} %lu\n", v.name, v.stream, v.drops);
+		APPEND("tsn_deadline_misses_total{" LABELS "} %lu\n",
+		       v.name, v.stream, v.deadline_misses);
+		if (!v.samples)
+			continue;
+		APPEND("tsn_latency_ns{" LABELS ",quantile=\"0.5\"} %ld\n", v.name, v.stream, v.p50);
+		APPEND("tsn_latency_ns{" LABELS ",quantile=\"0.99\"} %ld\n", v.name, v.stream, v.p99);
+		APPEND("tsn_latency_ns{" LABELS ",quantile=\"0.999\"} %ld\n", v.name, v.stream, v.p999);
+		APPEND("tsn_latency_ns{" LABELS ",quantile=\"1\"} %ld\n", v.name, v.stream, v.lat_max);
+		APPEND("tsn_latency_ns_count{" LABELS "} %lu\n", v.name, v.stream, v.samples);
+#undef LABELS
+	}
+
+#ifdef WITH_XDP
+	for (i = 0; i < xdp_count; i++) {
+		if (xdp_read(xdp_socks[i].fd, &st))
+			continue;
+#define XDP_STAT(f) APPEND("tsn_xdp_" #f "_total{socket=\"%s\"} %llu\n", \
+			   xdp_socks[i].name, st.f)
+		XDP_STAT(rx_dropped);
+		XDP_STAT(rx_invalid_descs);
+		XDP_STAT(tx_invalid_descs);
+		XDP_STAT(rx_ring_full);
+		XDP_STAT(rx_fill_ring_empty_descs);
+		XDP_STAT(tx_ring_empty_descs);
+#undef XDP_STAT
+	}
+#endif
+
+	return len;
+}
+
+static size_t format_json(char *buf, size_t size)
+{
+	uint32_t i, n = __atomic_load_n(&block_count, __ATOMIC_ACQUIRE);
+#ifdef WITH_XDP
+	struct xdp_statistics st;
+	int emitted = 0;
+#endif
+	struct block_view v;
+	size_t len = 0;
+
+	APPEND("{\"streams\":[");
+	for (i = 0; i < n; i++) {
+		block_read(blocks[i], &v);
+		APPEND("%s{\"thread\":\"%s\",\"stream\":\"%s\",\"packets\":%lu,"
+		       "\"drops\":%lu,\"deadline_misses\":%lu,"
+		       "\"latency_ns\":{\"count\":%lu,\"p50\":%ld,\"p99\":%ld,"
+		       "\"p999\":%ld,\"max\":%ld}}",
+		       i ? "," : "", v.name, v.stream, v.packets, v.drops,
+		       v.deadline_misses, v.samples, v.p50, v.p99, v.p999,
+		       v.lat_max);
+	}
+
+	APPEND("],\"xdp\":[");
+#ifdef WITH_XDP
+	for (i = 0; i < xdp_count; i++) {
+		if (xdp_read(xdp_socks[i].fd, &st))
+			continue;
+		APPEND("%s{\"socket\":\"%s\",\"rx_dropped\":%llu,"
+		       "\"rx_invalid_descs\":%llu,\"tx_invalid_descs\":%llu,"
+		       "\"rx_ring_full\":%llu,\"rx_fill_ring_empty_descs\":%llu,"
+		       "\"tx_ring_empty_descs\":%llu}",
+		       emitted++ ? "," : "", xdp_socks[i].name, st.rx_dropped,
+		       st.rx_invalid_descs, st.tx_invalid_descs, st.rx_ring_full,
+		       st.rx_fill_ring_empty_descs, st.tx_ring_empty_descs);
+	}
+#endif
+	APPEND("]}\n");
+
+	return len;
+}
+
+static void metrics_serve(int fd, char *resp)
+{
+	struct timeval tv = { 0, 200000 };
+	char req[METRICS_REQ_LEN];
+	size_t len, off;
+	ssize_t ret;
+	int http;
+
+	/* A plain client may send nothing at all; don't wait long for it */
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ret = recv(fd, req, sizeof(req) - 1, 0);
+	req[ret > 0 ? ret : 0] = '\0';
+	http = !strncmp(req, "GET ", 4);
+
+	off = 0;
+	if (http)
+		off = snprintf(resp, METRICS_RESP_LEN, "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: %s\r\n\r\n",
+			       strstr(req, "json") ? "application/json" :
+			       "text/plain; version=0.0.4");
+
+	if (strstr(req, "json"))
+		len = format_json(resp + off, METRICS_RESP_LEN - off);
+	else
+		len = format_prometheus(resp + off, METRICS_RESP_LEN - off);
+	len += off;
+
+	for (off = 0; off < len; off += ret) {
+		ret = send(fd, resp + off, len - off, MSG_NOSIGNAL);
+		if (ret <= 0)
+			break;
+	}
+}
+
+static void *metrics_thread(void *arg)
+{
+	int lsock = (int)(intptr_t)arg;
+	char *resp;
+	int fd;
+
+	resp = malloc(METRICS_RESP_LEN);
+	if (!resp)
+		return NULL;
+
+	while (1) {
+		fd = accept(lsock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		metrics_serve(fd, resp);
+		close(fd);
+	}
+
+	free(resp);
+	return NULL;
+}
+
+static void metrics_unlink(void)
+{
+	unlink(sock_path);
+}
+
+/* Listen on a Unix socket at path and serve metrics from a detached,
+ * normal priority thread.
+ */
+int metrics_server_start(const char *path)
+{
+	struct sockaddr_un addr;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int lsock;
+	int ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lsock < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(lsock, 4)) {
+		close(lsock);
+		return -1;
+	}
+
+	strcpy(sock_path, path);
+	atexit(metrics_unlink);
+	__atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+
+	/* Never inherit the caller's RT policy */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread, &attr, metrics_thread, (void *)(intptr_t)lsock);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		__atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+		close(lsock);
+		return -1;
+	}
+
+	return 0;
+}
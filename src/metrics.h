@@ -0,0 +1,130 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef METRICS_HEADER
+#define METRICS_HEADER
+
+#include <stdint.h>
+#include <string.h>
+
+/* Runtime counters served over a Unix domain socket by a non-RT thread.
+ * Every hot-path thread owns one cacheline-aligned block per stream and is
+ * its only writer; the server only reads. A request containing "json" gets
+ * JSON, anything else (incl. an HTTP GET) gets Prometheus text, e.g.
+ *   curl --unix-socket /run/txrx.sock http://localhost/metrics
+ *
+ * Blocks are registered with metrics_get() during setup. Receivers also
+ * register a METRICS_STREAM_OTHER block for frames of unexpected streams,
+ * so the hot path never takes the registry lock.
+ */
+#define METRICS_MAX_BLOCKS	32
+#define METRICS_STREAM_OTHER	UINT32_MAX	//Shown as stream "other"
+#define METRICS_MAX_XDP		4
+#define METRICS_NAME_LEN	16
+#define METRICS_HIST_BINS	1000	//Last bin collects overflow
+#define METRICS_BIN_NS		1000	//1us per bin
+
+struct metrics_block {
+	char name[METRICS_NAME_LEN];	//Thread role, e.g. "tx", "rx", "sub1"
+	uint32_t stream_id;
+
+	uint64_t packets;
+	uint64_t drops;
+	uint64_t deadline_misses;
+	uint64_t last_seq;		//Writer private, for drop detection
+	int64_t lat_max;
+	uint64_t hist[METRICS_HIST_BINS];
+} __attribute__((aligned(64)));
+
+int metrics_server_start(const char *path);
+int metrics_enabled(void);
+struct metrics_block *metrics_get(const char *name, uint32_t stream_id);
+#ifdef WITH_XDP
+void metrics_add_xdp_socket(const char *name, int fd);
+#endif
+
+static inline void metrics_add(uint64_t *counter, uint64_t val)
+{
+	__atomic_store_n(counter, *counter + val, __ATOMIC_RELAXED);
+}
+
+/* Block for a received frame: the expected stream's own block, or the
+ * shared "other" block for any other stream id. Both are NULL when metrics
+ * are disabled.
+ */
+static inline struct metrics_block *metrics_rx_block(struct metrics_block *expected,
+						     struct metrics_block *other,
+						     uint32_t stream_id)
+{
+	if (expected && expected->stream_id == stream_id)
+		return expected;
+	return other;
+}
+
+static inline void metrics_tx(struct metrics_block *b, int deadline_miss)
+{
+	if (!b)
+		return;
+
+	metrics_add(&b->packets, 1);
+	if (deadline_miss)
+		metrics_add(&b->deadline_misses, 1);
+}
+
+static inline void metrics_rx(struct metrics_block *b, uint64_t seq,
+			      int64_t latency)
+{
+	int64_t bin;
+
+	if (!b)
+		return;
+
+	/* Sequence numbers of mixed streams say nothing about drops */
+	if (b->stream_id != METRICS_STREAM_OTHER) {
+		if (b->packets && seq > b->last_seq + 1)
+			metrics_add(&b->drops, seq - b->last_seq - 1);
+		if (seq > b->last_seq)
+			b->last_seq = seq;
+	}
+	if (latency > b->lat_max)
+		__atomic_store_n(&b->lat_max, latency, __ATOMIC_RELAXED);
+
+	bin = latency / METRICS_BIN_NS;
+	if (bin < 0)
+		bin = 0;
+	else if (bin >= METRICS_HIST_BINS)
+		bin = METRICS_HIST_BINS - 1;
+	metrics_add(&b->hist[bin], 1);
+	metrics_add(&b->packets, 1);
+}
+
+#endif
@@ -97,10 +97,15 @@ int configureServer(struct ServerData *sdata)
 
         pub->writeFunc = &dummyDSWrite;
 
+        /* Register the metrics block before the RT threads need it */
+        pub->mx = metrics_get(pub->twoWayData ? "pubr" : "pub", pub->id);
+
         if( pub->twoWayData == false) {
             pub->readFunc = &pubGetDataToTransmit;
+            pub->payloadLen = PUB_PAYLOAD_LEN;
         } else {
             pub->readFunc = &pubReturnGetDataToTransmit;
+            pub->payloadLen = PUBRETURN_PAYLOAD_LEN;
 
             /* Don't start pubReturn until valid data available */
             g_roundtrip_pubReturn = false;
@@ -125,6 +130,7 @@ int configureServer(struct ServerData *sdata)
 
     for (int i = 0; i < sdata->subCount; i++) {
         struct SubscriberData *sub = &sdata->subData[i];
+        sub->mx = metrics_get(sub->twoWayData ? "subr" : "sub", sub->id);
         sub->readFunc = &dummyDSRead;
         if ( sub->twoWayData == false)
             sub->writeFunc = &subStoreDataReceived;
@@ -111,6 +111,9 @@ void free_resources(struct ServerData *sdata)
     for (i = 0; i < sdata->pubCount; i++) {
         if (sdata->pubData[i].url)
             free(sdata->pubData[i].url);
+
+        if (sdata->pubData[i].rtValue)
+            UA_DataValue_delete(sdata->pubData[i].rtValue);
     }
 
     if (sdata->pubData)
@@ -127,6 +130,9 @@ void free_resources(struct ServerData *sdata)
             fflush(sdata->subData[i].fpSubscriberOutput);
             fclose(sdata->subData[i].fpSubscriberOutput);
         }
+
+        pcapng_close(sdata->subData[i].pcap);
+        telemetry_detach(sdata->subData[i].telem);
     }
 
     if (sdata->subData)
@@ -169,6 +175,13 @@ struct ServerData *parseJson(struct json_object *json)
     catch_err(s->cycleTimeNs < HUNDRED_USEC_NSEC || s->cycleTimeNs > CYCLETIME_NS_MAX,
               "Invalid cycle_time_ns");
 
+    char *metricsPath = getOptionalStr(json, "metrics_socket", NULL);
+    if (metricsPath) {
+        int ret = metrics_server_start(metricsPath);
+        free(metricsPath);
+        catch_err(ret != 0, "Error in starting metrics endpoint");
+    }
+
     debug("Found: pub if %s, sub if %s, cycleTimeNs %ld pollNs %d, packet_count %ld",
             s->pubInterface, s->subInterface, s->cycleTimeNs,
             s->pollingDurationNs, s->packetCount);
@@ -243,6 +256,7 @@ struct ServerData *parseJson(struct json_object *json)
                   "Invalid writerGroupId");
 
         pd->twoWayData = getBool(pubJson, "two_way_data");
+        pd->rtFixedSize = getOptionalBool(pubJson, "rt_fixed_size", false);
 
         cpuAff = getInt(pubJson, "iperf_cpu_affinity");
         catch_err(cpuAff < 0 || cpuAff > 3, "Invalid iperf_cpu_affinity");
@@ -299,6 +313,21 @@ struct ServerData *parseJson(struct json_object *json)
         catch_err(sd->fpSubscriberOutput == NULL,
                   "Error in opening output file");
 
+        char *pcapFileName = getOptionalStr(subJson, "subscriber_pcapng_file", NULL);
+        if (pcapFileName) {
+            sd->pcap = pcapng_open(pcapFileName, "opcua-server",
+                                   s->subInterface, LINKTYPE_USER0);
+            free(pcapFileName);
+            catch_err(sd->pcap == NULL, "Error in opening pcapng file");
+        }
+
+        char *telemName = getOptionalStr(subJson, "subscriber_telemetry_shm", NULL);
+        if (telemName) {
+            sd->telem = telemetry_create(telemName);
+            free(telemName);
+            catch_err(sd->telem == NULL, "Error in creating telemetry segment");
+        }
+
         log("Subscriber: %s %s CPU%ld",
             sd->url, s->useXDP ? "AF_XDP" : "AF_PACKET", sd->cpuAffinity);
 
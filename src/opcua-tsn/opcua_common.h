@@ -42,8 +42,17 @@
 #include <sys/msg.h>
 
 #include "opcua_utils.h"
+#include "../pcapng.h"
+#include "../telemetry.h"
+#include "../metrics.h"
+#include "../tsn-probes.h"
 #define MAX_OPCUA_THREAD 6
 
+/* UInt64 values per published DataSet */
+#define PUB_PAYLOAD_LEN         2   /* tx_sequence, txTime */
+#define PUBRETURN_PAYLOAD_LEN   5   /* rx_sequence, txTime, rxTime, tx_sequence, txTime */
+#define PAYLOAD_MAX_LEN         5
+
 typedef UA_StatusCode (DSCallbackRead)(UA_Server *server,
         const UA_NodeId *sessionId, void *sessionContext,
         const UA_NodeId *nodeId, void *nodeContext, UA_Boolean sourceTimeStamp,
@@ -70,6 +79,13 @@ struct PublisherData {
     size_t cpuAffinity;
     DSCallbackRead *readFunc;
     DSCallbackWrite *writeFunc;
+    struct metrics_block *mx;       /* Metrics endpoint counters, see metrics.h */
+    UA_UInt64 txTime;               /* ETF launch time of the frame being built */
+    bool rtFixedSize;               /* Publish pre-encoded fixed-size messages */
+    size_t payloadLen;              /* PUB_PAYLOAD_LEN or PUBRETURN_PAYLOAD_LEN */
+    UA_UInt64 payload[PAYLOAD_MAX_LEN];  /* Published values, updated in place */
+    UA_DataValue *rtValue;          /* Static value source over payload, rtFixedSize only */
+    UA_Int64 lastSeq;               /* tx_sequence of the last frame, for probes */
 };
 
 struct SubscriberData {
@@ -82,12 +98,16 @@ struct SubscriberData {
     int32_t subscribedWGId;
     FILE *fpSubscriberOutput;
     char *subscriberOutputFileName;
+    struct pcapng_writer *pcap;     /* Optional pcapng export, NULL if unused */
+    struct telemetry *telem;        /* Optional shm telemetry, NULL if unused */
+    struct metrics_block *mx;       /* Metrics endpoint counters, see metrics.h */
     char *temp_targetVars;
     char *temp_dataSetMetaData;
     bool twoWayData;
     size_t cpuAffinity;
     DSCallbackRead *readFunc;
     DSCallbackWrite *writeFunc;
+    UA_UInt64 lastSeq;              /* Last received sequence, for probes */
 };
 
 struct ServerData {
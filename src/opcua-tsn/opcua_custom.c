@@ -45,6 +45,7 @@
 
 #include "opcua_custom.h"
 #include "opcua_common.h"
+#include "opcua_publish.h"
 
 #define CLOCKID                               CLOCK_TAI
 #define ONESEC_IN_NSEC                        (1000 * 1000 * 1000)
@@ -227,7 +228,12 @@ void *pub_thread(void *arg)
         if (!g_roundtrip_pubReturn)
             blank_counter++; //Do nothing
         else {
+            pData[ind].txTime = tx_timestamp;
+            TSN_PROBE2(pub_enter, pData[ind].lastSeq, tx_timestamp);
+            if (pData[ind].rtFixedSize)
+                refreshStaticValue(server, &pData[ind]);
             pubCallback(server, currentWriterGroup);
+            TSN_PROBE2(pub_exit, pData[ind].lastSeq, tx_timestamp);
             /* There is a problem of increased delay in 5.10 and above kernel if there is
              * no sleep after pubCallback.
              * Suspicion of unyielding process in pub/sub API in open62541-iotg.
@@ -278,7 +284,11 @@ void *sub_thread(void *arg)
 
     while (g_running) {
         clock_nanosleep(CLOCKID, TIMER_ABSTIME, &nextnanosleeptimeSub, NULL);
+        TSN_PROBE2(sub_enter, sData[ind].lastSeq,
+                   as_nanoseconds(&nextnanosleeptimeSub));
         subCallback(server, currentReaderGroup);
+        TSN_PROBE2(sub_exit, sData[ind].lastSeq,
+                   as_nanoseconds(&nextnanosleeptimeSub));
         /* There is a problem of increased delay in 5.10 and above kernel if there is
         * no sleep after subCallback.
         * Suspicion of unyielding process in pub/sub API in open62541-iotg.
@@ -65,6 +65,33 @@ extern UA_Boolean g_running, g_roundtrip_pubReturn;
 static UA_Int64 tx_sequence = -2; //TODO
 static UA_UInt64 prev_rx_sequence = 999;
 
+/* Queue the decoded DataSet values (UInt64 array) to the subscriber's
+ * pcapng writer. The callback has no access to the raw frame, so records use
+ * the USER0 link type. File I/O happens on the writer's own thread.
+ */
+static void subRecordPcapng(struct SubscriberData *sdata, const UA_Variant *v,
+                            UA_UInt64 rxTime, UA_UInt64 txTime, UA_Int64 latency)
+{
+    size_t count = (v->arrayLength == (size_t) -1) ? 1 : v->arrayLength;
+
+    pcapng_record(sdata->pcap, v->data, count * sizeof(UA_UInt64), rxTime,
+                  sdata->xdpQueue < 0 ? 0 : sdata->xdpQueue, txTime, latency);
+}
+
+/* Point the published DataValue at the publisher's preallocated payload.
+ * The array is owned by PublisherData and rewritten in place every cycle, so
+ * the publish path never allocates and the library has nothing to free.
+ */
+static void pubSetPayload(struct PublisherData *pdata, const UA_UInt64 *d,
+                          size_t len, UA_DataValue *data)
+{
+    memcpy(pdata->payload, d, len * sizeof(UA_UInt64));
+    UA_Variant_setArray(&data->value, pdata->payload, len,
+                        &UA_TYPES[UA_TYPES_UINT64]);
+    data->value.storageType = UA_VARIANT_DATA_NODELETE;
+    data->hasValue = true;
+}
+
 UA_StatusCode
 pubGetDataToTransmit(UA_Server *server, const UA_NodeId *sessionId,
                      void *sessionContext, const UA_NodeId *nodeId,
@@ -89,18 +116,17 @@ pubGetDataToTransmit(UA_Server *server, const UA_NodeId *sessionId,
 
     tx_sequence++;
     currentTime = as_nanoseconds(&current_time_timespec);
-    UA_UInt64 d[2] = {tx_sequence, currentTime};
+    UA_UInt64 d[PUB_PAYLOAD_LEN] = {tx_sequence, currentTime};
 
-    debug("[PUB] tx_sequence : %ld, time : %ld\n", tx_sequence, currentTime);
+    struct PublisherData *pdata = (struct PublisherData *)nodeContext;
+    /* Stamped after its own launch time, ETF will drop it */
+    metrics_tx(pdata->mx, currentTime > pdata->txTime);
+    pdata->lastSeq = tx_sequence;
 
-    UA_StatusCode retval = UA_Variant_setArrayCopy(&data->value, &d[0], 2,
-                                                   &UA_TYPES[UA_TYPES_UINT64]);
+    TSN_PROBE2(payload_stamp, tx_sequence, currentTime);
+    debug("[PUB] tx_sequence : %ld, time : %ld\n", tx_sequence, currentTime);
 
-    if (retval != UA_STATUSCODE_GOOD)
-            debug("[PUB]Error in transmitting data source\n");
-
-    data->hasValue = true;
-    data->value.storageType = UA_VARIANT_DATA_NODELETE;
+    pubSetPayload(pdata, d, PUB_PAYLOAD_LEN, data);
 
     if (tx_sequence == (UA_Int64)packetCount) {
         g_running = UA_FALSE;
@@ -156,16 +182,26 @@ subStoreDataReceived(UA_Server *server, const UA_NodeId *sessionId,
 
         msgqB.msg_type = MSGQ_TYPE;
         msgqB.rx_sequence = ptr_data[0];
+        sdata->lastSeq = msgqB.rx_sequence;
         msgqB.txTime = ptr_data[1];
         msgqB.rxTime = as_nanoseconds(&current_time_timespec);
 
         UA_Int64 latency = (UA_Int64)(msgqB.rxTime - msgqB.txTime);
+        TSN_PROBE3(rx_timestamp, msgqB.rx_sequence, RXhwTS, msgqB.rxTime);
 
         if (fpSubscriber != NULL) {
             fprintf(fpSubscriber, "%ld\t%ld\t%d\t%ld\t%ld\t%ld\n",
                     latency, msgqB.rx_sequence, sdata->id, msgqB.txTime, RXhwTS, msgqB.rxTime);
         }
 
+        if (sdata->pcap != NULL)
+            subRecordPcapng(sdata, &v, msgqB.rxTime, msgqB.txTime, latency);
+
+        if (sdata->telem != NULL)
+            telemetry_update(sdata->telem, msgqB.rx_sequence, latency, msgqB.rxTime);
+
+        metrics_rx(sdata->mx, msgqB.rx_sequence, latency);
+
         if (g_sData->msqid >= 0) {
             ret = msgsnd(g_sData->msqid, (void *)&msgqB, sizeof(struct msgq_buf) - sizeof(msgqB.msg_type), IPC_NOWAIT);
             if (ret < 0) {
@@ -276,18 +312,17 @@ pubReturnGetDataToTransmit(UA_Server *server, const UA_NodeId *sessionId,
     clock_gettime(CLOCK_TAI, &current_time_timespec);
     currentTime = as_nanoseconds(&current_time_timespec);
 
-    UA_UInt64 d[5] = {curr_rx_sequence, curr_txTime, curr_rxTime, tx_sequence, currentTime};
+    UA_UInt64 d[PUBRETURN_PAYLOAD_LEN] = {curr_rx_sequence, curr_txTime, curr_rxTime,
+                                          tx_sequence, currentTime};
+
+    struct PublisherData *pdata = (struct PublisherData *)nodeContext;
+    metrics_tx(pdata->mx, currentTime > pdata->txTime);
+    pdata->lastSeq = tx_sequence;
 
     debug("[PUBR] rx_seqA:%ld, txtimePubA:%ld, rxTimeSubB:%ld, tx_seqB:%ld, txtimePubB:%ld\n",
           curr_rx_sequence, curr_txTime, curr_rxTime, tx_sequence, currentTime);
 
-    UA_StatusCode retval = UA_Variant_setArrayCopy(&data->value, &d[0], 5,
-                                                   &UA_TYPES[UA_TYPES_UINT64]);
-    if (retval != UA_STATUSCODE_GOOD)
-            debug("[PUBR] Error in transmitting data source\n");
-
-    data->hasValue = true;
-    data->value.storageType = UA_VARIANT_DATA_NODELETE;
+    pubSetPayload(pdata, d, PUBRETURN_PAYLOAD_LEN, data);
 
     /* Termination condition */
     if (tx_sequence >= (UA_Int64)packetCount) {
@@ -352,6 +387,7 @@ subReturnStoreDataReceived(UA_Server *server, const UA_NodeId *sessionId,
         UA_Int64  returnLatency = 0;
         struct timespec current_time_timespec;
         seqA   = ptr_data[0];
+        sdata->lastSeq = seqA;
         seqB   = ptr_data[3];
 
         clock_gettime(CLOCK_TAI, &current_time_timespec);
@@ -375,6 +411,22 @@ subReturnStoreDataReceived(UA_Server *server, const UA_NodeId *sessionId,
                         b2aLatency, seqB, sdata->id, txPubB, RXhwTS, rxSubA, returnLatency);
             }
         }
+
+        if (sdata->pcap != NULL)
+            subRecordPcapng(sdata, &v, rxSubA, txPubA, returnLatency);
+
+        if (sdata->telem != NULL && seqA != ERROR_DUPLICATE &&
+            seqA != ERROR_MSGQ_COPY && seqA != ERROR_NOTHING_TO_FORWARD)
+            telemetry_update(sdata->telem, seqA, returnLatency, rxSubA);
+
+        struct metrics_block *mx = sdata->mx;
+        if (seqA == ERROR_DUPLICATE || seqA == ERROR_MSGQ_COPY ||
+            seqA == ERROR_NOTHING_TO_FORWARD) {
+            if (mx != NULL)
+                metrics_add(&mx->drops, 1);
+        } else {
+            metrics_rx(mx, seqA, returnLatency);
+        }
     } else {
         debug("[SUBR] Rx invalid variant\n");
     }
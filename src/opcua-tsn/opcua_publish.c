@@ -122,6 +122,11 @@ static void addPublishedDataSet(UA_Server *server, UA_NodeId *publishedDataSetId
  *
  * The DataSetField (DSF) is part of the PDS and describes exactly one published
  * field.
+ *
+ * With rt_fixed_size the field reads a static value source instead of the
+ * datasource node: the value is a fixed-length UInt64 array over
+ * pdata->payload, which pub_thread refreshes before every publish, so the
+ * NetworkMessage can be encoded once at freeze time.
  */
 static void addDataSetField(UA_Server *server, UA_NodeId *publishedDataSetIdent,
         struct ServerData *sdata, struct PublisherData *pdata)
@@ -166,6 +171,18 @@ static void addDataSetField(UA_Server *server, UA_NodeId *publishedDataSetIdent,
     dataSetFieldConfig.field.variable.publishParameters.publishedVariable =
                                 UA_NODEID_STRING(1, "payload-datasource");
     dataSetFieldConfig.field.variable.publishParameters.attributeId = UA_ATTRIBUTEID_VALUE;
+
+    if (pdata->rtFixedSize) {
+        pdata->rtValue = UA_DataValue_new();
+        UA_Variant_setArray(&pdata->rtValue->value, pdata->payload,
+                            pdata->payloadLen, &UA_TYPES[UA_TYPES_UINT64]);
+        pdata->rtValue->value.storageType = UA_VARIANT_DATA_NODELETE;
+        pdata->rtValue->hasValue = UA_TRUE;
+
+        dataSetFieldConfig.field.variable.rtValueSource.rtFieldSourceEnabled = UA_TRUE;
+        dataSetFieldConfig.field.variable.rtValueSource.staticValueSource = &pdata->rtValue;
+    }
+
     UA_Server_addDataSetField(server, *publishedDataSetIdent,
                               &dataSetFieldConfig, &dataSetFieldIdent);
 }
@@ -195,8 +212,11 @@ static void addWriterGroup(UA_Server *server, UA_NodeId *connectionIdent,
     writerGroupConfig.writerGroupId = pdata->writerGroupId;
     writerGroupConfig.encodingMimeType = UA_PUBSUB_ENCODING_UADP;
 #if defined PUBSUB_CONFIG_FASTPATH_FIXED_OFFSETS
-    //TODO: enable rtlevel to increase performance?
-    // writerGroupConfig.rtLevel            = UA_PUBSUB_RT_FIXED_SIZE;
+    /* Encode once at freeze, then only patch the offsets of the sequence
+     * number, timestamps and payload every cycle
+     */
+    if (pdata->rtFixedSize)
+        writerGroupConfig.rtLevel = UA_PUBSUB_RT_FIXED_SIZE;
 #endif
     writerGroupConfig.messageSettings.encoding             = UA_EXTENSIONOBJECT_DECODED;
     writerGroupConfig.messageSettings.content.decoded.type = &UA_TYPES[UA_TYPES_UADPWRITERGROUPMESSAGEDATATYPE];
@@ -241,7 +261,8 @@ static void addDataSetWriter(UA_Server *server, UA_NodeId *writerGroupIdent,
     memset(&dataSetWriterConfig, 0, sizeof(UA_DataSetWriterConfig));
     dataSetWriterConfig.name = UA_STRING("Demo DataSetWriter");
     dataSetWriterConfig.dataSetWriterId = (UA_UInt16)pdata->dataSetWriterId;
-    dataSetWriterConfig.keyFrameCount = KEYFRAME_COUNT;
+    /* Fixed-size messages are always key frames */
+    dataSetWriterConfig.keyFrameCount = pdata->rtFixedSize ? 1 : KEYFRAME_COUNT;
     UA_Server_addDataSetWriter(server, *writerGroupIdent, *publishedDataSetIdent,
                                &dataSetWriterConfig, &dataSetWriterIdent);
 }
@@ -254,6 +275,20 @@ int createPublisher(UA_Server *serv, struct ServerData *sdata,
     addDataSetField(serv, &publishedDataSetIdent, sdata, pdata);
     addWriterGroup(serv, connectionIdent, &g_writerGroupIdent, sdata, pdata);
     addDataSetWriter(serv, &g_writerGroupIdent, &publishedDataSetIdent, pdata);
-    UA_Server_freezeWriterGroupConfiguration(serv, g_writerGroupIdent);
+    UA_StatusCode rc = UA_Server_freezeWriterGroupConfiguration(serv, g_writerGroupIdent);
+    if (rc != UA_STATUSCODE_GOOD) {
+        log_error("Failed to freeze the WriterGroup: %s", UA_StatusCode_name(rc));
+        return -1;
+    }
     return 0;
 }
+
+/* Refresh the static value source of a rt_fixed_size publisher from its
+ * datasource callback; the library then patches it into the buffered message.
+ * The callback rewrites pdata->payload in place, which rtValue points at.
+ */
+void refreshStaticValue(UA_Server *server, struct PublisherData *pdata)
+{
+    pdata->readFunc(server, NULL, NULL, NULL, pdata, UA_FALSE, NULL,
+                    pdata->rtValue);
+}
@@ -41,5 +41,6 @@ int createPublisher(UA_Server *serv, struct ServerData *sdata,
                     struct PublisherData *pub, UA_NodeId *connectionIdent);
 void addPubSubConnection(UA_Server *server, UA_NodeId *connId,
                          struct ServerData *sdata, struct PublisherData *pdata);
+void refreshStaticValue(UA_Server *server, struct PublisherData *pdata);
 
 #endif
@@ -0,0 +1,253 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pcapng.h"
+
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+
+#define OPT_ENDOFOPT		0
+#define OPT_SHB_USERAPPL	4
+#define OPT_IF_NAME		2
+#define OPT_IF_TSRESOL		9
+#define OPT_EPB_QUEUE		6
+#define OPT_CUSTOM_STR		2988	//Custom UTF-8 option, copyable
+
+#define PCAPNG_PEN		343	//Intel Corporation
+#define PCAPNG_BLOCK_MAX	512
+#define PCAPNG_IDLE_NS		1000000
+
+#define PAD4(x)			(((x) + 3) & ~3U)
+
+struct block {
+	uint8_t buf[PCAPNG_BLOCK_MAX];
+	uint32_t len;
+};
+
+static void put(struct block *b, const void *data, uint32_t len)
+{
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+}
+
+static void put32(struct block *b, uint32_t v)
+{
+	put(b, &v, sizeof(v));
+}
+
+static void put_opt(struct block *b, uint16_t code, const void *data,
+		    uint16_t len)
+{
+	uint32_t pad = 0;
+
+	put(b, &code, sizeof(code));
+	put(b, &len, sizeof(len));
+	put(b, data, len);
+	put(b, &pad, PAD4(len) - len);
+}
+
+static void put_custom_str(struct block *b, const char *str)
+{
+	uint8_t opt[64];
+	uint32_t pen = PCAPNG_PEN;
+	uint16_t len = strlen(str);
+
+	memcpy(opt, &pen, sizeof(pen));
+	memcpy(opt + sizeof(pen), str, len);
+	put_opt(b, OPT_CUSTOM_STR, opt, sizeof(pen) + len);
+}
+
+/* Start a block: type + placeholder for total length */
+static void block_begin(struct block *b, uint32_t type)
+{
+	b->len = 0;
+	put32(b, type);
+	put32(b, 0);
+}
+
+/* End of options, trailing length, then patch in the leading length */
+static void block_end(struct block *b, FILE *fp, int has_opts)
+{
+	if (has_opts)
+		put_opt(b, OPT_ENDOFOPT, NULL, 0);
+	put32(b, b->len + sizeof(uint32_t));
+	memcpy(b->buf + sizeof(uint32_t), &b->len, sizeof(uint32_t));
+	fwrite(b->buf, 1, b->len, fp);
+}
+
+static void write_epb(FILE *fp, struct pcapng_slot *s)
+{
+	uint32_t pad = 0;
+	struct block b;
+	char str[48];
+
+	block_begin(&b, PCAPNG_EPB);
+	put32(&b, 0);				//Interface ID
+	put32(&b, (uint32_t)(s->ts >> 32));	//Timestamp in if_tsresol units
+	put32(&b, (uint32_t)s->ts);
+	put32(&b, s->caplen);
+	put32(&b, s->origlen);
+	put(&b, s->data, s->caplen);
+	put(&b, &pad, PAD4(s->caplen) - s->caplen);
+
+	put_opt(&b, OPT_EPB_QUEUE, &s->queue, sizeof(s->queue));
+	snprintf(str, sizeof(str), "app_txtime=%lu", s->app_txtime);
+	put_custom_str(&b, str);
+	snprintf(str, sizeof(str), "latency=%ld", s->latency);
+	put_custom_str(&b, str);
+
+	block_end(&b, fp, 1);
+}
+
+static void *pcapng_writer_thread(void *arg)
+{
+	struct pcapng_writer *w = (struct pcapng_writer *)arg;
+	struct timespec idle = { 0, PCAPNG_IDLE_NS };
+	uint64_t head, tail;
+
+	while (1) {
+		head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+		tail = w->tail;
+
+		if (tail == head) {
+			if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) &&
+			    head == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+				break;
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		for (; tail != head; tail++)
+			write_epb(w->fp, &w->slots[tail & (PCAPNG_RING_SLOTS - 1)]);
+
+		w->written += head - w->tail;
+		__atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+struct pcapng_writer *pcapng_open(const char *path, const char *appname,
+				  const char *ifname, uint16_t linktype)
+{
+	uint32_t byte_order = PCAPNG_BYTE_ORDER;
+	uint16_t version[2] = { 1, 0 };
+	int64_t section_len = -1;
+	uint8_t tsresol = 9;		//Nanoseconds
+	uint16_t reserved = 0;
+	struct pcapng_writer *w;
+	struct block b;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->fp = fopen(path, "w");
+	if (!w->fp) {
+		free(w);
+		return NULL;
+	}
+	setvbuf(w->fp, NULL, _IOFBF, 1 << 20);
+
+	block_begin(&b, PCAPNG_SHB);
+	put(&b, &byte_order, sizeof(byte_order));
+	put(&b, version, sizeof(version));
+	put(&b, &section_len, sizeof(section_len));
+	put_opt(&b, OPT_SHB_USERAPPL, appname, strlen(appname));
+	block_end(&b, w->fp, 1);
+
+	block_begin(&b, PCAPNG_IDB);
+	put(&b, &linktype, sizeof(linktype));
+	put(&b, &reserved, sizeof(reserved));
+	put32(&b, PCAPNG_SNAPLEN);
+	put_opt(&b, OPT_IF_NAME, ifname, strlen(ifname));
+	put_opt(&b, OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+	block_end(&b, w->fp, 1);
+
+	if (pthread_create(&w->thread, NULL, pcapng_writer_thread, w)) {
+		fclose(w->fp);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+/* RT side: copy one record into the ring, never blocks */
+int pcapng_record(struct pcapng_writer *w, const void *frame, uint32_t len,
+		  uint64_t ts, uint32_t queue, uint64_t app_txtime,
+		  int64_t latency)
+{
+	uint64_t head = w->head;
+	struct pcapng_slot *s;
+
+	if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) >= PCAPNG_RING_SLOTS) {
+		w->dropped++;
+		return -1;
+	}
+
+	s = &w->slots[head & (PCAPNG_RING_SLOTS - 1)];
+	s->ts = ts;
+	s->app_txtime = app_txtime;
+	s->latency = latency;
+	s->queue = queue;
+	s->origlen = len;
+	s->caplen = len < PCAPNG_SNAPLEN ? len : PCAPNG_SNAPLEN;
+	memcpy(s->data, frame, s->caplen);
+
+	__atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Drain the ring, stop the writer thread and close the file */
+void pcapng_close(struct pcapng_writer *w)
+{
+	if (!w)
+		return;
+
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(w->thread, NULL);
+
+	fprintf(stderr, "pcapng: %lu records written, %lu dropped\n",
+		w->written, w->dropped);
+
+	fclose(w->fp);
+	free(w);
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef PCAPNG_HEADER
+#define PCAPNG_HEADER
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_USER0		147
+
+#define PCAPNG_SNAPLEN		128	//Frame headers + measurement payload
+#define PCAPNG_RING_SLOTS	4096	//Must be a power of two
+
+struct pcapng_slot {
+	uint64_t ts;		//hw rxtime, or user rxtime if no hw timestamp
+	uint64_t app_txtime;
+	int64_t latency;
+	uint32_t queue;
+	uint32_t caplen;
+	uint32_t origlen;
+	uint8_t data[PCAPNG_SNAPLEN];
+};
+
+/* pcapng file writer. The RT thread only copies records into a single
+ * producer/single consumer ring; a separate thread formats the blocks and
+ * does all file I/O. Records are dropped (and counted) if the ring is full.
+ */
+struct pcapng_writer {
+	FILE *fp;
+	pthread_t thread;
+	int stop;
+
+	uint64_t head __attribute__((aligned(64)));	//Producer index
+	uint64_t dropped;
+	uint64_t tail __attribute__((aligned(64)));	//Consumer index
+	uint64_t written;
+
+	struct pcapng_slot slots[PCAPNG_RING_SLOTS];
+};
+
+struct pcapng_writer *pcapng_open(const char *path, const char *appname,
+				  const char *ifname, uint16_t linktype);
+int pcapng_record(struct pcapng_writer *w, const void *frame, uint32_t len,
+		  uint64_t ts, uint32_t queue, uint64_t app_txtime,
+		  int64_t latency);
+void pcapng_close(struct pcapng_writer *w);
+
+#endif
@@ -0,0 +1,629 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timex.h>
+
+#include "phc-source.h"
+
+#define NSEC_PER_SEC		1000000000LL
+
+static long long timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static long long clock_ns(clockid_t clkid)
+{
+	struct timespec ts;
+
+	clock_gettime(clkid, &ts);
+	return timespec_ns(&ts);
+}
+
+/* Sleep until wall0 + elapsed / speed, or at most timeout_ms.
+ * Returns false if the timeout ran out first.
+ */
+static bool pace(struct timespec *wall0, long long elapsed, double speed,
+		 int timeout_ms)
+{
+	long long due, now, limit;
+	struct timespec ts;
+
+	if (speed <= 0)
+		return true;
+
+	due = timespec_ns(wall0) + (long long)(elapsed / speed);
+	now = clock_ns(CLOCK_MONOTONIC);
+	if (due <= now)
+		return true;
+
+	limit = timeout_ms < 0 ? due : now + timeout_ms * 1000000LL;
+	ts.tv_sec = (due < limit ? due : limit) / NSEC_PER_SEC;
+	ts.tv_nsec = (due < limit ? due : limit) % NSEC_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	return due <= limit;
+}
+
+/* Hardware PHC */
+
+static int hw_open(struct phc_source *src, const char *arg)
+{
+	src->fd = open(arg, O_RDWR);
+	src->paced = true;
+	return src->fd < 0 ? -1 : 0;
+}
+
+static int hw_extts_enable(struct phc_source *src, int channel, bool enable)
+{
+	struct ptp_extts_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.index = channel;
+	if (enable)
+		req.flags = PTP_ENABLE_FEATURE | PTP_RISING_EDGE;
+	return ioctl(src->fd, PTP_EXTTS_REQUEST, &req);
+}
+
+static int hw_read_extts(struct phc_source *src, struct ptp_extts_event *ev,
+			 int max, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = src->fd, .events = POLLIN };
+	ssize_t n;
+	int ready;
+
+	ready = poll(&pfd, 1, timeout_ms);
+	if (ready <= 0)
+		return ready < 0 && errno != EINTR ? -1 : 0;
+
+	/* Drain every queued event in one read */
+	n = read(src->fd, ev, max * sizeof(*ev));
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+	if (n % sizeof(*ev)) {
+		errno = EIO;
+		return -1;
+	}
+	return n / sizeof(*ev);
+}
+
+static long long ptp_ns(const struct ptp_clock_time *t)
+{
+	return t->sec * NSEC_PER_SEC + t->nsec;
+}
+
+/* Keep the lowest-delay pair of a burst, track the spread of all */
+static void offset_pair(struct phc_offset *po, long long sys0, long long phc,
+			long long sys1)
+{
+	long long d = sys1 - sys0;
+	long long off = phc - sys0 - d / 2;
+
+	if (!po->samples++ || d < po->delay) {
+		po->delay = d;
+		po->sys = sys0 + d / 2;
+		po->offset = off;
+	}
+	if (po->samples == 1 || d > po->delay_max)
+		po->delay_max = d;
+	if (po->samples == 1 || off < po->min)
+		po->min = off;
+	if (po->samples == 1 || off > po->max)
+		po->max = off;
+}
+
+static int hw_offset_extended(struct phc_source *src, struct phc_offset *po)
+{
+	struct ptp_sys_offset_extended ext;
+	unsigned int i;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.n_samples = src->samples;
+	if (ioctl(src->fd, PTP_SYS_OFFSET_EXTENDED, &ext))
+		return -1;
+
+	/* ts[i] = { sys before, phc, sys after } */
+	for (i = 0; i < ext.n_samples; i++)
+		offset_pair(po, ptp_ns(&ext.ts[i][0]), ptp_ns(&ext.ts[i][1]),
+			    ptp_ns(&ext.ts[i][2]));
+	return 0;
+}
+
+/* Same from a PTP_SYS_OFFSET burst, for drivers without the extended call */
+static int hw_offset_basic(struct phc_source *src, struct phc_offset *po)
+{
+	struct ptp_sys_offset req;
+	unsigned int i;
+
+	memset(&req, 0, sizeof(req));
+	req.n_samples = src->samples;
+	if (ioctl(src->fd, PTP_SYS_OFFSET, &req))
+		return -1;
+
+	/* ts[] = { sys, phc, sys, phc, .. sys } */
+	for (i = 0; i < req.n_samples; i++)
+		offset_pair(po, ptp_ns(&req.ts[2 * i]), ptp_ns(&req.ts[2 * i + 1]),
+			    ptp_ns(&req.ts[2 * i + 2]));
+	return 0;
+}
+
+/* Hardware cross-timestamp: PHC and CLOCK_REALTIME latched together */
+static int hw_offset_precise(struct phc_source *src, struct phc_offset *po)
+{
+	struct ptp_sys_offset_precise pre;
+
+	memset(&pre, 0, sizeof(pre));
+	if (ioctl(src->fd, PTP_SYS_OFFSET_PRECISE, &pre))
+		return -1;
+
+	po->sys = ptp_ns(&pre.sys_realtime);
+	po->offset = ptp_ns(&pre.device) - po->sys;
+	po->min = po->max = po->offset;
+	po->samples = 1;
+	return 0;
+}
+
+/* PHC - CLOCK_REALTIME by src->method. Methods the driver lacks fall back
+ * for good: PRECISE to EXTENDED, EXTENDED (older drivers) to BASIC.
+ */
+static int hw_read_offset(struct phc_source *src, struct phc_offset *po)
+{
+	memset(po, 0, sizeof(*po));
+
+	if (src->method == PHC_SYSOFF_PRECISE) {
+		po->method = PHC_SYSOFF_PRECISE;
+		if (!hw_offset_precise(src, po))
+			return 0;
+		if (errno != EOPNOTSUPP)
+			return -1;
+		src->method = PHC_SYSOFF_EXTENDED;
+	}
+
+	if (src->method == PHC_SYSOFF_EXTENDED) {
+		po->method = PHC_SYSOFF_EXTENDED;
+		if (!hw_offset_extended(src, po))
+			return 0;
+		if (errno != EOPNOTSUPP)
+			return -1;
+		src->method = PHC_SYSOFF_BASIC;
+	}
+
+	po->method = PHC_SYSOFF_BASIC;
+	return hw_offset_basic(src, po);
+}
+
+/* PHC offset to CLOCK_TAI at the next multiple of period in CLOCK_TAI */
+static int hw_sys_offset(struct phc_source *src, long long *offset,
+			 long long *tai, long long *delay)
+{
+	struct phc_offset po;
+	struct timex tx = { 0 };
+	struct timespec ts;
+
+	if (!src->next)
+		src->next = (clock_ns(CLOCK_TAI) / src->period + 1) * src->period;
+	ts.tv_sec = src->next / NSEC_PER_SEC;
+	ts.tv_nsec = src->next % NSEC_PER_SEC;
+	clock_nanosleep(CLOCK_TAI, TIMER_ABSTIME, &ts, NULL);
+	src->next += src->period;
+
+	if (hw_read_offset(src, &po))
+		return -1;
+	if (adjtimex(&tx) < 0)
+		tx.tai = 0;
+
+	*tai = po.sys + tx.tai * NSEC_PER_SEC;
+	*offset = po.offset - tx.tai * NSEC_PER_SEC;
+	*delay = po.delay;
+	return 0;
+}
+
+static void hw_close(struct phc_source *src)
+{
+	close(src->fd);
+}
+
+static const struct phc_source_ops hw_ops = {
+	.name = "phc",
+	.open = hw_open,
+	.extts_enable = hw_extts_enable,
+	.read_extts = hw_read_extts,
+	.sys_offset = hw_sys_offset,
+	.read_offset = hw_read_offset,
+	.close = hw_close,
+};
+
+/* Synthetic clock */
+
+static double gauss(unsigned int *seed)
+{
+	double u1 = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+	double u2 = rand_r(seed) / ((double)RAND_MAX + 1.0);
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static int mock_open(struct phc_source *src, const char *arg)
+{
+	static unsigned int instances;
+	struct phc_mock *m = &src->mock;
+	char *opts, *tok, *val, *save = NULL;
+
+	m->speed = 1.0;
+	m->seed = ++instances;
+	m->start = (clock_ns(CLOCK_TAI) / NSEC_PER_SEC + 1) * NSEC_PER_SEC;
+
+	opts = strdup(arg ? arg : "");
+	for (tok = strtok_r(opts, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val) {
+			free(opts);
+			errno = EINVAL;
+			return -1;
+		}
+		*val++ = '\0';
+		if (!strcmp(tok, "offset"))
+			m->offset = strtoll(val, NULL, 0);
+		else if (!strcmp(tok, "drift"))
+			m->drift = strtod(val, NULL);
+		else if (!strcmp(tok, "jitter"))
+			m->jitter = strtod(val, NULL);
+		else if (!strcmp(tok, "drop"))
+			m->drop = strtod(val, NULL);
+		else if (!strcmp(tok, "speed"))
+			m->speed = strtod(val, NULL);
+		else if (!strcmp(tok, "count"))
+			m->count = strtoll(val, NULL, 0);
+		else if (!strcmp(tok, "channel"))
+			m->channel = strtol(val, NULL, 0);
+		else if (!strcmp(tok, "seed"))
+			m->seed = strtoul(val, NULL, 0);
+		else if (!strcmp(tok, "start"))
+			m->start = strtoll(val, NULL, 0) * NSEC_PER_SEC;
+		else {
+			free(opts);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	free(opts);
+
+	src->paced = m->speed > 0;
+	clock_gettime(CLOCK_MONOTONIC, &m->wall0);
+	return 0;
+}
+
+static int mock_extts_enable(struct phc_source *src, int channel, bool enable)
+{
+	(void)src;
+	(void)channel;
+	(void)enable;
+	return 0;
+}
+
+/* Offset of the mock clock at nominal TAI time t, jitter and drift
+ * included
+ */
+static long long mock_offset(struct phc_mock *m, long long t)
+{
+	double off = m->offset + m->drift * (t - m->start) / 1e9;
+
+	if (m->jitter > 0)
+		off += m->jitter * gauss(&m->seed);
+	return llround(off);
+}
+
+/* Next sample index that is not dropped, false at the end of count */
+static bool mock_next(struct phc_source *src, long long *t)
+{
+	struct phc_mock *m = &src->mock;
+
+	while (!m->count || m->k < m->count) {
+		*t = m->start + m->k * src->period;
+		m->k++;
+		if (m->drop > 0 &&
+		    rand_r(&m->seed) < m->drop * ((double)RAND_MAX + 1.0))
+			continue;
+		return true;
+	}
+	src->eof = true;
+	return false;
+}
+
+static int mock_read_extts(struct phc_source *src, struct ptp_extts_event *ev,
+			   int max, int timeout_ms)
+{
+	struct phc_mock *m = &src->mock;
+	long long t, pt;
+	int n = 0;
+
+	while (n < max) {
+		/* Without pacing, fill the whole batch at once */
+		if (m->speed > 0 && n) {
+			t = m->start + m->k * src->period;
+			if (timespec_ns(&m->wall0) + (long long)((t - m->start) / m->speed) >
+			    clock_ns(CLOCK_MONOTONIC))
+				break;
+		}
+		if (!pace(&m->wall0, m->k * src->period, m->speed, timeout_ms))
+			break;
+		if (!mock_next(src, &t))
+			break;
+
+		pt = t + mock_offset(m, t);
+		memset(&ev[n], 0, sizeof(ev[n]));
+		ev[n].index = m->channel;
+		ev[n].t.sec = pt / NSEC_PER_SEC;
+		ev[n].t.nsec = pt % NSEC_PER_SEC;
+		n++;
+	}
+	return n;
+}
+
+static int mock_sys_offset(struct phc_source *src, long long *offset,
+			   long long *tai, long long *delay)
+{
+	struct phc_mock *m = &src->mock;
+	long long t;
+
+	pace(&m->wall0, m->k * src->period, m->speed, -1);
+	if (!mock_next(src, &t))
+		return -1;
+
+	*tai = t;
+	*offset = mock_offset(m, t);
+	*delay = 0;
+	return 0;
+}
+
+/* The mock clock against CLOCK_REALTIME now, one pair without delay */
+static int mock_read_offset(struct phc_source *src, struct phc_offset *po)
+{
+	struct timex tx = { 0 };
+	long long t = clock_ns(CLOCK_TAI);
+
+	if (adjtimex(&tx) < 0)
+		tx.tai = 0;
+
+	memset(po, 0, sizeof(*po));
+	po->sys = t - tx.tai * NSEC_PER_SEC;
+	po->offset = mock_offset(&src->mock, t) + tx.tai * NSEC_PER_SEC;
+	po->min = po->max = po->offset;
+	po->samples = 1;
+	po->method = src->method;
+	return 0;
+}
+
+static void mock_close(struct phc_source *src)
+{
+	(void)src;
+}
+
+static const struct phc_source_ops mock_ops = {
+	.name = "mock",
+	.open = mock_open,
+	.extts_enable = mock_extts_enable,
+	.read_extts = mock_read_extts,
+	.sys_offset = mock_sys_offset,
+	.read_offset = mock_read_offset,
+	.close = mock_close,
+};
+
+/* Replayed EXTTS capture */
+
+static int replay_open(struct phc_source *src, const char *arg)
+{
+	struct phc_replay *r = &src->replay;
+	char *path, *opt;
+
+	if (!arg) {
+		errno = EINVAL;
+		return -1;
+	}
+	path = strdup(arg);
+	opt = strchr(path, ',');
+	if (opt) {
+		*opt++ = '\0';
+		if (strncmp(opt, "speed=", 6)) {
+			free(path);
+			errno = EINVAL;
+			return -1;
+		}
+		r->speed = strtod(opt + 6, NULL);
+	}
+
+	r->fp = fopen(path, "r");
+	free(path);
+	src->paced = r->speed > 0;
+	r->first = -1;
+	return r->fp ? 0 : -1;
+}
+
+static int replay_extts_enable(struct phc_source *src, int channel, bool enable)
+{
+	(void)src;
+	(void)channel;
+	(void)enable;
+	return 0;
+}
+
+/* Next event of the file, false at EOF */
+static bool replay_line(struct phc_replay *r, struct ptp_extts_event *e)
+{
+	char line[256], frac[16];
+	unsigned int index;
+	long long sec;
+	long nsec;
+	size_t len;
+
+	while (fgets(line, sizeof(line), r->fp)) {
+		memset(e, 0, sizeof(*e));
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "event index %u at %lld.%15[0-9]", &index,
+			   &sec, frac) == 3) {
+			/* Fraction to ns, however many digits were printed */
+			len = strlen(frac);
+			nsec = strtol(frac, NULL, 10);
+			while (len < 9) {
+				nsec *= 10;
+				len++;
+			}
+			while (len-- > 9)
+				nsec /= 10;
+		} else if (sscanf(line, "%u %lld %ld", &index, &sec, &nsec) != 3) {
+			continue;
+		}
+		e->index = index;
+		e->t.sec = sec;
+		e->t.nsec = nsec;
+		return true;
+	}
+	return false;
+}
+
+static int replay_read_extts(struct phc_source *src, struct ptp_extts_event *ev,
+			     int max, int timeout_ms)
+{
+	struct phc_replay *r = &src->replay;
+	long long t;
+	int n = 0;
+
+	while (n < max) {
+		if (!replay_line(r, &ev[n])) {
+			src->eof = true;
+			break;
+		}
+		t = ev[n].t.sec * NSEC_PER_SEC + ev[n].t.nsec;
+		if (r->first < 0) {
+			r->first = t;
+			clock_gettime(CLOCK_MONOTONIC, &r->wall0);
+		}
+		/* Paced replay hands over one event at a time, on time */
+		pace(&r->wall0, t - r->first, r->speed, -1);
+		n++;
+		if (r->speed > 0)
+			break;
+	}
+	(void)timeout_ms;
+	return n;
+}
+
+static int replay_sys_offset(struct phc_source *src, long long *offset,
+			     long long *tai, long long *delay)
+{
+	(void)src;
+	(void)offset;
+	(void)tai;
+	(void)delay;
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+static int replay_read_offset(struct phc_source *src, struct phc_offset *po)
+{
+	(void)src;
+	(void)po;
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+static void replay_close(struct phc_source *src)
+{
+	fclose(src->replay.fp);
+}
+
+static const struct phc_source_ops replay_ops = {
+	.name = "replay",
+	.open = replay_open,
+	.extts_enable = replay_extts_enable,
+	.read_extts = replay_read_extts,
+	.sys_offset = replay_sys_offset,
+	.read_offset = replay_read_offset,
+	.close = replay_close,
+};
+
+/**
+ *  @brief Open the source named by spec
+ *
+ *  @param period	ns between pulses or offset reads (1 / rate)
+ *  @return source, or NULL with errno set
+ */
+struct phc_source *phc_source_open(const char *spec, long period)
+{
+	struct phc_source *src;
+	const char *arg = NULL;
+
+	src = calloc(1, sizeof(*src));
+	if (!src)
+		return NULL;
+	src->spec = spec;
+	src->period = period;
+	src->fd = -1;
+	src->method = PHC_SYSOFF_EXTENDED;
+	src->samples = PHC_SYSOFF_SAMPLES;
+
+	if (!strncmp(spec, "mock", 4) && (spec[4] == '\0' || spec[4] == ':')) {
+		src->ops = &mock_ops;
+		arg = spec[4] ? spec + 5 : NULL;
+	} else if (!strncmp(spec, "replay:", 7)) {
+		src->ops = &replay_ops;
+		arg = spec + 7;
+	} else {
+		src->ops = &hw_ops;
+		arg = spec;
+	}
+
+	if (src->ops->open(src, arg)) {
+		free(src);
+		return NULL;
+	}
+	return src;
+}
+
+void phc_source_close(struct phc_source *src)
+{
+	if (!src)
+		return;
+	src->ops->close(src);
+	free(src);
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef PHC_SOURCE_HEADER
+#define PHC_SOURCE_HEADER
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <linux/ptp_clock.h>
+
+/* PHC sample source for tsq and txrx-tsn, chosen by the device string:
+ *
+ *   /dev/ptpX                   the hardware PHC
+ *   mock[:key=val,..]           a synthetic clock
+ *   replay:FILE[,speed=X]       EXTTS events captured to a file
+ *
+ * The mock keys are offset (ns), drift (ppb), jitter (ns, gaussian sigma),
+ * drop (probability a pulse or read is lost), speed (virtual seconds per
+ * wall second, 0 for as fast as possible), count (samples before EOF, 0
+ * for endless), channel, seed and start (TAI second of the first pulse,
+ * default the next wall second). Replay lines are "channel sec nsec" or
+ * testptp's "event index N at SEC.NSEC"; # lines are skipped.
+ *
+ * Every source paces itself: hardware through poll() or a CLOCK_TAI sleep,
+ * the mock and replay through speed. Sources that are not paced in real
+ * time (speed 0) leave paced false, so callers can apply flow control.
+ */
+#define PHC_SYSOFF_EXTENDED	0	//Lowest-delay PTP_SYS_OFFSET_EXTENDED pair
+#define PHC_SYSOFF_PRECISE	1	//PTP_SYS_OFFSET_PRECISE cross-timestamp
+#define PHC_SYSOFF_BASIC	2	//Lowest-delay PTP_SYS_OFFSET pair
+#define PHC_SYSOFF_SAMPLES	25	//Default burst size
+
+/* One PHC - CLOCK_REALTIME estimate */
+struct phc_offset {
+	long long offset;	//PHC - CLOCK_REALTIME at sys
+	long long sys;		//CLOCK_REALTIME of the estimate
+	long long delay;	//Read delay of the pair used, 0 if precise
+	long long delay_max;	//Slowest read of the burst
+	long long min;		//Offset range over the burst
+	long long max;
+	unsigned int samples;	//Pairs read, 1 if precise
+	int method;		//PHC_SYSOFF_* that produced it
+};
+
+struct phc_source;
+
+struct phc_source_ops {
+	const char *name;
+	int (*open)(struct phc_source *src, const char *arg);
+	int (*extts_enable)(struct phc_source *src, int channel, bool enable);
+	/* Up to max events, 0 on timeout or EOF, -1 on error */
+	int (*read_extts)(struct phc_source *src, struct ptp_extts_event *ev,
+			  int max, int timeout_ms);
+	/* Offset to CLOCK_TAI at the next multiple of period, 0 or -1 */
+	int (*sys_offset)(struct phc_source *src, long long *offset,
+			  long long *tai, long long *delay);
+	/* Offset to CLOCK_REALTIME now, unpaced, 0 or -1 */
+	int (*read_offset)(struct phc_source *src, struct phc_offset *po);
+	void (*close)(struct phc_source *src);
+};
+
+/* Synthetic clock parameters and state */
+struct phc_mock {
+	long long offset;
+	double drift;
+	double jitter;
+	double drop;
+	double speed;
+	long long count;
+	int channel;
+	unsigned int seed;
+	long long start;	//TAI ns of sample 0
+	long long k;		//Next sample index
+	struct timespec wall0;	//CLOCK_MONOTONIC at sample 0
+};
+
+/* Replayed capture */
+struct phc_replay {
+	FILE *fp;
+	double speed;
+	long long first;	//Time of the first event, ns
+	struct timespec wall0;
+};
+
+struct phc_source {
+	const struct phc_source_ops *ops;
+	const char *spec;
+	long period;		//ns between pulses or offset reads
+	bool paced;
+	bool eof;
+	int fd;			//Hardware PHC, -1 otherwise
+	long long next;		//Hardware: TAI ns of the next offset read
+	int method;		//Hardware: PHC_SYSOFF_*
+	unsigned int samples;	//Hardware: burst size, 1..PTP_MAX_SAMPLES
+	struct phc_mock mock;
+	struct phc_replay replay;
+};
+
+struct phc_source *phc_source_open(const char *spec, long period);
+void phc_source_close(struct phc_source *src);
+
+static inline int phc_source_extts_enable(struct phc_source *src,
+					  int channel, bool enable)
+{
+	return src->ops->extts_enable(src, channel, enable);
+}
+
+static inline int phc_source_read_extts(struct phc_source *src,
+					struct ptp_extts_event *ev, int max,
+					int timeout_ms)
+{
+	return src->ops->read_extts(src, ev, max, timeout_ms);
+}
+
+static inline int phc_source_sys_offset(struct phc_source *src,
+					long long *offset, long long *tai,
+					long long *delay)
+{
+	return src->ops->sys_offset(src, offset, tai, delay);
+}
+
+static inline int phc_source_read_offset(struct phc_source *src,
+					 struct phc_offset *po)
+{
+	return src->ops->read_offset(src, po);
+}
+
+#endif
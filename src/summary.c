@@ -0,0 +1,238 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "summary.h"
+
+#define SUMMARY_IDLE_NS		100000000
+
+static const double summary_pcts[] = { 0.50, 0.90, 0.99, 0.999, 0.9999 };
+
+#define NUM_PCTS (sizeof(summary_pcts) / sizeof(summary_pcts[0]))
+
+/* Upper bound in ns of the bin holding each requested fraction of samples */
+static void hist_pcts(const struct summary_window *win, int64_t *out)
+{
+	uint64_t sum = 0, target;
+	unsigned int p = 0;
+	int i;
+
+	memset(out, 0, NUM_PCTS * sizeof(*out));
+	if (!win->packets)
+		return;
+
+	for (i = 0; i < SUMMARY_HIST_BINS && p < NUM_PCTS; i++) {
+		sum += win->hist[i];
+		while (p < NUM_PCTS) {
+			target = (uint64_t)(summary_pcts[p] * win->packets);
+			if (target >= win->packets)
+				target = win->packets - 1;
+			if (sum <= target)
+				break;
+			out[p++] = (int64_t)(i + 1) * SUMMARY_BIN_NS;
+		}
+	}
+}
+
+/* One line per window:
+ *   start packets lost ooo min mean max p50 p90 p99 p99.9 p99.99 hist
+ * where hist lists the non-empty 1us bins as bin_us:count,...
+ */
+static void write_window(FILE *fp, const struct summary_window *win)
+{
+	int64_t pct[NUM_PCTS];
+	unsigned int i;
+	int first = 1;
+	int b;
+
+	hist_pcts(win, pct);
+
+	fprintf(fp, "%lu\t%lu\t%lu\t%lu\t%ld\t%ld\t%ld",
+		win->start, win->packets, win->lost, win->out_of_order,
+		win->lat_min,
+		win->packets ? win->lat_sum / (int64_t)win->packets : 0,
+		win->lat_max);
+	for (i = 0; i < NUM_PCTS; i++)
+		fprintf(fp, "\t%ld", pct[i]);
+
+	fputc('\t', fp);
+	for (b = 0; b < SUMMARY_HIST_BINS; b++) {
+		if (!win->hist[b])
+			continue;
+		fprintf(fp, "%s%d:%lu", first ? "" : ",", b, win->hist[b]);
+		first = 0;
+	}
+	if (first)
+		fputc('-', fp);
+	fputc('\n', fp);
+	fflush(fp);
+}
+
+static void *summary_writer_thread(void *arg)
+{
+	struct summary_writer *w = (struct summary_writer *)arg;
+	struct timespec idle = { 0, SUMMARY_IDLE_NS };
+	uint64_t head, tail;
+
+	while (1) {
+		head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+		tail = w->tail;
+
+		if (tail == head) {
+			if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) &&
+			    head == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+				break;
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		for (; tail != head; tail++)
+			write_window(w->fp, &w->ring[tail & (SUMMARY_RING_SLOTS - 1)]);
+
+		__atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+struct summary_writer *summary_open(const char *path, uint32_t window_sec,
+				    const char *info)
+{
+	struct summary_writer *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->fp = fopen(path, "w");
+	if (!w->fp) {
+		free(w);
+		return NULL;
+	}
+
+	/* Fault in the window buffers now rather than on the RT path */
+	mlock(w, sizeof(*w));
+	w->window_ns = (uint64_t)window_sec * 1000000000ULL;
+
+	fprintf(w->fp, "# txrx-tsn summary v1 window_s=%u bin_ns=%d %s\n",
+		window_sec, SUMMARY_BIN_NS, info ? info : "");
+	fprintf(w->fp, "# start\tpackets\tlost\tooo\tmin\tmean\tmax"
+		"\tp50\tp90\tp99\tp99.9\tp99.99\thist(bin_us:count)\n");
+	fflush(w->fp);
+
+	if (pthread_create(&w->thread, NULL, summary_writer_thread, w)) {
+		fclose(w->fp);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+/* Hand the current window to the writer thread and start a new one */
+static void summary_rotate(struct summary_writer *w, uint64_t start)
+{
+	uint64_t head = w->head;
+
+	if (w->cur.packets) {
+		if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) >= SUMMARY_RING_SLOTS) {
+			w->dropped++;
+		} else {
+			memcpy(&w->ring[head & (SUMMARY_RING_SLOTS - 1)], &w->cur,
+			       sizeof(w->cur));
+			__atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	memset(&w->cur, 0, sizeof(w->cur));
+	w->cur.start = start;
+}
+
+/* RT side, single writer */
+void summary_update(struct summary_writer *w, uint64_t seq, int64_t latency,
+		    uint64_t now)
+{
+	struct summary_window *win = &w->cur;
+	int64_t bin;
+
+	if (now - win->start >= w->window_ns)
+		summary_rotate(w, now - now % w->window_ns);
+
+	if (w->total_packets && seq <= w->last_seq) {
+		win->out_of_order++;
+		w->total_ooo++;
+	} else {
+		if (w->total_packets && seq > w->last_seq + 1) {
+			win->lost += seq - w->last_seq - 1;
+			w->total_lost += seq - w->last_seq - 1;
+		}
+		w->last_seq = seq;
+	}
+
+	if (!win->packets || latency < win->lat_min)
+		win->lat_min = latency;
+	if (!win->packets || latency > win->lat_max)
+		win->lat_max = latency;
+	win->lat_sum += latency;
+	win->packets++;
+	w->total_packets++;
+
+	bin = latency / SUMMARY_BIN_NS;
+	if (bin < 0)
+		bin = 0;
+	else if (bin >= SUMMARY_HIST_BINS)
+		bin = SUMMARY_HIST_BINS - 1;
+	win->hist[bin]++;
+}
+
+/* Flush the partial window, stop the writer and append the run totals */
+void summary_close(struct summary_writer *w)
+{
+	if (!w)
+		return;
+
+	summary_rotate(w, 0);
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(w->thread, NULL);
+
+	fprintf(w->fp, "# total packets=%lu lost=%lu ooo=%lu last_seq=%lu "
+		"dropped_windows=%lu\n", w->total_packets, w->total_lost,
+		w->total_ooo, w->last_seq, w->dropped);
+	fclose(w->fp);
+	free(w);
+}
@@ -0,0 +1,85 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef SUMMARY_HEADER
+#define SUMMARY_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* Windowed result summaries for long soak runs. The RT receive path only
+ * fills a fixed-size window; completed windows are handed through a small
+ * ring to a writer thread that appends one line per window to the summary
+ * file, so memory and disk use do not grow with the packet count.
+ */
+#define SUMMARY_HIST_BINS	10000	//1us bins up to 10ms, last bin is overflow
+#define SUMMARY_BIN_NS		1000
+#define SUMMARY_RING_SLOTS	4	//Must be a power of two
+
+struct summary_window {
+	uint64_t start;		//Window start, clock domain ns
+	uint64_t packets;
+	uint64_t lost;		//Gaps in the sequence
+	uint64_t out_of_order;	//Duplicate or late sequence numbers
+	int64_t lat_min;
+	int64_t lat_max;
+	int64_t lat_sum;
+	uint64_t hist[SUMMARY_HIST_BINS];
+};
+
+struct summary_writer {
+	FILE *fp;
+	pthread_t thread;
+	int stop;
+	uint64_t window_ns;
+
+	/* RT side */
+	uint64_t last_seq;
+	uint64_t total_packets;
+	uint64_t total_lost;
+	uint64_t total_ooo;
+	uint64_t dropped;	//Windows lost because the ring was full
+	struct summary_window cur;
+
+	uint64_t head __attribute__((aligned(64)));	//Producer index
+	uint64_t tail __attribute__((aligned(64)));	//Consumer index
+	struct summary_window ring[SUMMARY_RING_SLOTS];
+};
+
+struct summary_writer *summary_open(const char *path, uint32_t window_sec,
+				    const char *info);
+void summary_update(struct summary_writer *w, uint64_t seq, int64_t latency,
+		    uint64_t now);
+void summary_close(struct summary_writer *w);
+
+#endif
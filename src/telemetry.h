@@ -0,0 +1,134 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef TELEMETRY_HEADER
+#define TELEMETRY_HEADER
+
+#include <stdint.h>
+#include <string.h>
+
+/* Live telemetry in a POSIX shared memory segment (/dev/shm/<name>). A single
+ * RT writer updates it under a seqlock; readers (tsn-telemetry) take a
+ * consistent copy without ever blocking the writer.
+ */
+#define TELEMETRY_MAGIC		0x544e5354	//"TSNT"
+#define TELEMETRY_VERSION	1
+
+#define TELEMETRY_HIST_BINS	1000		//Last bin collects overflow
+#define TELEMETRY_BIN_NS	1000		//1us per bin
+#define TELEMETRY_LAST_N	1024		//Must be a power of two
+#define TELEMETRY_WINDOW_NS	1000000000ULL	//Rolling histogram window
+
+struct telemetry_sample {
+	uint64_t seq;
+	int64_t latency;
+};
+
+struct telemetry {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;		//Seqlock, odd while the writer updates
+	uint32_t pid;
+
+	uint64_t packets;
+	uint64_t lost;		//Gaps in the sequence
+	uint64_t out_of_order;	//Duplicate or late sequence numbers
+	uint64_t last_seq;
+	int64_t lat_min;
+	int64_t lat_max;
+	int64_t lat_last;
+
+	/* hist_win[win] fills for TELEMETRY_WINDOW_NS, then the other one is
+	 * cleared and takes over. hist_win[win ^ 1] is the last full window.
+	 */
+	uint64_t win_start;
+	uint32_t win;
+	uint32_t pad;
+	uint64_t hist[TELEMETRY_HIST_BINS];
+	uint64_t hist_win[2][TELEMETRY_HIST_BINS];
+
+	uint64_t head;		//Total samples written to last[]
+	struct telemetry_sample last[TELEMETRY_LAST_N];
+};
+
+struct telemetry *telemetry_create(const char *name);
+struct telemetry *telemetry_attach(const char *name);
+void telemetry_detach(struct telemetry *t);
+void telemetry_snapshot(const struct telemetry *t, struct telemetry *copy);
+
+/* RT side, single writer per segment */
+static inline void telemetry_update(struct telemetry *t, uint64_t seq,
+				    int64_t latency, uint64_t now)
+{
+	uint32_t s = t->seq;
+	int64_t bin;
+
+	__atomic_store_n(&t->seq, s + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (t->packets && seq <= t->last_seq) {
+		t->out_of_order++;
+	} else {
+		if (t->packets && seq > t->last_seq + 1)
+			t->lost += seq - t->last_seq - 1;
+		t->last_seq = seq;
+	}
+
+	if (!t->packets || latency < t->lat_min)
+		t->lat_min = latency;
+	if (!t->packets || latency > t->lat_max)
+		t->lat_max = latency;
+	t->lat_last = latency;
+	t->packets++;
+
+	if (now - t->win_start >= TELEMETRY_WINDOW_NS) {
+		t->win ^= 1;
+		memset(t->hist_win[t->win], 0, sizeof(t->hist_win[0]));
+		t->win_start = now;
+	}
+
+	bin = latency / TELEMETRY_BIN_NS;
+	if (bin < 0)
+		bin = 0;
+	else if (bin >= TELEMETRY_HIST_BINS)
+		bin = TELEMETRY_HIST_BINS - 1;
+	t->hist[bin]++;
+	t->hist_win[t->win][bin]++;
+
+	t->last[t->head & (TELEMETRY_LAST_N - 1)].seq = seq;
+	t->last[t->head & (TELEMETRY_LAST_N - 1)].latency = latency;
+	t->head++;
+
+	__atomic_store_n(&t->seq, s + 2, __ATOMIC_RELEASE);
+}
+
+#endif
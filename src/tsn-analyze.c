@@ -0,0 +1,746 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Streaming analyzer for txrx-tsn / opcua-server RX logs. Reads the log once
+ * through mmap and prints the same tables as the awk pipelines in
+ * helpers.sh, plus latency percentiles. With -m launch it reads a txrx-tsn
+ * TX log instead and reports hw txtime - launch txtime per queue.
+ */
+
+#define MAX_COLUMNS 32
+
+#define TABLE_U2U	(1 << 0)
+#define TABLE_STDDEV	(1 << 1)
+#define TABLE_DUPLOSS	(1 << 2)
+#define TABLE_TBS	(1 << 3)
+#define TABLE_PCT	(1 << 4)
+#define TABLE_ALL	0x1f
+#define TABLE_LAUNCH	(1 << 5)
+
+/* txrx-tsn TX log: seq, user txtime, hw txtime, launch txtime, queue */
+#define LAUNCH_HW_COL		3
+#define LAUNCH_TARGET_COL	4
+#define LAUNCH_QUEUE_COL	5
+#define MAX_QUEUES		16
+
+/* Log-linear histogram: values below 2^(SUB_BITS+1) are exact, above that
+ * each power of two is split into 2^SUB_BITS buckets (<0.4% error).
+ */
+#define HIST_SUB_BITS	8
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS) * HIST_SUB_COUNT)
+
+#define MAX_META	32
+#define PROFILE_MAGIC	"# tsn-profile v1"
+
+struct opt {
+	char *file;
+	char *plot_file;
+	char *hist_file;
+	char *meta[MAX_META];
+	int meta_count;
+	int lat_col;
+	int seq_col;
+	int recv_col;
+	int plot_col;
+	int tbs_col;
+	long expected;
+	unsigned int tables;
+};
+
+struct running {
+	uint64_t n;
+	double mean;
+	double m2;
+};
+
+struct stats {
+	/* Latency of rows with seq > 0 */
+	int64_t max;
+	int64_t min;
+	double total;
+	uint64_t count;
+	uint64_t pos[HIST_BUCKETS];
+	uint64_t neg[HIST_BUCKETS];
+
+	/* Latency of all rows, for stddev */
+	struct running all;
+
+	/* Received / duplicates */
+	uint64_t received;
+	uint64_t duplicates;
+	uint64_t run;
+	const char *prev_seq;
+	size_t prev_seq_len;
+
+	/* Deltas between consecutive rx times */
+	struct running tbs;
+	int64_t prev_rx;
+	int have_prev_rx;
+};
+
+/* Launch time error per queue, rows without hw or launch txtime are
+ * only counted as missing.
+ */
+struct launch {
+	struct stats *queue[MAX_QUEUES];
+	uint64_t missing[MAX_QUEUES];
+	uint64_t rows[MAX_QUEUES];
+};
+
+static struct argp_option options[] = {
+	{"latency-col",	'l', "COL",	0, "latency column\n"
+					   "	Def: 1"},
+	{"seq-col",	's', "COL",	0, "sequence column, rows with seq <= 0 are not in U2U stats\n"
+					   "	Def: 2"},
+	{"recv-col",	'r', "COL",	0, "column counted for Received\n"
+					   "	Def: seq-col"},
+	{"tbs-col",	't', "COL",	0, "user rx time column for TBS deltas\n"
+					   "	Def: 6"},
+	{"expected",	'n', "NUM",	0, "expected packet count, for Losses"},
+	{"tables",	'm', "LIST",	0, "comma separated tables to print\n"
+					   "	Def: all | Opt: u2u, stddev, duploss, tbs, pct\n"
+					   "	launch: TX log hw - launch txtime per queue"},
+	{"plot",	'o', "FILE",	0, "write latency and plot-col columns to FILE"},
+	{"plot-col",	'p', "COL",	0, "second column of the plot file\n"
+					   "	Def: seq-col"},
+	{"save-hist",	'H', "FILE",	0, "save the U2U histogram as a run profile for tsn-compare"},
+	{"meta",	'M', "KEY=VAL",	0, "metadata stored in the run profile, repeatable\n"
+					   "	e.g. -M kernel=$(uname -r) -M cycle=1000000"},
+	{ 0 }
+};
+
+static int parse_col(char *arg)
+{
+	char *str_end = NULL;
+	long res;
+
+	errno = 0;
+	res = strtol(arg, &str_end, 10);
+	if (errno || res < 1 || res > MAX_COLUMNS || *str_end) {
+		fprintf(stderr, "Error: invalid column %s. Check --help\n", arg);
+		exit(EXIT_FAILURE);
+	}
+	return (int)res;
+}
+
+static unsigned int parse_tables(char *arg)
+{
+	unsigned int tables = 0;
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (!strcmp(tok, "u2u"))
+			tables |= TABLE_U2U;
+		else if (!strcmp(tok, "stddev"))
+			tables |= TABLE_STDDEV;
+		else if (!strcmp(tok, "duploss"))
+			tables |= TABLE_DUPLOSS;
+		else if (!strcmp(tok, "tbs"))
+			tables |= TABLE_TBS;
+		else if (!strcmp(tok, "pct"))
+			tables |= TABLE_PCT;
+		else if (!strcmp(tok, "launch"))
+			tables |= TABLE_LAUNCH;
+		else if (!strcmp(tok, "all"))
+			tables |= TABLE_ALL;
+		else {
+			fprintf(stderr, "Error: invalid table %s. Check --help\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return tables;
+}
+
+static error_t parser(int key, char *arg, struct argp_state *state)
+{
+	struct opt *opt = state->input;
+	char *str_end = NULL;
+
+	switch (key) {
+	case 'l':
+		opt->lat_col = parse_col(arg);
+		break;
+	case 's':
+		opt->seq_col = parse_col(arg);
+		break;
+	case 'r':
+		opt->recv_col = parse_col(arg);
+		break;
+	case 't':
+		opt->tbs_col = parse_col(arg);
+		break;
+	case 'p':
+		opt->plot_col = parse_col(arg);
+		break;
+	case 'n':
+		errno = 0;
+		opt->expected = strtol(arg, &str_end, 10);
+		if (errno || opt->expected < 0 || *str_end) {
+			fprintf(stderr, "Error: invalid packet count. Check --help\n");
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case 'm':
+		opt->tables = parse_tables(arg);
+		break;
+	case 'o':
+		opt->plot_file = arg;
+		break;
+	case 'H':
+		opt->hist_file = arg;
+		break;
+	case 'M':
+		if (!strchr(arg, '=') || strchr(arg, '\n') ||
+		    opt->meta_count >= MAX_META) {
+			fprintf(stderr, "Error: invalid metadata %s. Check --help\n", arg);
+			exit(EXIT_FAILURE);
+		}
+		opt->meta[opt->meta_count++] = arg;
+		break;
+	case ARGP_KEY_ARG:
+		if (opt->file)
+			argp_usage(state);
+		opt->file = arg;
+		break;
+	case ARGP_KEY_END:
+		if (!opt->file)
+			argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static char usage[] = "[-l COL] [-s COL] [-n NUM] [-m TABLES] [-H FILE] FILE";
+
+static char summary[] = "  Streaming analyzer for txrx-tsn and opcua-server logs";
+
+static struct argp argp = { options, parser, usage, summary };
+
+/* SWAR: true if all 8 bytes are ASCII digits */
+static inline int swar_is_digits(uint64_t chunk)
+{
+	return ((chunk & 0xf0f0f0f0f0f0f0f0ULL) |
+		(((chunk + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+		0x3333333333333333ULL;
+}
+
+/* SWAR: convert 8 ASCII digits (first digit in the lowest byte) */
+static inline uint64_t swar_parse8(uint64_t chunk)
+{
+	chunk -= 0x3030303030303030ULL;
+	chunk = (chunk * 10) + (chunk >> 8);
+	chunk = (((chunk & 0x000000ff000000ffULL) * 0x000f424000000064ULL) +
+		 (((chunk >> 16) & 0x000000ff000000ffULL) * 0x0000271000000001ULL)) >> 32;
+	return chunk;
+}
+
+/* Parse the leading integer of a field, 8 digits at a time. Like awk, a
+ * field without a leading number is 0.
+ */
+static int64_t parse_int(const char *p, size_t len)
+{
+	uint64_t val = 0, chunk;
+	int neg = 0;
+
+	if (len && *p == '-') {
+		neg = 1;
+		p++;
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&chunk, p, sizeof(chunk));
+		if (!swar_is_digits(chunk))
+			break;
+		val = val * 100000000ULL + swar_parse8(chunk);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len && *p >= '0' && *p <= '9') {
+		val = val * 10 + (*p - '0');
+		p++;
+		len--;
+	}
+
+	return neg ? -(int64_t)val : (int64_t)val;
+}
+
+/* Same as grep -x -E '[0-9]+' */
+static int is_digits(const char *p, size_t len)
+{
+	uint64_t chunk;
+
+	if (!len)
+		return 0;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&chunk, p, sizeof(chunk));
+		if (!swar_is_digits(chunk))
+			return 0;
+	}
+
+	for (; len; p++, len--)
+		if (*p < '0' || *p > '9')
+			return 0;
+
+	return 1;
+}
+
+static inline void running_add(struct running *r, double x)
+{
+	double delta = x - r->mean;
+
+	r->n++;
+	r->mean += delta / r->n;
+	r->m2 += delta * (x - r->mean);
+}
+
+static inline double running_stddev(struct running *r)
+{
+	return r->n ? sqrt(r->m2 / r->n) : 0;
+}
+
+static inline int hist_index(uint64_t v)
+{
+	int msb;
+
+	if (v < 2 * HIST_SUB_COUNT)
+		return (int)v;
+
+	msb = 63 - __builtin_clzll(v);
+	return ((msb - HIST_SUB_BITS) << HIST_SUB_BITS) +
+	       (int)(v >> (msb - HIST_SUB_BITS));
+}
+
+/* Midpoint of a bucket */
+static double hist_value(int idx)
+{
+	int shift;
+	uint64_t m;
+
+	if (idx < 2 * HIST_SUB_COUNT)
+		return idx;
+
+	shift = (idx >> HIST_SUB_BITS) - 1;
+	m = (idx & (HIST_SUB_COUNT - 1)) | HIST_SUB_COUNT;
+	return (double)(m << shift) + (double)((1ULL << shift) - 1) / 2;
+}
+
+/* Value at the given percentile, walking from the most negative bucket */
+static double hist_percentile(struct stats *st, double pct)
+{
+	uint64_t rank, seen = 0;
+	double v = 0;
+	int i;
+
+	if (!st->count)
+		return 0;
+
+	rank = (uint64_t)ceil(pct / 100.0 * st->count);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = HIST_BUCKETS - 1; i >= 0; i--) {
+		seen += st->neg[i];
+		if (seen >= rank) {
+			v = -hist_value(i);
+			goto out;
+		}
+	}
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += st->pos[i];
+		if (seen >= rank) {
+			v = hist_value(i);
+			goto out;
+		}
+	}
+out:
+	if (v > st->max)
+		v = st->max;
+	if (v < st->min)
+		v = st->min;
+	return v;
+}
+
+/* Format like awk's print: integers as-is, others with %.6g */
+static const char *awk_num(char *buf, size_t len, double v)
+{
+	if (v == (double)(int64_t)v)
+		snprintf(buf, len, "%ld", (int64_t)v);
+	else
+		snprintf(buf, len, "%.6g", v);
+	return buf;
+}
+
+/* Split on blanks like awk's default FS */
+static void split_line(const char *line, const char *end, const char **start,
+		       size_t *len, int max_col)
+{
+	const char *p = line;
+	int col = 0;
+
+	while (p < end && col < max_col) {
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		if (p == end)
+			break;
+		start[++col] = p;
+		while (p < end && *p != ' ' && *p != '\t')
+			p++;
+		len[col] = p - start[col];
+	}
+}
+
+static void stats_add(struct stats *st, int64_t lat)
+{
+	if (!st->count || lat > st->max)
+		st->max = lat;
+	if (!st->count || lat < st->min)
+		st->min = lat;
+	st->total += lat;
+	st->count++;
+	if (lat < 0)
+		st->neg[hist_index(-(uint64_t)lat)]++;
+	else
+		st->pos[hist_index(lat)]++;
+}
+
+static void analyze_line(struct opt *opt, struct stats *st, FILE *plot,
+			 const char *line, const char *end, int max_col)
+{
+	const char *start[MAX_COLUMNS + 1] = { 0 };
+	size_t len[MAX_COLUMNS + 1] = { 0 };
+	int64_t lat, seq, rx;
+
+	split_line(line, end, start, len, max_col);
+
+	lat = parse_int(start[opt->lat_col], len[opt->lat_col]);
+	seq = parse_int(start[opt->seq_col], len[opt->seq_col]);
+
+	if (seq > 0)
+		stats_add(st, lat);
+
+	running_add(&st->all, lat);
+
+	if (is_digits(start[opt->recv_col], len[opt->recv_col]))
+		st->received++;
+
+	/* uniq -D: every line of a run of equal adjacent values */
+	if (st->prev_seq && len[opt->seq_col] == st->prev_seq_len &&
+	    !memcmp(start[opt->seq_col], st->prev_seq, st->prev_seq_len)) {
+		st->run++;
+	} else {
+		if (st->run > 1)
+			st->duplicates += st->run;
+		st->run = 1;
+	}
+	st->prev_seq = start[opt->seq_col] ? start[opt->seq_col] : "";
+	st->prev_seq_len = len[opt->seq_col];
+
+	rx = parse_int(start[opt->tbs_col], len[opt->tbs_col]);
+	if (st->have_prev_rx)
+		running_add(&st->tbs, rx - st->prev_rx);
+	st->prev_rx = rx;
+	st->have_prev_rx = 1;
+
+	if (plot) {
+		fwrite(start[opt->lat_col] ? start[opt->lat_col] : "", 1,
+		       len[opt->lat_col], plot);
+		fputc('\t', plot);
+		fwrite(start[opt->plot_col] ? start[opt->plot_col] : "", 1,
+		       len[opt->plot_col], plot);
+		fputc('\n', plot);
+	}
+}
+
+static void analyze_launch_line(struct launch *ln, struct stats *st,
+				const char *line, const char *end)
+{
+	const char *start[MAX_COLUMNS + 1] = { 0 };
+	size_t len[MAX_COLUMNS + 1] = { 0 };
+	int64_t hw, target, err, q;
+	struct stats *qs;
+
+	split_line(line, end, start, len, LAUNCH_QUEUE_COL);
+	if (!start[LAUNCH_QUEUE_COL])
+		return;
+
+	q = parse_int(start[LAUNCH_QUEUE_COL], len[LAUNCH_QUEUE_COL]);
+	if (q < 0 || q >= MAX_QUEUES)
+		return;
+
+	ln->rows[q]++;
+	hw = parse_int(start[LAUNCH_HW_COL], len[LAUNCH_HW_COL]);
+	target = parse_int(start[LAUNCH_TARGET_COL], len[LAUNCH_TARGET_COL]);
+	if (!hw || !target) {
+		ln->missing[q]++;
+		return;
+	}
+
+	qs = ln->queue[q];
+	if (!qs) {
+		qs = calloc(1, sizeof(*qs));
+		if (!qs) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		ln->queue[q] = qs;
+	}
+
+	err = hw - target;
+	stats_add(qs, err);
+	running_add(&qs->all, err);
+	stats_add(st, err);
+	running_add(&st->all, err);
+}
+
+static void print_launch_row(const char *name, struct stats *st,
+			     uint64_t missing)
+{
+	double avg = st->count ? st->total / st->count : 0;
+	char a[32], b[32];
+
+	fprintf(stdout, "%s\t%lu\t%lu\t%ld\t%s\t%ld\t%s\t%.0f\t%.0f\t%.0f\t%.0f\n",
+		name, st->count, missing, st->count ? st->min : 0,
+		awk_num(a, sizeof(a), avg), st->count ? st->max : 0,
+		awk_num(b, sizeof(b), running_stddev(&st->all)),
+		hist_percentile(st, 50), hist_percentile(st, 99),
+		hist_percentile(st, 99.9), hist_percentile(st, 99.99));
+}
+
+static void print_launch(struct launch *ln, struct stats *st)
+{
+	static struct stats empty;
+	uint64_t missing = 0;
+	char name[16];
+	int q;
+
+	fprintf(stdout, "Queue\tCount\tNoHWTS\tMin\tAvg\tMax\tStdDev\tP50\tP99\tP99.9\tP99.99\n");
+	for (q = 0; q < MAX_QUEUES; q++) {
+		if (!ln->rows[q])
+			continue;
+		snprintf(name, sizeof(name), "Q%d", q);
+		print_launch_row(name, ln->queue[q] ? ln->queue[q] : &empty,
+				 ln->missing[q]);
+		missing += ln->missing[q];
+	}
+	print_launch_row("All", st, missing);
+}
+
+/* Run profile: metadata then one "value count" line per non-empty bucket,
+ * ascending. Values are bucket midpoints in ns.
+ */
+static void save_profile(struct opt *opt, struct stats *st)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(opt->hist_file, "w");
+	if (!f) {
+		fprintf(stderr, "Error: %s: %s\n", opt->hist_file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(f, PROFILE_MAGIC "\n");
+	for (i = 0; i < opt->meta_count; i++)
+		fprintf(f, "# meta %s\n", opt->meta[i]);
+	fprintf(f, "# count %lu\n# min %ld\n# max %ld\n",
+		st->count, st->min, st->max);
+	fprintf(f, "# expected %ld\n# received %lu\n# duplicates %lu\n",
+		opt->expected, st->received, st->duplicates);
+
+	for (i = HIST_BUCKETS - 1; i >= 0; i--)
+		if (st->neg[i])
+			fprintf(f, "%.0f %lu\n", -hist_value(i), st->neg[i]);
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if (st->pos[i])
+			fprintf(f, "%.0f %lu\n", hist_value(i), st->pos[i]);
+
+	if (fclose(f)) {
+		fprintf(stderr, "Error: %s: %s\n", opt->hist_file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void print_tables(struct opt *opt, struct stats *st)
+{
+	double avg = st->count ? st->total / st->count : 0;
+	double sd, tbs_sd;
+	char a[32], b[32];
+
+	if (opt->tables & TABLE_U2U)
+		fprintf(stdout, "Results\tMax\tAvg\tMin\nU2U\t%ld\t%s\t%ld\n",
+			st->max, awk_num(a, sizeof(a), avg), st->min);
+
+	if (opt->tables & TABLE_STDDEV) {
+		sd = running_stddev(&st->all);
+		fprintf(stdout, "Stddev\tCV\n%s\t%.5f\n",
+			awk_num(a, sizeof(a), sd), avg ? sd / avg : 0);
+	}
+
+	if (opt->tables & TABLE_DUPLOSS)
+		fprintf(stdout, "Expected\tReceived\tDuplicates\tLosses\n"
+			"%ld\t%lu\t%lu\t%ld\n",
+			opt->expected, st->received, st->duplicates,
+			opt->expected - (long)st->received - (long)st->duplicates);
+
+	if (opt->tables & TABLE_TBS) {
+		tbs_sd = running_stddev(&st->tbs);
+		fprintf(stdout, "Results\tAvg\tStdDev\tCV\nTBS\t%s\t%s\t%.5f\n",
+			awk_num(a, sizeof(a), st->tbs.mean),
+			awk_num(b, sizeof(b), tbs_sd),
+			st->tbs.mean ? tbs_sd / st->tbs.mean : 0);
+	}
+
+	if (opt->tables & TABLE_PCT)
+		fprintf(stdout, "Percentile\tP50\tP90\tP99\tP99.9\tP99.99\tP99.999\n"
+			"U2U\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\n",
+			hist_percentile(st, 50), hist_percentile(st, 90),
+			hist_percentile(st, 99), hist_percentile(st, 99.9),
+			hist_percentile(st, 99.99), hist_percentile(st, 99.999));
+}
+
+int main(int argc, char *argv[])
+{
+	const char *data, *p, *end, *nl;
+	struct launch launch;
+	struct stats *st;
+	FILE *plot = NULL;
+	struct opt opt;
+	struct stat sb;
+	int max_col;
+	int fd, i;
+
+	memset(&opt, 0, sizeof(opt));
+	memset(&launch, 0, sizeof(launch));
+	opt.lat_col = 1;
+	opt.seq_col = 2;
+	opt.tbs_col = 6;
+	opt.tables = TABLE_ALL;
+
+	argp_parse(&argp, argc, argv, 0, 0, &opt);
+
+	if (!opt.recv_col)
+		opt.recv_col = opt.seq_col;
+	if (!opt.plot_col)
+		opt.plot_col = opt.seq_col;
+
+	max_col = opt.lat_col;
+	if (opt.seq_col > max_col)
+		max_col = opt.seq_col;
+	if (opt.recv_col > max_col)
+		max_col = opt.recv_col;
+	if (opt.plot_col > max_col)
+		max_col = opt.plot_col;
+	if (opt.tbs_col > max_col)
+		max_col = opt.tbs_col;
+
+	st = calloc(1, sizeof(*st));
+	if (!st) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(opt.file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb)) {
+		fprintf(stderr, "Error: %s: %s\n", opt.file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (opt.plot_file) {
+		plot = fopen(opt.plot_file, "w");
+		if (!plot) {
+			fprintf(stderr, "Error: %s: %s\n", opt.plot_file,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		setvbuf(plot, NULL, _IOFBF, 1 << 20);
+	}
+
+	if (sb.st_size > 0) {
+		data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "Error: mmap %s: %s\n", opt.file,
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		madvise((void *)data, sb.st_size, MADV_SEQUENTIAL);
+
+		end = data + sb.st_size;
+		for (p = data; p < end; p = nl + 1) {
+			nl = memchr(p, '\n', end - p);
+			if (!nl)
+				nl = end;
+			if (opt.tables & TABLE_LAUNCH)
+				analyze_launch_line(&launch, st, p, nl);
+			else
+				analyze_line(&opt, st, plot, p, nl, max_col);
+		}
+
+		munmap((void *)data, sb.st_size);
+	}
+	close(fd);
+
+	if (st->run > 1)
+		st->duplicates += st->run;
+
+	if (plot)
+		fclose(plot);
+
+	if (opt.tables & TABLE_LAUNCH)
+		print_launch(&launch, st);
+	else
+		print_tables(&opt, st);
+	if (opt.hist_file)
+		save_profile(&opt, st);
+	for (i = 0; i < MAX_QUEUES; i++)
+		free(launch.queue[i]);
+	free(st);
+
+	return 0;
+}
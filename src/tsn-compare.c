@@ -0,0 +1,383 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#include <argp.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Compares two run profiles saved by tsn-analyze -H. Prints metadata that
+ * differs, percentile deltas and a two-sample Kolmogorov-Smirnov test, and
+ * exits with EXIT_REGRESSION when the new run's tail is significantly worse.
+ */
+
+#define PROFILE_MAGIC	"# tsn-profile v1"
+#define MAX_META	32
+#define MAX_LINE	1024
+
+#define EXIT_REGRESSION	1
+#define EXIT_ERROR	2
+
+struct profile {
+	const char *file;
+	char *meta[MAX_META];
+	int meta_count;
+	uint64_t count;
+	int64_t min;
+	int64_t max;
+
+	/* Non-empty buckets, ascending by value */
+	double *val;
+	uint64_t *cnt;
+	size_t n;
+	size_t cap;
+};
+
+struct opt {
+	char *base_file;
+	char *new_file;
+	double alpha;
+	double threshold;
+};
+
+static struct argp_option options[] = {
+	{"alpha",	'a', "NUM",	0, "KS significance level\n"
+					   "	Def: 0.01"},
+	{"threshold",	't', "PCT",	0, "tail (P99, P99.9, P99.99) increase that counts as a regression\n"
+					   "	Def: 10"},
+	{ 0 }
+};
+
+static double parse_double(char *arg, const char *what)
+{
+	char *str_end = NULL;
+	double res;
+
+	errno = 0;
+	res = strtod(arg, &str_end);
+	if (errno || res < 0 || *str_end) {
+		fprintf(stderr, "Error: invalid %s %s. Check --help\n", what, arg);
+		exit(EXIT_ERROR);
+	}
+	return res;
+}
+
+static error_t parser(int key, char *arg, struct argp_state *state)
+{
+	struct opt *opt = state->input;
+
+	switch (key) {
+	case 'a':
+		opt->alpha = parse_double(arg, "alpha");
+		break;
+	case 't':
+		opt->threshold = parse_double(arg, "threshold");
+		break;
+	case ARGP_KEY_ARG:
+		if (!opt->base_file)
+			opt->base_file = arg;
+		else if (!opt->new_file)
+			opt->new_file = arg;
+		else
+			argp_usage(state);
+		break;
+	case ARGP_KEY_END:
+		if (!opt->new_file)
+			argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static char usage[] = "[-a ALPHA] [-t PCT] BASELINE NEW";
+
+static char summary[] = "  Compare a run profile against a baseline (see tsn-analyze -H)";
+
+static struct argp argp = { options, parser, usage, summary };
+
+static void profile_add(struct profile *p, double val, uint64_t cnt)
+{
+	if (p->n == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 1024;
+		p->val = realloc(p->val, p->cap * sizeof(*p->val));
+		p->cnt = realloc(p->cnt, p->cap * sizeof(*p->cnt));
+		if (!p->val || !p->cnt) {
+			fprintf(stderr, "Error: out of memory\n");
+			exit(EXIT_ERROR);
+		}
+	}
+	p->val[p->n] = val;
+	p->cnt[p->n] = cnt;
+	p->n++;
+}
+
+static void profile_load(struct profile *p, const char *file)
+{
+	char line[MAX_LINE];
+	uint64_t total = 0;
+	unsigned long cnt;
+	double val;
+	FILE *f;
+	char *s;
+
+	memset(p, 0, sizeof(*p));
+	p->file = file;
+	p->min = INT64_MIN;
+	p->max = INT64_MAX;
+
+	f = fopen(file, "r");
+	if (!f) {
+		fprintf(stderr, "Error: %s: %s\n", file, strerror(errno));
+		exit(EXIT_ERROR);
+	}
+
+	if (!fgets(line, sizeof(line), f) ||
+	    strncmp(line, PROFILE_MAGIC, strlen(PROFILE_MAGIC))) {
+		fprintf(stderr, "Error: %s: not a tsn-profile file\n", file);
+		exit(EXIT_ERROR);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+
+		if (!strncmp(line, "# meta ", 7)) {
+			if (p->meta_count >= MAX_META)
+				continue;
+			s = strdup(line + 7);
+			if (!s) {
+				fprintf(stderr, "Error: out of memory\n");
+				exit(EXIT_ERROR);
+			}
+			p->meta[p->meta_count++] = s;
+		} else if (!strncmp(line, "# min ", 6)) {
+			p->min = strtoll(line + 6, NULL, 10);
+		} else if (!strncmp(line, "# max ", 6)) {
+			p->max = strtoll(line + 6, NULL, 10);
+		} else if (line[0] == '#' || !line[0]) {
+			continue;
+		} else if (sscanf(line, "%lf %lu", &val, &cnt) == 2) {
+			if (p->n && val <= p->val[p->n - 1]) {
+				fprintf(stderr, "Error: %s: values not ascending\n", file);
+				exit(EXIT_ERROR);
+			}
+			profile_add(p, val, cnt);
+			total += cnt;
+		} else {
+			fprintf(stderr, "Error: %s: bad line: %s\n", file, line);
+			exit(EXIT_ERROR);
+		}
+	}
+	fclose(f);
+
+	p->count = total;
+	if (!p->count) {
+		fprintf(stderr, "Error: %s: empty histogram\n", file);
+		exit(EXIT_ERROR);
+	}
+}
+
+/* Same rank rule as tsn-analyze, so the numbers match its pct table */
+static double profile_percentile(struct profile *p, double pct)
+{
+	uint64_t rank, seen = 0;
+	double v;
+	size_t i;
+
+	if (pct >= 100 && p->max != INT64_MAX)
+		return p->max;
+
+	rank = (uint64_t)ceil(pct / 100.0 * p->count);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < p->n; i++) {
+		seen += p->cnt[i];
+		if (seen >= rank)
+			break;
+	}
+	v = p->val[i < p->n ? i : p->n - 1];
+
+	if (v > p->max)
+		v = p->max;
+	if (v < p->min)
+		v = p->min;
+	return v;
+}
+
+static const char *meta_find(struct profile *p, const char *key, size_t len)
+{
+	int i;
+
+	for (i = 0; i < p->meta_count; i++)
+		if (!strncmp(p->meta[i], key, len) && p->meta[i][len] == '=')
+			return p->meta[i] + len + 1;
+	return NULL;
+}
+
+static void print_meta(struct profile *a, struct profile *b)
+{
+	const char *va, *vb;
+	size_t len;
+	int i, diff = 0;
+
+	fprintf(stdout, "Metadata\tBaseline\tNew\n");
+	for (i = 0; i < a->meta_count; i++) {
+		len = strcspn(a->meta[i], "=");
+		va = a->meta[i] + len + 1;
+		vb = meta_find(b, a->meta[i], len);
+		if (!vb || strcmp(va, vb)) {
+			fprintf(stdout, "%.*s\t%s\t%s\n", (int)len, a->meta[i],
+				va, vb ? vb : "-");
+			diff++;
+		}
+	}
+	for (i = 0; i < b->meta_count; i++) {
+		len = strcspn(b->meta[i], "=");
+		if (!meta_find(a, b->meta[i], len)) {
+			fprintf(stdout, "%.*s\t-\t%s\n", (int)len, b->meta[i],
+				b->meta[i] + len + 1);
+			diff++;
+		}
+	}
+	if (!diff)
+		fprintf(stdout, "(identical)\t\t\n");
+	fputc('\n', stdout);
+}
+
+/* Kolmogorov distribution tail Q_KS(lambda) */
+static double ks_q(double lambda)
+{
+	double sum = 0, term, sign = 1;
+	int j;
+
+	if (lambda < 0.2)
+		return 1;
+
+	for (j = 1; j <= 100; j++) {
+		term = sign * exp(-2.0 * j * j * lambda * lambda);
+		sum += term;
+		if (fabs(term) < 1e-12 * fabs(sum))
+			break;
+		sign = -sign;
+	}
+	sum *= 2;
+	return sum < 0 ? 0 : (sum > 1 ? 1 : sum);
+}
+
+/* Walk both histograms in value order. d_plus is the largest amount by
+ * which the baseline CDF leads the new one, i.e. the new run is slower.
+ */
+static void ks_test(struct profile *a, struct profile *b, double *d,
+		    double *d_plus, double *p)
+{
+	uint64_t ca = 0, cb = 0;
+	size_t i = 0, j = 0;
+	double fa, fb, ne, x;
+
+	*d = *d_plus = 0;
+	while (i < a->n || j < b->n) {
+		if (j >= b->n || (i < a->n && a->val[i] <= b->val[j]))
+			x = a->val[i];
+		else
+			x = b->val[j];
+
+		while (i < a->n && a->val[i] == x)
+			ca += a->cnt[i++];
+		while (j < b->n && b->val[j] == x)
+			cb += b->cnt[j++];
+
+		fa = (double)ca / a->count;
+		fb = (double)cb / b->count;
+		if (fabs(fa - fb) > *d)
+			*d = fabs(fa - fb);
+		if (fa - fb > *d_plus)
+			*d_plus = fa - fb;
+	}
+
+	ne = (double)a->count * b->count / (a->count + b->count);
+	*p = ks_q((sqrt(ne) + 0.12 + 0.11 / sqrt(ne)) * *d);
+}
+
+int main(int argc, char *argv[])
+{
+	static const double pcts[] = { 50, 90, 99, 99.9, 99.99, 100 };
+	static const char *names[] = { "P50", "P90", "P99", "P99.9", "P99.99", "Max" };
+	struct profile base, new;
+	double vb, vn, pct, worst = 0;
+	double d, d_plus, p;
+	int regression;
+	struct opt opt;
+	unsigned int i;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.alpha = 0.01;
+	opt.threshold = 10;
+
+	argp_parse(&argp, argc, argv, 0, 0, &opt);
+
+	profile_load(&base, opt.base_file);
+	profile_load(&new, opt.new_file);
+
+	print_meta(&base, &new);
+
+	fprintf(stdout, "Percentile\tBaseline\tNew\tDelta\tDelta%%\n");
+	fprintf(stdout, "Count\t%lu\t%lu\t%ld\t\n", base.count, new.count,
+		(long)new.count - (long)base.count);
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		vb = profile_percentile(&base, pcts[i]);
+		vn = profile_percentile(&new, pcts[i]);
+		pct = vb ? (vn - vb) / fabs(vb) * 100 : 0;
+		fprintf(stdout, "%s\t%.0f\t%.0f\t%+.0f\t%+.2f\n",
+			names[i], vb, vn, vn - vb, pct);
+
+		/* Max is a single sample, keep it out of the verdict */
+		if (pcts[i] >= 99 && pcts[i] < 100 && pct > worst)
+			worst = pct;
+	}
+
+	ks_test(&base, &new, &d, &d_plus, &p);
+	fprintf(stdout, "\nKS\tD\tD+\tp-value\n");
+	fprintf(stdout, "U2U\t%.5f\t%.5f\t%.3g\n", d, d_plus, p);
+
+	regression = p < opt.alpha && d_plus > 0 && worst > opt.threshold;
+	fprintf(stdout, "\nResult: %s (tail %+.2f%%, threshold %.2f%%, alpha %g)\n",
+		regression ? "REGRESSION" :
+		p < opt.alpha ? "DIFFERENT, tail within threshold" : "PASS",
+		worst, opt.threshold, opt.alpha);
+
+	return regression ? EXIT_REGRESSION : EXIT_SUCCESS;
+}
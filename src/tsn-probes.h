@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef TSN_PROBES_HEADER
+#define TSN_PROBES_HEADER
+
+/* USDT probes (provider "tsn") on the hot path of txrx-tsn and opcua-server.
+ * Built in when configure finds sys/sdt.h (--disable-usdt to drop them);
+ * each probe is a single nop until a tracer attaches. Arguments are seq
+ * and nanosecond timestamps in the app's clock domain, e.g.
+ *   bpftrace -e 'usdt:./txrx-tsn:tsn:send_exit { printf("%d %d\n", arg0, arg1); }'
+ *
+ *   tx_wakeup(seq, wake_ns)	 sender woke up for this cycle
+ *   payload_stamp(seq, tx_ns)	 user tx timestamp written into the payload
+ *   send_enter(seq)		 before sendto/sendmsg/AF_XDP tx kick
+ *   send_exit(seq, ret)	 after the send call, its result (AF_XDP: the
+ *				 kick's sendto, -1 if the frame was not queued)
+ *   tx_complete(seq, hw_ns)	 hw tx timestamp / AF_XDP completion (seq = count)
+ *   rx_pop(len, rx_ns)		 frame taken from the socket or XDP rx ring
+ *   rx_timestamp(seq, hw_ns, rx_ns) payload validated, timestamps extracted
+ *   pub_enter(seq, txtime)	 opcua pubCallback, seq of the previous frame
+ *   pub_exit(seq, txtime)	 seq of the frame just published
+ *   sub_enter(seq, wake_ns)	 opcua subCallback, seq last received
+ *   sub_exit(seq, wake_ns)	 seq last received after the callback
+ */
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+
+#define TSN_PROBE1(name, a)		DTRACE_PROBE1(tsn, name, a)
+#define TSN_PROBE2(name, a, b)		DTRACE_PROBE2(tsn, name, a, b)
+#define TSN_PROBE3(name, a, b, c)	DTRACE_PROBE3(tsn, name, a, b, c)
+#else
+/* sizeof keeps probe-only values "used" without evaluating them */
+#define TSN_PROBE1(name, a)		do { (void)sizeof(a); } while (0)
+#define TSN_PROBE2(name, a, b)		do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define TSN_PROBE3(name, a, b, c)	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#endif
+
+#endif
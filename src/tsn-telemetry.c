@@ -0,0 +1,244 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#include <argp.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+/* Reader for the shared memory telemetry of txrx-tsn (-M) and opcua-server
+ * ("subscriber_telemetry_shm"). Prints a live summary, or exports the latest
+ * samples / histogram as gnuplot data, e.g. with common/liveplot.gnu:
+ *   filename='< ./tsn-telemetry -g -c 100 txrx'
+ */
+
+#define MODE_SUMMARY	0
+#define MODE_SAMPLES	1
+#define MODE_HIST	2
+
+struct opt {
+	char *name;
+	int mode;
+	int once;
+	uint32_t count;
+	uint32_t interval;
+};
+
+static struct argp_option options[] = {
+	{"gnuplot",	'g', 0,		0, "print the latest samples as: index seq latency"},
+	{"histogram",	'H', 0,		0, "print histogram as: bin(us) total last-window"},
+	{"count",	'c', "NUM",	0, "number of samples for -g\n"
+					   "	Def: 1024 | Min: 1 | Max: 1024"},
+	{"interval",	'i', "SEC",	0, "summary refresh interval\n"
+					   "	Def: 1"},
+	{"once",	'1', 0,		0, "print one summary and exit"},
+	{ 0 }
+};
+
+static long parse_num(char *arg, long min, long max, const char *what)
+{
+	char *str_end = NULL;
+	long res;
+
+	errno = 0;
+	res = strtol(arg, &str_end, 10);
+	if (errno || res < min || res > max || *str_end) {
+		fprintf(stderr, "Error: invalid %s. Check --help\n", what);
+		exit(EXIT_FAILURE);
+	}
+	return res;
+}
+
+static error_t parser(int key, char *arg, struct argp_state *state)
+{
+	struct opt *opt = state->input;
+
+	switch (key) {
+	case 'g':
+		opt->mode = MODE_SAMPLES;
+		break;
+	case 'H':
+		opt->mode = MODE_HIST;
+		break;
+	case 'c':
+		opt->count = parse_num(arg, 1, TELEMETRY_LAST_N, "sample count");
+		break;
+	case 'i':
+		opt->interval = parse_num(arg, 1, 3600, "interval");
+		break;
+	case '1':
+		opt->once = 1;
+		break;
+	case ARGP_KEY_ARG:
+		if (opt->name)
+			argp_usage(state);
+		opt->name = arg;
+		break;
+	case ARGP_KEY_END:
+		if (!opt->name)
+			argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static char usage[] = "NAME";
+
+static char summary[] = "  Live latency telemetry reader for txrx-tsn and opcua-server";
+
+static struct argp argp = { options, parser, usage, summary };
+
+/* Upper bound in ns of the bin holding the p-th fraction of samples */
+static int64_t hist_pct(const uint64_t *hist, double p)
+{
+	uint64_t total = 0, sum = 0, target;
+	int i;
+
+	for (i = 0; i < TELEMETRY_HIST_BINS; i++)
+		total += hist[i];
+	if (!total)
+		return 0;
+
+	target = (uint64_t)(p * total);
+	if (target >= total)
+		target = total - 1;
+
+	for (i = 0; i < TELEMETRY_HIST_BINS; i++) {
+		sum += hist[i];
+		if (sum > target)
+			break;
+	}
+	return (int64_t)(i + 1) * TELEMETRY_BIN_NS;
+}
+
+static uint64_t hist_total(const uint64_t *hist)
+{
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < TELEMETRY_HIST_BINS; i++)
+		total += hist[i];
+	return total;
+}
+
+static void print_summary(const struct telemetry *t)
+{
+	const uint64_t *win = t->hist_win[t->win ^ 1];
+
+	printf("pkts %lu lost %lu ooo %lu | min %ld max %ld last %ld | "
+	       "1s: n %lu p50 %ld p99 %ld p99.9 %ld | "
+	       "all: p50 %ld p99 %ld p99.9 %ld p99.99 %ld\n",
+	       t->packets, t->lost, t->out_of_order,
+	       t->lat_min, t->lat_max, t->lat_last,
+	       hist_total(win), hist_pct(win, 0.50), hist_pct(win, 0.99),
+	       hist_pct(win, 0.999),
+	       hist_pct(t->hist, 0.50), hist_pct(t->hist, 0.99),
+	       hist_pct(t->hist, 0.999), hist_pct(t->hist, 0.9999));
+	fflush(stdout);
+}
+
+static void print_samples(const struct telemetry *t, uint32_t count)
+{
+	uint64_t start, i;
+
+	if (count > t->head)
+		count = t->head;
+	start = t->head - count;
+
+	for (i = start; i < t->head; i++)
+		printf("%lu\t%lu\t%ld\n", i - start,
+		       t->last[i & (TELEMETRY_LAST_N - 1)].seq,
+		       t->last[i & (TELEMETRY_LAST_N - 1)].latency);
+}
+
+static void print_hist(const struct telemetry *t)
+{
+	const uint64_t *win = t->hist_win[t->win ^ 1];
+	int i;
+
+	for (i = 0; i < TELEMETRY_HIST_BINS; i++)
+		printf("%d\t%lu\t%lu\n", i * TELEMETRY_BIN_NS / 1000,
+		       t->hist[i], win[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	struct telemetry *t, *copy;
+	struct opt opt;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.count = TELEMETRY_LAST_N;
+	opt.interval = 1;
+
+	argp_parse(&argp, argc, argv, 0, 0, &opt);
+
+	t = telemetry_attach(opt.name);
+	if (!t) {
+		fprintf(stderr, "Error: no telemetry segment /dev/shm/%s\n",
+			opt.name);
+		return EXIT_FAILURE;
+	}
+
+	copy = malloc(sizeof(*copy));
+	if (!copy) {
+		fprintf(stderr, "Error: out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	while (1) {
+		telemetry_snapshot(t, copy);
+
+		if (opt.mode == MODE_SAMPLES) {
+			print_samples(copy, opt.count);
+			break;
+		} else if (opt.mode == MODE_HIST) {
+			print_hist(copy);
+			break;
+		}
+
+		print_summary(copy);
+		if (opt.once)
+			break;
+		sleep(opt.interval);
+	}
+
+	free(copy);
+	telemetry_detach(t);
+	return EXIT_SUCCESS;
+}
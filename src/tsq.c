@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  *
  *****************************************************************************/
+#define _GNU_SOURCE
 #include <argp.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -48,14 +49,35 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <errno.h>
-
-#define BUFFER_SIZE 256
-#define CLIENT_COUNT 2
+#include <sys/epoll.h>
+#include <endian.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/timex.h>
+
+#include "txrx-clock.h"
+#include "phc-source.h"
+
+#define TSQ_MAX_TALKERS 16
+#define DEFAULT_TALKERS 2
+#define TSQ_MAX_CHANNELS 8
+#define TSQ_MAX_RATE 100000	//Hz, PEROUT period down to 10us
+#define TSQ_EVENTS_PER_READ 64
+#define TSQ_RING_SECONDS 64	//Seconds a member may run ahead of the others
+#define TSQ_LISTEN_EVENT TSQ_MAX_TALKERS	//epoll id of the TCP listen socket
+#define DEFAULT_STATS_INTERVAL 60	//s between stability reports
+#define NSEC_PER_SEC 1000000000LL
 #define DEFAULT_LISTENER_OUTFILE "tsq-listener-data.txt"
 #define NULL_OUTFILE "NULL"
 
 #define MODE_LISTENER 1
 #define MODE_TALKER 2
+#define MODE_LOCAL 3
+
+#define SOURCE_EXTTS 0		//Time-stamp a PPS or PEROUT edge
+#define SOURCE_SYSOFF 1		//Read the PHC offset to CLOCK_TAI
 
 int halt_sig;
 FILE *glob_fp;
@@ -122,8 +144,154 @@ typedef struct payload {
 	int seq;
 	long long secs;
 	long nsecs;
+	int channel;
+	/* Per-second statistics (TSQ_MSG_STATS): secs/nsecs hold the mean
+	 * edge time, min/max are phases in ns relative to the second.
+	 */
+	int count;
+	long min;
+	long max;
+	long jitter;
 } payload;
 
+/* Talker <-> listener wire format, big endian, over TCP or UDP:
+ *   header:  magic(16) version(8) type(8) len(16) uid(16)
+ *   samples: secs(64) nsecs(32) channel(16) seq(16), 16 bytes each
+ *   stats:   secs(64) mean(32) min(32) max(32) jitter(32) count(32)
+ *            channel(16) seq(16), 32 bytes each
+ * len is the full message length, so a TCP stream is split on it and a
+ * UDP datagram must match it exactly. HELLO carries one sample record per
+ * EXTTS channel the talker reports, with zero timestamps.
+ */
+#define TSQ_MAGIC		0x5451	//"TQ"
+#define TSQ_VERSION		2
+#define TSQ_MSG_HELLO		1	//Talker registers its uid and channels
+#define TSQ_MSG_START		2	//Listener starts all talkers
+#define TSQ_MSG_SAMPLES		3	//Raw EXTTS events (1 PPS)
+#define TSQ_MSG_STATS		4	//Per-second statistics (-r above 1)
+#define TSQ_MAX_BATCH		64
+#define TSQ_HELLO_RETRY_MS	1000	//UDP: resend HELLO until START
+
+struct tsq_hdr {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t type;
+	uint16_t len;
+	uint16_t uid;
+} __attribute__((packed));
+
+struct tsq_wire_sample {
+	int64_t secs;
+	uint32_t nsecs;
+	uint16_t channel;
+	uint16_t seq;
+} __attribute__((packed));
+
+struct tsq_wire_stats {
+	int64_t secs;		//PPS second
+	int32_t mean;		//Phases in ns relative to secs
+	int32_t min;
+	int32_t max;
+	uint32_t jitter;	//Standard deviation in ns
+	uint32_t count;		//Edges seen in that second
+	uint16_t channel;
+	uint16_t seq;
+} __attribute__((packed));
+
+#define TSQ_MAX_MSG (sizeof(struct tsq_hdr) + \
+		     TSQ_MAX_BATCH * sizeof(struct tsq_wire_stats))
+
+struct tsq_msg {
+	int type;
+	int uid;
+	int count;
+	payload samples[TSQ_MAX_BATCH];
+};
+
+/* TCP reassembly buffer, holds at most one partial message after parsing */
+struct tsq_rxbuf {
+	uint8_t data[2 * TSQ_MAX_MSG];
+	size_t len;
+};
+
+/* Listener state per connected talker */
+struct talker_conn {
+	int fd;
+	int uid;
+	struct tsq_rxbuf rx;
+	struct sockaddr_in addr;	//UDP: where to send START
+};
+
+/* One compared clock: an EXTTS channel of a talker */
+struct member {
+	int uid;
+	int channel;
+	payload sample;		//Sample of the round being joined
+	/* Samples not yet joined, slot = PPS second % TSQ_RING_SECONDS */
+	payload ring[TSQ_RING_SECONDS];
+	bool valid[TSQ_RING_SECONDS];
+	long long newest;	//Latest PPS second received
+	bool started;
+	unsigned long samples;
+	unsigned long missing;	//Seconds given up on without this member
+	unsigned long late;	//Samples older than the next second to join
+};
+
+/* Observation intervals of the stability statistics, in seconds */
+#define TSQ_NUM_TAUS 10
+static const int tsq_taus[TSQ_NUM_TAUS] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+#define TSQ_TAU_MAX 1000
+#define TSQ_STAB_HIST (3 * TSQ_TAU_MAX + 1)	//TDEV spans 3 tau
+#define TSQ_STAB_MAX_GAP 10	//s bridged by interpolation, more restarts
+
+/* Online time error statistics of one member against the reference.
+ *
+ * The phase x (ns) is kept per second in a ring covering 3 * TSQ_TAU_MAX,
+ * along with its running sum, so each new second adds one overlapping
+ * ADEV, TDEV and MTIE term per tau: ADEV from x(t), x(t-m), x(t-2m), TDEV
+ * from the prefix sums at t, t-m, t-2m and t-3m, MTIE from a scan of the
+ * last m+1 seconds. Every term needs the seconds it spans to be in the
+ * current segment.
+ */
+struct stability {
+	unsigned long n;	//Rounds fed
+	double mean;		//Welford
+	double m2;
+	long long max_abs;
+	unsigned long bridged;	//Seconds filled by interpolation
+	unsigned long restarts;	//Gaps too long to bridge
+
+	long long seg_start;	//First second of the contiguous segment
+	long long last;		//Last second in the ring
+	long long x[TSQ_STAB_HIST];
+	long long sum[TSQ_STAB_HIST];	//x prefix sum within the segment
+
+	double avar_sum[TSQ_NUM_TAUS];
+	unsigned long avar_n[TSQ_NUM_TAUS];
+	double tvar_sum[TSQ_NUM_TAUS];
+	unsigned long tvar_n[TSQ_NUM_TAUS];
+	long long mtie[TSQ_NUM_TAUS];
+	bool mtie_valid[TSQ_NUM_TAUS];
+};
+
+struct listener {
+	int count;		//Members to compare
+	int nconns;
+	struct talker_conn conns[TSQ_MAX_TALKERS];
+	struct member talkers[TSQ_MAX_TALKERS];
+	int nmembers;
+	unsigned long rounds;
+	long long next_sec;	//Oldest PPS second not joined or skipped yet
+	bool started;
+	unsigned long skipped;	//Seconds without a sample from every member
+	long long pair_sum[TSQ_MAX_TALKERS][TSQ_MAX_TALKERS];	//i < j only
+	long long median_sum[TSQ_MAX_TALKERS];
+	struct stability stab[TSQ_MAX_TALKERS];	//Member i - member 0, i > 0
+	long stats_interval;
+};
+
 /* User input options */
 struct opt {
 	char *args[1];
@@ -133,32 +301,75 @@ struct opt {
 	long port;
 	/* Listener */
 	char *output_file;
+	long talkers;
+	long stats_interval;
 	/* Talker */
 	long uid;
 	char *device;
+	/* Local */
+	char *devices[TSQ_MAX_TALKERS];
+	int ndevices;
+	int source;
+	int sysoff_method;	//PHC_SYSOFF_* for SOURCE_SYSOFF
+	long burst;
+	long cpu;
 	long timeout;
+	long batch;
+	int udp;
+	long rate;
+	char *perout_device;
+	long perout_index;
+	int channels[TSQ_MAX_CHANNELS];
+	int nchannels;
+	int enable_channels;	//-c given: enable/disable EXTTS ourselves
 };
 
 static struct argp_option options[] = {
 	/* Shared */
 
 	{"talker",  'T', 0,       0, "Talker mode (read AUXTS)"},
-	{"listener",'L', 0,       0, "Listener mode (listen for 2 talker and compare)"},
+	{"listener",'L', 0,       0, "Listener mode (listen for N talkers and compare)"},
+	{"local",   'l', 0,       0, "Local mode (compare the PHCs given with -d in\n"
+				     "one process, no sockets)"},
 
 	{"verbose", 'v', 0,       0, "Produce verbose output"},
 	{"ip",      'i', "ADDR",  0, "Server IP address (eg. 192.1.2.3)"},
 	{"port",    'p', "PORT",  0, "Port number\n"
 				     "	Def: 5678 | Min: 999 | Max: 9999"},
+	{"udp",     'U', 0,       0, "Use UDP instead of TCP (talkers and listener)"},
 
 	/* Listener-specific */
 	{"output",  'o', "FILE",  0, "Save output to FILE (eg. temp.txt)"},
+	{"talkers", 'n', "COUNT", 0, "Number of talkers (or talker channels) to\n"
+				     "wait for and compare\n"
+				     "	Def: 2 | Min: 2 | Max: 16"},
+	{"stats",   'S', "SEC",   0, "Print ADEV/TDEV/MTIE every SEC rounds, 0: at exit\n"
+				     "	Def: 60"},
 
 	/* Talker-specific */
-	{"device",  'd', "FILE",  0, "PTP device to read (eg. /dev/ptp1)"},
+	{"device",  'd', "FILE",  0, "PTP device to read (eg. /dev/ptp1), repeat in\n"
+				     "local mode"},
+	{"source",  's', "TYPE",  0, "Sample source: extts | sysoff | precise\n"
+				     "(sysoff, precise: PHC - CLOCK_TAI, no PPS)\n"
+				     "	Def: extts"},
+	{"burst",   'N', "COUNT", 0, "sysoff: PHC reads per sample, lowest delay wins\n"
+				     "	Def: 25 | Min: 1 | Max: 25"},
+	{"cpu",     'a', "CPU",   0, "Local mode: pin reader N to CPU + N\n"
+				     "	Def: 1"},
 	{"uid",     'u', "COUNT", 0, "Unique Talker ID"
 				     "	Def: 1234 | Min: 999 | Max: 9999"},
 	{"timeout", 't', "MSEC",  0, "Polling timeout in ms"
 				     "	Def: 1100ms | Min: 1ms | Max: 2000ms"},
+	{"batch",   'b', "COUNT", 0, "Events per message sent to the listener\n"
+				     "	Def: 1 | Min: 1 | Max: 64"},
+	{"rate",    'r', "HZ",    0, "Pulse rate. Above 1, send per-second stats\n"
+				     "	Def: 1 | Min: 1 | Max: 100000"},
+	{"channels",'c', "LIST",  0, "EXTTS channels to enable and report (eg. 0,1)\n"
+				     "	Def: 0 (enabled by setup script)"},
+	{"perout",  'O', "FILE",  0, "Source PHC to program PEROUT at -r on\n"
+				     "(eg. /dev/ptp0)"},
+	{"perout-index", 'x', "NUM", 0, "PEROUT channel on the source PHC\n"
+				     "	Def: 0"},
 
 	{ 0 }
 };
@@ -182,9 +393,45 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 	case 'L':
 		user_opt->mode = MODE_LISTENER;
 		break;
+	case 'l':
+		user_opt->mode = MODE_LOCAL;
+		break;
+	case 's':
+		if (!strcmp(arg, "extts"))
+			user_opt->source = SOURCE_EXTTS;
+		else if (!strcmp(arg, "sysoff"))
+			user_opt->source = SOURCE_SYSOFF;
+		else if (!strcmp(arg, "precise")) {
+			user_opt->source = SOURCE_SYSOFF;
+			user_opt->sysoff_method = PHC_SYSOFF_PRECISE;
+		}
+		else
+			error("Invalid source. Check --help.");
+		break;
+	case 'N':
+		len = strlen(arg);
+		user_opt->burst = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->burst < 1 || user_opt->burst > PTP_MAX_SAMPLES || str_end != &arg[len])
+			error("Invalid burst size. Check --help.");
+		break;
+	case 'a':
+		len = strlen(arg);
+		user_opt->cpu = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->cpu < 0 || user_opt->cpu >= CPU_SETSIZE || str_end != &arg[len])
+			error("Invalid CPU. Check --help.");
+		break;
 	case 'i':
 		user_opt->server_ip = arg;
 		break;
+	case 'U':
+		user_opt->udp = 1;
+		break;
+	case 'b':
+		len = strlen(arg);
+		user_opt->batch = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->batch < 1 || user_opt->batch > TSQ_MAX_BATCH || str_end != &arg[len])
+			error("Invalid batch size. Check --help.");
+		break;
 	case 'p':
 		len = strlen(arg);
 		user_opt->port = strtol((const char *)arg, &str_end, 10);
@@ -194,6 +441,18 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 	case 'o':
 		user_opt->output_file = arg;
 		break;
+	case 'n':
+		len = strlen(arg);
+		user_opt->talkers = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->talkers < 2 || user_opt->talkers > TSQ_MAX_TALKERS || str_end != &arg[len])
+			error("Invalid talker count. Check --help.");
+		break;
+	case 'S':
+		len = strlen(arg);
+		user_opt->stats_interval = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->stats_interval < 0 || str_end != &arg[len])
+			error("Invalid stats interval. Check --help.");
+		break;
 	case 'u':
 		len = strlen(arg);
 		user_opt->uid = strtol((const char *)arg, &str_end, 10);
@@ -201,7 +460,10 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 			error("Invalid UID. Check --help.");
 		break;
 	case 'd':
-		user_opt->device = arg;
+		if (user_opt->ndevices >= TSQ_MAX_TALKERS)
+			error("Too many devices. Check --help.");
+		user_opt->devices[user_opt->ndevices++] = arg;
+		user_opt->device = user_opt->devices[0];
 		break;
 	case 't':
 		len = strlen(arg);
@@ -209,322 +471,1422 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 		if (errno || user_opt->timeout <= 0 || user_opt->timeout > 2000 || str_end != &arg[len])
 			error("Invalid timeout. Check --help.");
 		break;
+	case 'r':
+		len = strlen(arg);
+		user_opt->rate = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->rate < 1 || user_opt->rate > TSQ_MAX_RATE ||
+		    str_end != &arg[len] || NSEC_PER_SEC % user_opt->rate)
+			error("Invalid rate, must divide 1s evenly. Check --help.");
+		break;
+	case 'c':
+		user_opt->nchannels = 0;
+		user_opt->enable_channels = 1;
+		for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+			len = strlen(tok);
+			if (user_opt->nchannels >= TSQ_MAX_CHANNELS)
+				error("Too many channels. Check --help.");
+			user_opt->channels[user_opt->nchannels] = strtol(tok, &str_end, 10);
+			if (errno || user_opt->channels[user_opt->nchannels] < 0 ||
+			    str_end != &tok[len])
+				error("Invalid channel list. Check --help.");
+			user_opt->nchannels++;
+		}
+		if (!user_opt->nchannels)
+			error("Invalid channel list. Check --help.");
+		break;
+	case 'O':
+		user_opt->perout_device = arg;
+		break;
+	case 'x':
+		len = strlen(arg);
+		user_opt->perout_index = strtol((const char *)arg, &str_end, 10);
+		if (errno || user_opt->perout_index < 0 || str_end != &arg[len])
+			error("Invalid PEROUT index. Check --help.");
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
 }
 
-static char usage[] = "-i <IP_ADDR> -p <PORT> -d /dev/ptp<X> -u <UID> {-T|-L}";
+static char usage[] = "-i <IP_ADDR> -p <PORT> -d /dev/ptp<X> -u <UID> [-n <TALKERS>]\n"
+		     "[-r <HZ> [-O /dev/ptp<Y>]] [-c <CH,..>] {-T|-L}\n"
+		     "-l -d /dev/ptp<X> -d /dev/ptp<Y> [-d ..] [-s extts|sysoff] [-r <HZ>]";
 
 static char summary[] = "Time Sync Quality Measurement application";
 
 static struct argp argp = { options, parser, usage, summary };
 
 /**
- *  @brief Validate payload structure received
+ *  @brief PPS second a sample belongs to
  *
- *  @param pl	pointer to payload received
- *  @param cli_ids
- *  @return validation boolean result
+ *  Rounded to the nearest second, so edges a few ns either side of the
+ *  second boundary on different talkers still pair up.
  *
+ *  @param pl	pointer to payload
+ *  @return PPS second
  */
-bool validate_payload (payload *pl, int *cli_ids, int client_num)
+long long pps_second(payload *pl)
 {
-	bool ret = false;
+	return pl->secs + (pl->nsecs >= NSEC_PER_SEC / 2);
+}
 
-	if ((pl->uid != 0) && (pl->secs != 0) && (pl->nsecs != 0)) {
-		for (int i = 0 ; i < client_num ; i++) {
-			if (cli_ids[i] == pl->uid) {
-				ret = true;
-				break;
-			}
-		}
-	}
-	return ret;
+/**
+ *  @brief Time of a sample in ns
+ */
+static inline long long sample_ns(payload *pl)
+{
+	return pl->secs * NSEC_PER_SEC + pl->nsecs;
+}
+
+/**
+ *  @brief Wire record size of a message type
+ */
+static inline size_t tsq_rec_size(int type)
+{
+	return type == TSQ_MSG_STATS ? sizeof(struct tsq_wire_stats) :
+				       sizeof(struct tsq_wire_sample);
 }
 
 /**
- *  @brief Check if all the data is received/ready for each client
+ *  @brief Build a message into buf
  *
- *  @param pl	pointer to data ready flags table
- *  @param size	size of data ready flags table
- *  @return true if data is now all available
+ *  @return message length in bytes
  */
-bool data_ready(bool *flags, int size)
+size_t tsq_pack(uint8_t *buf, int type, int uid, payload *pl, int count)
 {
-	for (int i = 0 ; i < size ; i++) {
-		if (*flags == false)
-			return false;
-		flags++;
+	struct tsq_hdr *hdr = (struct tsq_hdr *)buf;
+	struct tsq_wire_sample *ws;
+	struct tsq_wire_stats *st;
+	long long sec;
+	size_t len;
+
+	len = sizeof(*hdr) + count * tsq_rec_size(type);
+	hdr->magic = htobe16(TSQ_MAGIC);
+	hdr->version = TSQ_VERSION;
+	hdr->type = type;
+	hdr->len = htobe16(len);
+	hdr->uid = htobe16(uid);
+
+	if (type == TSQ_MSG_STATS) {
+		st = (struct tsq_wire_stats *)(hdr + 1);
+		for (int i = 0; i < count; i++) {
+			sec = pps_second(&pl[i]);
+			st[i].secs = htobe64(sec);
+			st[i].mean = htobe32(sample_ns(&pl[i]) - sec * NSEC_PER_SEC);
+			st[i].min = htobe32(pl[i].min);
+			st[i].max = htobe32(pl[i].max);
+			st[i].jitter = htobe32(pl[i].jitter);
+			st[i].count = htobe32(pl[i].count);
+			st[i].channel = htobe16(pl[i].channel);
+			st[i].seq = htobe16(pl[i].seq);
+		}
+		return len;
 	}
-	return true;
+
+	ws = (struct tsq_wire_sample *)(hdr + 1);
+	for (int i = 0; i < count; i++) {
+		ws[i].secs = htobe64(pl[i].secs);
+		ws[i].nsecs = htobe32(pl[i].nsecs);
+		ws[i].channel = htobe16(pl[i].channel);
+		ws[i].seq = htobe16(pl[i].seq);
+	}
+	return len;
 }
 
 /**
- *  @brief Reset data ready flags table
+ *  @brief Parse one message from the start of buf
  *
- *  @param pl	pointer to data ready flags table
- *  @param size	size of data ready flags table
+ *  STATS records are turned back into a sample at the mean edge time, so
+ *  the listener aligns them like raw events.
+ *
+ *  @return message length, 0 if buf holds only part of it, -1 if the
+ *  header is invalid (stream out of sync)
  */
-void reset_data_ready(bool *flags, int size)
+int tsq_unpack(const uint8_t *buf, size_t avail, struct tsq_msg *msg)
 {
-	for (int i = 0; i < size; i++) {
-		*flags = false;
-		flags++;
+	const struct tsq_hdr *hdr = (const struct tsq_hdr *)buf;
+	const struct tsq_wire_sample *ws;
+	const struct tsq_wire_stats *st;
+	payload *pl;
+	long long t;
+	size_t len, rec;
+
+	if (avail < sizeof(*hdr))
+		return 0;
+
+	len = be16toh(hdr->len);
+	rec = tsq_rec_size(hdr->type);
+	if (be16toh(hdr->magic) != TSQ_MAGIC || hdr->version != TSQ_VERSION ||
+	    len < sizeof(*hdr) || len > TSQ_MAX_MSG ||
+	    (len - sizeof(*hdr)) % rec)
+		return -1;
+
+	if (avail < len)
+		return 0;
+
+	msg->type = hdr->type;
+	msg->uid = be16toh(hdr->uid);
+	msg->count = (len - sizeof(*hdr)) / rec;
+	if (msg->count > TSQ_MAX_BATCH)
+		return -1;
+
+	ws = (const struct tsq_wire_sample *)(hdr + 1);
+	st = (const struct tsq_wire_stats *)(hdr + 1);
+	for (int i = 0; i < msg->count; i++) {
+		pl = &msg->samples[i];
+		memset(pl, 0, sizeof(*pl));
+		pl->uid = msg->uid;
+		if (msg->type != TSQ_MSG_STATS) {
+			pl->secs = (int64_t)be64toh(ws[i].secs);
+			pl->nsecs = be32toh(ws[i].nsecs);
+			pl->channel = be16toh(ws[i].channel);
+			pl->seq = be16toh(ws[i].seq);
+			continue;
+		}
+		t = (int64_t)be64toh(st[i].secs) * NSEC_PER_SEC +
+		    (int32_t)be32toh(st[i].mean);
+		pl->secs = t / NSEC_PER_SEC;
+		pl->nsecs = t % NSEC_PER_SEC;
+		pl->min = (int32_t)be32toh(st[i].min);
+		pl->max = (int32_t)be32toh(st[i].max);
+		pl->jitter = be32toh(st[i].jitter);
+		pl->count = be32toh(st[i].count);
+		pl->channel = be16toh(st[i].channel);
+		pl->seq = be16toh(st[i].seq);
 	}
+	return len;
 }
 
-/* Listener - wait for 2 talkers to connect and receive. Compare both talker
- * timestamps to get the delta and transmit out.
- * TODO: Expand it to support 4 talkers at the same time?
+/**
+ *  @brief Send a whole message, looping over partial TCP writes
  */
-void listener(struct opt *user_opt) {
+void tsq_send(int fd, int type, int uid, payload *pl, int count)
+{
+	uint8_t buf[TSQ_MAX_MSG];
+	size_t len, off = 0;
+	ssize_t n;
 
-	char *server_ip;
-	struct sockaddr_in serv;
-	socklen_t len;
-	int rounds = 0;
-	int connfd = 0;
-	int n = 0;
-	int i = 0;
-	int verbose;
-	int max_sd = 0;
-	int activity = 0;
-	char recv_buff[BUFFER_SIZE];
-	long long secs_error;
-	long nsecs_error;
-	int cli_ids[CLIENT_COUNT];
-	int cli_conns[CLIENT_COUNT] = {};
-	payload cli_data[CLIENT_COUNT];
-	payload temp_data, keep_data;
-	fd_set readfds;
-	bool pl_valid_flag[CLIENT_COUNT] = {false, false};
-	bool skip_slot = false;
-	int keep_data_slot = 0;
-
-	memset(&keep_data, 0, sizeof(payload));
+	len = tsq_pack(buf, type, uid, pl, count);
+	while (off < len) {
+		n = write(fd, buf + off, len - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("[TSQ] Error writing to socket.\n");
+		}
+		off += n;
+	}
+}
 
-	if(user_opt == NULL)
-		error("[TSQ-L] User option is NULL");
+/**
+ *  @brief Append whatever one read() returns to the reassembly buffer
+ *
+ *  @return read() result
+ */
+ssize_t tsq_rx_fill(int fd, struct tsq_rxbuf *rb)
+{
+	ssize_t n;
 
-	verbose = user_opt->verbose;
+	n = read(fd, rb->data + rb->len, sizeof(rb->data) - rb->len);
+	if (n > 0)
+		rb->len += n;
+	return n;
+}
 
-	server_ip = user_opt->server_ip;
+/**
+ *  @brief Take the next complete message out of the reassembly buffer
+ *
+ *  @return 1 with msg filled, 0 if more data is needed, -1 if out of sync
+ */
+int tsq_rx_next(struct tsq_rxbuf *rb, struct tsq_msg *msg)
+{
+	int len;
 
-	glob_fp = fopen(user_opt->output_file, "w");
-	if (glob_fp == NULL)
-		error("[TSQ-L] Error opening file: %s\n", user_opt->output_file);
+	len = tsq_unpack(rb->data, rb->len, msg);
+	if (len <= 0)
+		return len;
 
-	printf("[TSQ-L] Saving output in %s\n", user_opt->output_file);
+	rb->len -= len;
+	memmove(rb->data, rb->data + len, rb->len);
+	return 1;
+}
 
-	// Create listener socket
-	glob_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (glob_sockfd < 0)
-		error("[TSQ-L] Error opening listening socket\n");
+/**
+ *  @brief Block until one complete message arrives on a TCP socket
+ */
+void tsq_recv_blocking(int fd, struct tsq_rxbuf *rb, struct tsq_msg *msg)
+{
+	int ret;
+	ssize_t n;
 
-	// connection settings
-	memset(&serv, 0, sizeof(serv));
-	serv.sin_family = AF_INET;
-	serv.sin_addr.s_addr = inet_addr(server_ip);
-	if (user_opt->port != 0)
-		serv.sin_port = htons(user_opt->port);
-	else
-		serv.sin_port = 0;
+	while ((ret = tsq_rx_next(rb, msg)) == 0) {
+		n = tsq_rx_fill(fd, rb);
+		if (n < 0 && errno == EINTR && get_signal() == 0)
+			continue;
+		if (n <= 0)
+			error("[TSQ] Connection closed during handshake\n");
+	}
+	if (ret < 0)
+		error("[TSQ] Invalid message, stream out of sync\n");
+}
 
-	// bind the socket and start listening
-	if (bind(glob_sockfd, (struct sockaddr *)&serv, sizeof(serv)) < 0)
-		error("[TSQ-L] Error binding listening socket\n");
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
 
-	listen(glob_sockfd, 2);
+	return (x > y) - (x < y);
+}
 
-	len = sizeof(serv);
-	if (getsockname(glob_sockfd, (struct sockaddr *)&serv, &len) == -1)
-		error("[TSQ-L] getsockname() failed");
+/**
+ *  @brief Matrix label of a member: uid, or uid:channel past channel 0
+ */
+static const char *member_label(struct member *m, char *buf, size_t len)
+{
+	if (m->channel)
+		snprintf(buf, len, "%d:%d", m->uid, m->channel);
 	else
-		if (verbose)
-			printf("[TSQ-L] Started listening on %s:%d\n",
-			server_ip, ntohs(serv.sin_port));
+		snprintf(buf, len, "%d", m->uid);
+	return buf;
+}
+
+static inline int stab_slot(long long sec)
+{
+	return (int)(((sec % TSQ_STAB_HIST) + TSQ_STAB_HIST) % TSQ_STAB_HIST);
+}
 
-	// Waiting for CLIENT_COUNT connections
-	i = 0;
-	while (i < CLIENT_COUNT && get_signal() == 0) {
+/**
+ *  @brief Add one second of phase and the overlapping terms it completes
+ */
+static void stab_push(struct stability *st, long long sec, long long x)
+{
+	long long xm, x2m, lo, hi, v, s0, s1, s2, s3, d;
+	int slot = stab_slot(sec);
+	int m, k, t;
+
+	st->x[slot] = x;
+	st->sum[slot] = sec == st->seg_start ? x : st->sum[stab_slot(sec - 1)] + x;
+	st->last = sec;
+
+	for (t = 0; t < TSQ_NUM_TAUS; t++) {
+		m = tsq_taus[t];
+
+		if (sec - m < st->seg_start)
+			break;
+		lo = hi = x;
+		for (k = 1; k <= m; k++) {
+			v = st->x[stab_slot(sec - k)];
+			if (v < lo)
+				lo = v;
+			if (v > hi)
+				hi = v;
+		}
+		if (!st->mtie_valid[t] || hi - lo > st->mtie[t])
+			st->mtie[t] = hi - lo;
+		st->mtie_valid[t] = true;
 
-		connfd = accept(glob_sockfd, (struct sockaddr *)NULL, NULL);
+		if (sec - 2 * m < st->seg_start)
+			continue;
+		xm = st->x[stab_slot(sec - m)];
+		x2m = st->x[stab_slot(sec - 2 * m)];
+		d = x - 2 * xm + x2m;
+		st->avar_sum[t] += (double)d * d;
+		st->avar_n[t]++;
 
-		if (connfd < 0) {
-			printf("[TSQ-L] Error accepting connection. Waiting for the next one\n");
+		if (sec - 3 * m < st->seg_start)
 			continue;
+		s0 = st->sum[slot];
+		s1 = st->sum[stab_slot(sec - m)];
+		s2 = st->sum[stab_slot(sec - 2 * m)];
+		s3 = st->sum[stab_slot(sec - 3 * m)];
+		d = (s0 - s1) - 2 * (s1 - s2) + (s2 - s3);
+		st->tvar_sum[t] += (double)d * d;
+		st->tvar_n[t]++;
+	}
+}
+
+/**
+ *  @brief Feed the time error of one joined second
+ *
+ *  Short gaps (skipped seconds) are bridged by linear interpolation so the
+ *  long-tau terms survive occasional pulse loss; longer ones start a new
+ *  segment.
+ */
+void stab_add(struct stability *st, long long sec, long long x)
+{
+	long long gap, prev, s;
+	double delta;
+
+	st->n++;
+	delta = x - st->mean;
+	st->mean += delta / st->n;
+	st->m2 += delta * (x - st->mean);
+	if (llabs(x) > st->max_abs)
+		st->max_abs = llabs(x);
+
+	if (st->n == 1 || sec <= st->last) {
+		st->seg_start = sec;
+	} else {
+		gap = sec - st->last - 1;
+		if (gap > TSQ_STAB_MAX_GAP) {
+			st->restarts++;
+			st->seg_start = sec;
+		} else if (gap) {
+			prev = st->x[stab_slot(st->last)];
+			for (s = 1; s <= gap; s++)
+				stab_push(st, st->last + 1,
+					  prev + (x - prev) * s / (gap + 1));
+			st->bridged += gap;
 		}
+	}
+	stab_push(st, sec, x);
+}
 
-		if (verbose)
-			printf("[TSQ-L] Accept a connection. glob_sockfd[%d]:%d\n", i, connfd);
+/**
+ *  @brief Print the time error summary and the ADEV/TDEV/MTIE table
+ */
+void stab_print(struct stability *st, const char *label)
+{
+	double adev, tdev;
+	int t, m;
+
+	if (!st->n)
+		return;
+
+	printf("[TSQ-L] Time error %s over %lu rounds: mean %.1f ns, stddev %.1f ns, "
+	       "max |TE| %lld ns, %lu s bridged, %lu restarts\n",
+	       label, st->n, st->mean,
+	       st->n > 1 ? sqrt(st->m2 / (st->n - 1)) : 0.0,
+	       st->max_abs, st->bridged, st->restarts);
+	printf("[TSQ-L] %8s %12s %12s %12s\n", "tau/s", "ADEV", "TDEV/ns", "MTIE/ns");
+
+	for (t = 0; t < TSQ_NUM_TAUS && st->mtie_valid[t]; t++) {
+		m = tsq_taus[t];
+		printf("[TSQ-L] %8d", m);
+		if (st->avar_n[t]) {
+			adev = sqrt(st->avar_sum[t] / (2.0 * st->avar_n[t])) /
+			       ((double)m * NSEC_PER_SEC);
+			printf(" %12.3e", adev);
+		} else {
+			printf(" %12s", "-");
+		}
+		if (st->tvar_n[t]) {
+			tdev = sqrt(st->tvar_sum[t] /
+				    (6.0 * m * m * st->tvar_n[t]));
+			printf(" %12.2f", tdev);
+		} else {
+			printf(" %12s", "-");
+		}
+		printf(" %12lld\n", st->mtie[t]);
+	}
+}
 
-		bzero(recv_buff, BUFFER_SIZE);
-		n = read(connfd, recv_buff, sizeof(recv_buff) - 1);
+/**
+ *  @brief Print the stability of every member against the first one
+ */
+void listener_print_stability(struct listener *l)
+{
+	char a[24], b[24], label[52];
 
-		if (n < 0) {
-			//close the connection in case failed read
-			close(connfd);
-			error("[TSQ-L] ERROR reading UID from socket\n");
-		}
+	for (int i = 1; i < l->count; i++) {
+		snprintf(label, sizeof(label), "%s - %s",
+			 member_label(&l->talkers[0], a, sizeof(a)),
+			 member_label(&l->talkers[i], b, sizeof(b)));
+		stab_print(&l->stab[i], label);
+	}
+}
 
-		cli_ids[i] = atoi(recv_buff);
-		if (verbose)
-			printf("[TSQ-L] Connected with client_id:%d\n", cli_ids[i]);
-		cli_conns[i] = connfd;
-		i++;
+/**
+ *  @brief Write one aligned round and update the running pair sums
+ *
+ *  Line format:
+ *    rounds secs_error off(0,1) [off(0,2) .. off(N-2,N-1)] med(0) .. med(N-1)
+ *  where off(i,j) is talker i - talker j in ns and med(i) is talker i minus
+ *  the ensemble median. Columns 1-3 keep the 2-talker layout.
+ */
+void listener_round(struct listener *l)
+{
+	long long ts[TSQ_MAX_TALKERS], sorted[TSQ_MAX_TALKERS];
+	long long median, off;
+	int n = l->count;
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		ts[i] = sample_ns(&l->talkers[i].sample);
+
+	memcpy(sorted, ts, n * sizeof(ts[0]));
+	qsort(sorted, n, sizeof(sorted[0]), cmp_ll);
+	median = (n & 1) ? sorted[n / 2] :
+		 (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+	fprintf(glob_fp, "%lu 0", l->rounds);
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			off = ts[i] - ts[j];
+			l->pair_sum[i][j] += off;
+			fprintf(glob_fp, " %lld", off);
+		}
 	}
+	for (i = 0; i < n; i++) {
+		l->median_sum[i] += ts[i] - median;
+		fprintf(glob_fp, " %lld", ts[i] - median);
+	}
+	fputc('\n', glob_fp);
+	l->rounds++;
 
-	// clients connected. Send command to start broadcast
-	for (int i = 0; i < CLIENT_COUNT; i++) {
+	for (i = 1; i < n; i++)
+		stab_add(&l->stab[i], l->next_sec, ts[0] - ts[i]);
+	if (l->stats_interval && l->rounds % l->stats_interval == 0)
+		listener_print_stability(l);
+}
 
-		connfd = cli_conns[i];
-		bzero(recv_buff, BUFFER_SIZE);
-		snprintf(recv_buff, sizeof(recv_buff), "start\n");
-		n = write(connfd, recv_buff, sizeof(recv_buff));
-		if (n < 0)
-			error("[TSQ-L] Error writing to client socket.\n");
+/**
+ *  @brief Print the mean pairwise offset matrix and median offsets
+ */
+void listener_print_matrix(struct listener *l)
+{
+	int n = l->count;
+	char label[24];
+	int i, j;
+
+	if (!l->rounds)
+		return;
+
+	printf("[TSQ-L] Mean offset (ns) row - column over %lu rounds\n",
+	       l->rounds);
+	printf("%8s", "");
+	for (j = 0; j < n; j++)
+		printf(" %10s", member_label(&l->talkers[j], label, sizeof(label)));
+	printf(" %10s\n", "median");
+
+	for (i = 0; i < n; i++) {
+		printf("%8s", member_label(&l->talkers[i], label, sizeof(label)));
+		for (j = 0; j < n; j++) {
+			if (i < j)
+				printf(" %10.1f", (double)l->pair_sum[i][j] / l->rounds);
+			else if (i > j)
+				printf(" %10.1f", -(double)l->pair_sum[j][i] / l->rounds);
+			else
+				printf(" %10s", "-");
+		}
+		printf(" %10.1f\n", (double)l->median_sum[i] / l->rounds);
 	}
-	memset(&cli_data, 0, sizeof(cli_data));
+}
 
-	while (get_signal() == 0) {
+/**
+ *  @brief Print joined and skipped seconds and each member's losses
+ */
+void listener_print_losses(struct listener *l)
+{
+	char label[24];
+	struct member *m;
+
+	printf("[TSQ-L] %lu seconds joined, %lu skipped\n", l->rounds, l->skipped);
+	for (int i = 0; i < l->nmembers; i++) {
+		m = &l->talkers[i];
+		printf("[TSQ-L] %8s: %lu samples, %lu missing seconds, %lu late\n",
+		       member_label(m, label, sizeof(label)), m->samples,
+		       m->missing, m->late);
+	}
+}
 
-		// write to file everytime
-		fflush(glob_fp);
+/**
+ *  @brief Ring slot of a member holding PPS second sec, or NULL
+ */
+static payload *member_slot(struct member *m, long long sec)
+{
+	int slot = (int)(((sec % TSQ_RING_SECONDS) + TSQ_RING_SECONDS) %
+			 TSQ_RING_SECONDS);
 
-		FD_ZERO(&readfds);
-		max_sd = 0;
+	if (!m->valid[slot] || pps_second(&m->ring[slot]) != sec)
+		return NULL;
+	return &m->ring[slot];
+}
 
-		for (int i = 0; i < CLIENT_COUNT; i++) {
-			FD_SET(cli_conns[i], &readfds);
-			if (cli_conns[i] > max_sd)
-				max_sd = cli_conns[i];
+/**
+ *  @brief Give up on seconds [next_sec, target)
+ *
+ *  Every member without a sample for a skipped second gets it counted as
+ *  missing, samples of members that had it are dropped.
+ */
+static void listener_skip_to(struct listener *l, long long target)
+{
+	long long gap = target - l->next_sec;
+	struct member *m;
+	long long sec, have;
+	char label[24];
+	int i, k;
+
+	fprintf(glob_fp, "# missing %lld second(s) from %lld:", gap, l->next_sec);
+	for (i = 0; i < l->count; i++) {
+		m = &l->talkers[i];
+		have = 0;
+		for (k = 0; k < TSQ_RING_SECONDS; k++) {
+			sec = pps_second(&m->ring[k]);
+			if (m->valid[k] && sec >= l->next_sec && sec < target)
+				have++;
 		}
+		if (have == gap)
+			continue;
+		m->missing += gap - have;
+		fprintf(glob_fp, " %s", member_label(m, label, sizeof(label)));
+	}
+	fputc('\n', glob_fp);
 
-		/*
-		 * wait for an activity on one of the sockets , timeout is NULL,
-		 * so wait indefinitely
-		 */
-		activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
-
-		if ((activity < 0) && (errno != EINTR))
-			error("[TSQ-L] Select error\n");
-
-		for (int i = 0; i < CLIENT_COUNT; i++) {
-
-			bzero(recv_buff, BUFFER_SIZE);
-			memset(&temp_data, 0, sizeof(temp_data));
-			connfd = cli_conns[i];
-
-			if (FD_ISSET(connfd, &readfds)) {
-				if (get_signal() != 0)
-					error("[TSQ-L] client socket closed. TSQ will end now.\n");
-
-				n = read(connfd, recv_buff, sizeof(recv_buff) - 1);
-
-				if (n < 0)
-					error("[TSQ-L] ERROR reading socket. Exiting.\n");
-				/*
-				 * If the slot is marked for keeping for sample alignment
-				 * we will recopy the previous value and not use the one read from the socket.
-				 */
-				if ((skip_slot == true) && (keep_data_slot == i)) {
-					memcpy(&cli_data[i], &keep_data, sizeof(payload));
-					pl_valid_flag[i] = true;
-
-					/*
-					 * if (verbose)
-					 *	printf("[TSQ-L] KEEP SLOT data from %d : Secs : %lld, Nsecs : %ld , seq : %d\n",
-					 *	cli_data[i].uid, cli_data[i].secs, cli_data[i].nsecs , cli_data[i].seq);
-					 */
-
-				} else {
-					if (n > 0) {  // copy the new value
-						memcpy(&temp_data, recv_buff, sizeof(payload));
-						if (validate_payload (&temp_data, cli_ids, CLIENT_COUNT)) {
-							pl_valid_flag[i] = true;
-							memcpy(&cli_data[i], &temp_data, sizeof(payload));
-							/*if (verbose)
-								printf("[TSQ-L] Msg from %d : Secs : %lld, Nsecs : %ld , seq : %d\n",
-								cli_data[i].uid, cli_data[i].secs, cli_data[i].nsecs, cli_data[i].seq); */
-						}
-					}
-				}
+	l->skipped += gap;
+	l->next_sec = target;
+}
+
+/**
+ *  @brief Join every second all members have reported, skip those that
+ *  can no longer complete
+ *
+ *  Talkers report seconds in order, so once every member is past
+ *  next_sec the members lacking it lost that pulse. A member that went
+ *  silent (lost link, reconnecting) holds joins back for at most
+ *  TSQ_RING_SECONDS, after which the others' seconds are skipped.
+ */
+static void listener_advance(struct listener *l, int verbose)
+{
+	long long min_newest, max_newest;
+	payload *pl;
+	bool complete;
+	int i;
+
+	for (;;) {
+		complete = true;
+		min_newest = LLONG_MAX;
+		max_newest = LLONG_MIN;
+		for (i = 0; i < l->count; i++) {
+			struct member *m = &l->talkers[i];
+
+			if (!m->started) {
+				min_newest = LLONG_MIN;
+				complete = false;
+				continue;
 			}
+			if (m->newest < min_newest)
+				min_newest = m->newest;
+			if (m->newest > max_newest)
+				max_newest = m->newest;
+
+			pl = member_slot(m, l->next_sec);
+			if (!pl)
+				complete = false;
+			else
+				m->sample = *pl;
 		}
 
-		if (data_ready(pl_valid_flag, CLIENT_COUNT)) {
-			secs_error = cli_data[0].secs - cli_data[1].secs;
-			nsecs_error = cli_data[0].nsecs - cli_data[1].nsecs;
-
+		if (complete) {
 			if (verbose)
-				printf("[TSQ-L] Msg from %d, %d: Secs off: %lld, Nsecs off: %ld\n",
-				cli_data[0].uid, cli_data[1].uid, secs_error, nsecs_error);
-			/*
-			 * 1. When secs_error is equals to 1, t0 sample is 'newer' compared to t1.
-			 * This means the t0 sample is not align to t1 sample, we shd keep t0, discard current t1, and reread t1.
-			 * 2. When secs_error is equals to -1, t1 sample is now 'newer' compare to t0.
-			 * The t1 sample is not align to t0 sample, we shd keep t1, discard current t0, and reread t0.
-			 * 3. When secs_error is 0 , the samples are aligned. The nsecs is then valid.
-			 * 4. When secs_error are not ( 0 | 1 |-1) , the samples are misaligned , and we wait for alignment in future samples.
-			 * In this case, we discard nsecs_errors.
-			 */
+				printf("[TSQ-L] Round %lu aligned at second %lld, %d-%d off: %lld ns\n",
+				       l->rounds, l->next_sec,
+				       l->talkers[0].uid, l->talkers[1].uid,
+				       sample_ns(&l->talkers[0].sample) -
+				       sample_ns(&l->talkers[1].sample));
+			listener_round(l);
+			l->next_sec++;
+		} else if (max_newest != LLONG_MIN &&
+			   max_newest - l->next_sec >= TSQ_RING_SECONDS) {
+			listener_skip_to(l, max_newest - TSQ_RING_SECONDS + 1);
+		} else if (min_newest != LLONG_MIN && min_newest > l->next_sec) {
+			listener_skip_to(l, l->next_sec + 1);
+		} else {
+			break;
+		}
+	}
+}
 
-			switch (secs_error) {
+/**
+ *  @brief Store a member's sample in its ring and join what is complete
+ */
+void listener_sample(struct listener *l, int idx, payload *pl, int verbose)
+{
+	struct member *m = &l->talkers[idx];
+	long long sec = pps_second(pl);
+	int slot = (int)(((sec % TSQ_RING_SECONDS) + TSQ_RING_SECONDS) %
+			 TSQ_RING_SECONDS);
+
+	m->samples++;
+	if (!l->started) {
+		l->next_sec = sec;
+		l->started = true;
+	}
+	if (sec < l->next_sec) {
+		m->late++;
+		return;
+	}
 
-			case 1:
-				skip_slot = true;
-				keep_data_slot = 0;
-				memcpy(&keep_data, &cli_data[0], sizeof(payload));
-				break;
+	if (!m->started || sec > m->newest)
+		m->newest = sec;
+	m->started = true;
 
-			case -1:
-				skip_slot = true;
-				keep_data_slot = 1;
-				memcpy(&keep_data, &cli_data[1], sizeof(payload));
-				break;
+	/* Make room first, the slot may still hold an unjoined second */
+	listener_advance(l, verbose);
 
-			case 0:
-				skip_slot = false;
-				memset(&keep_data, 0, sizeof(payload));
-				fprintf(glob_fp, "%d %lld %ld\n", rounds, secs_error, nsecs_error);
-				rounds++;
-				break;
+	m->ring[slot] = *pl;
+	m->valid[slot] = true;
+	listener_advance(l, verbose);
+}
 
-			default:
-				skip_slot = false;
-				memset(&keep_data, 0, sizeof(payload));
-				printf("[TSQ-L] Waiting for samples alignment...\n");
-				break;
-			}
+/**
+ *  @brief Index of a registered member
+ *
+ *  @return index or -1 if uid/channel is unknown
+ */
+int listener_find(struct listener *l, int uid, int channel)
+{
+	for (int i = 0; i < l->nmembers; i++)
+		if (l->talkers[i].uid == uid && l->talkers[i].channel == channel)
+			return i;
+	return -1;
+}
 
-			reset_data_ready(pl_valid_flag, CLIENT_COUNT);
-			memset(&cli_data, 0, sizeof(cli_data));
+/**
+ *  @brief Index of a talker connection
+ *
+ *  @return index or -1 if uid is unknown
+ */
+int listener_conn(struct listener *l, int uid)
+{
+	for (int i = 0; i < l->nconns; i++)
+		if (l->conns[i].uid == uid)
+			return i;
+	return -1;
+}
+
+/**
+ *  @brief Add the channels announced in a HELLO as members
+ *
+ *  A HELLO without records stands for channel 0. Members past -n are
+ *  ignored.
+ */
+void listener_join(struct listener *l, struct tsq_msg *msg, int verbose)
+{
+	int count = msg->count ? msg->count : 1;
+	int channel;
 
+	for (int k = 0; k < count; k++) {
+		channel = msg->count ? msg->samples[k].channel : 0;
+		if (listener_find(l, msg->uid, channel) >= 0)
+			continue;
+		if (l->nmembers >= l->count) {
+			printf("[TSQ-L] Ignoring client_id:%d channel %d, already have %d\n",
+			       msg->uid, channel, l->count);
+			continue;
 		}
+		l->talkers[l->nmembers].uid = msg->uid;
+		l->talkers[l->nmembers].channel = channel;
+		l->nmembers++;
+		if (verbose)
+			printf("[TSQ-L] Comparing client_id:%d channel %d\n",
+			       msg->uid, channel);
 	}
-
-	close(glob_sockfd);
-	fclose(glob_fp);
 }
 
-void talker(struct opt *user_opt){
-	char *server_ip;
-	int verbose;
-	int uid;
-	int port;
-	struct sockaddr_in serv;
-	char send_buff[BUFFER_SIZE];
-	int n;
-	payload data;
-	int seq = 0;
-	char *device;
-	int timeout_ms;
-	struct pollfd pfd;
-	struct ptp_extts_event e;
-	int ready;
-	int ret;
+/**
+ *  @brief Feed every sample of a SAMPLES or STATS message into the
+ *  alignment
+ */
+void listener_message(struct listener *l, struct tsq_msg *msg, int verbose)
+{
+	payload *pl;
+	int idx;
+
+	for (int k = 0; k < msg->count; k++) {
+		pl = &msg->samples[k];
+
+		/* An unset timestamp is not a sample; nsecs 0 is an edge
+		 * exactly on the second
+		 */
+		if (pl->secs == 0)
+			continue;
+
+		idx = listener_find(l, msg->uid, pl->channel);
+		if (idx < 0)
+			continue;
+
+		if (verbose && msg->type == TSQ_MSG_STATS)
+			printf("[TSQ-L] %d:%d second %lld: %d edges, min %ld max %ld jitter %ld ns\n",
+			       pl->uid, pl->channel, pps_second(pl), pl->count,
+			       pl->min, pl->max, pl->jitter);
+
+		listener_sample(l, idx, pl, verbose);
+	}
+}
+
+/**
+ *  @brief TCP: accept one talker and read its HELLO
+ *
+ *  A talker reconnecting with a known uid takes over its old connection
+ *  and keeps its members, so its samples join the rings again.
+ *
+ *  @return connection index, -1 if nothing was accepted
+ */
+int listener_accept(struct listener *l, int efd, int verbose)
+{
+	struct epoll_event ev;
+	struct tsq_msg msg;
+	struct tsq_rxbuf rx = { .len = 0 };
+	struct talker_conn *t;
+	int connfd;
+	int i;
+
+	connfd = accept(glob_sockfd, (struct sockaddr *)NULL, NULL);
+
+	if (connfd < 0) {
+		printf("[TSQ-L] Error accepting connection. Waiting for the next one\n");
+		return -1;
+	}
+
+	if (verbose)
+		printf("[TSQ-L] Accept a connection. fd:%d\n", connfd);
+
+	tsq_recv_blocking(connfd, &rx, &msg);
+	if (msg.type != TSQ_MSG_HELLO) {
+		close(connfd);
+		error("[TSQ-L] ERROR expected HELLO from talker\n");
+	}
+
+	i = listener_conn(l, msg.uid);
+	if (i < 0) {
+		if (l->nconns >= TSQ_MAX_TALKERS) {
+			printf("[TSQ-L] Too many talkers, rejecting client_id:%d\n", msg.uid);
+			close(connfd);
+			return -1;
+		}
+		i = l->nconns++;
+	} else if (l->conns[i].fd >= 0) {
+		epoll_ctl(efd, EPOLL_CTL_DEL, l->conns[i].fd, NULL);
+		close(l->conns[i].fd);
+	}
+
+	if (verbose)
+		printf("[TSQ-L] Connected with client_id:%d\n", msg.uid);
+	t = &l->conns[i];
+	t->fd = connfd;
+	t->uid = msg.uid;
+	t->rx = rx;
+	listener_join(l, &msg, verbose);
+
+	ev.events = EPOLLIN;
+	ev.data.u32 = i;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+		error("[TSQ-L] epoll_ctl() failed\n");
+	return i;
+}
+
+/**
+ *  @brief TCP: accept talkers until every member is known, then START
+ *  them all
+ */
+void listener_register_tcp(struct listener *l, int efd, int verbose)
+{
+	while (l->nmembers < l->count && get_signal() == 0)
+		listener_accept(l, efd, verbose);
+
+	// clients connected. Send command to start broadcast
+	for (int i = 0; i < l->nconns; i++)
+		tsq_send(l->conns[i].fd, TSQ_MSG_START, 0, NULL, 0);
+}
+
+/**
+ *  @brief UDP: collect one HELLO per talker, then START them all. Talkers
+ *  resend HELLO until they see START, see listener_udp().
+ */
+void listener_register_udp(struct listener *l, int verbose)
+{
+	uint8_t buf[TSQ_MAX_MSG];
+	struct sockaddr_in addr;
+	struct tsq_msg msg;
+	socklen_t alen;
+	ssize_t n;
+	int idx;
+
+	while (l->nmembers < l->count && get_signal() == 0) {
+		alen = sizeof(addr);
+		n = recvfrom(glob_sockfd, buf, sizeof(buf), 0,
+			     (struct sockaddr *)&addr, &alen);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			error("[TSQ-L] ERROR reading UDP socket\n");
+		}
+
+		if (tsq_unpack(buf, n, &msg) != n || msg.type != TSQ_MSG_HELLO)
+			continue;
+
+		idx = listener_conn(l, msg.uid);
+		if (idx < 0) {
+			if (l->nconns >= TSQ_MAX_TALKERS)
+				continue;
+			idx = l->nconns++;
+			l->conns[idx].uid = msg.uid;
+			if (verbose)
+				printf("[TSQ-L] Registered client_id:%d from %s:%d\n",
+				       msg.uid, inet_ntoa(addr.sin_addr),
+				       ntohs(addr.sin_port));
+		}
+		l->conns[idx].addr = addr;
+		l->conns[idx].fd = glob_sockfd;
+		listener_join(l, &msg, verbose);
+	}
+
+	for (int i = 0; i < l->nconns; i++) {
+		tsq_pack(buf, TSQ_MSG_START, 0, NULL, 0);
+		sendto(glob_sockfd, buf, sizeof(struct tsq_hdr), 0,
+		       (struct sockaddr *)&l->conns[i].addr,
+		       sizeof(l->conns[i].addr));
+	}
+}
+
+/**
+ *  @brief UDP: handle one datagram, one message per datagram
+ */
+void listener_udp(struct listener *l, int verbose)
+{
+	uint8_t buf[TSQ_MAX_MSG];
+	struct sockaddr_in addr;
+	struct tsq_msg msg;
+	socklen_t alen = sizeof(addr);
+	ssize_t n;
+	int idx;
+
+	n = recvfrom(glob_sockfd, buf, sizeof(buf), 0,
+		     (struct sockaddr *)&addr, &alen);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		error("[TSQ-L] ERROR reading UDP socket\n");
+	}
+
+	if (tsq_unpack(buf, n, &msg) != n) {
+		if (verbose)
+			printf("[TSQ-L] Dropping malformed %zd byte datagram\n", n);
+		return;
+	}
+
+	idx = listener_conn(l, msg.uid);
+	if (idx < 0)
+		return;
+
+	/* Talker missed START, or restarted and is registering again */
+	if (msg.type == TSQ_MSG_HELLO) {
+		l->conns[idx].addr = addr;
+		tsq_pack(buf, TSQ_MSG_START, 0, NULL, 0);
+		sendto(glob_sockfd, buf, sizeof(struct tsq_hdr), 0,
+		       (struct sockaddr *)&addr, alen);
+		return;
+	}
+
+	if (msg.type == TSQ_MSG_SAMPLES || msg.type == TSQ_MSG_STATS)
+		listener_message(l, &msg, verbose);
+}
+
+/**
+ *  @brief TCP: read what is available and handle every complete message
+ *
+ *  @return false once the talker closed or the stream is out of sync
+ */
+bool listener_tcp(struct listener *l, int idx, int verbose)
+{
+	struct talker_conn *t = &l->conns[idx];
+	struct tsq_msg msg;
+	ssize_t n;
+	int ret;
+
+	n = tsq_rx_fill(t->fd, &t->rx);
+	if (n < 0) {
+		if (errno == EINTR)
+			return true;
+		error("[TSQ-L] ERROR reading socket. Exiting.\n");
+	}
+	if (n == 0) {
+		printf("[TSQ-L] client %d socket closed, waiting for it to reconnect.\n",
+		       t->uid);
+		return false;
+	}
+
+	while ((ret = tsq_rx_next(&t->rx, &msg)) > 0) {
+		if ((msg.type == TSQ_MSG_SAMPLES || msg.type == TSQ_MSG_STATS) &&
+		    msg.uid == t->uid)
+			listener_message(l, &msg, verbose);
+	}
+
+	if (ret < 0) {
+		printf("[TSQ-L] client %d stream out of sync, dropping connection.\n",
+		       t->uid);
+		return false;
+	}
+	return true;
+}
+
+/**
+ *  @brief Allocate the alignment state for count members and open the
+ *  output file
+ */
+struct listener *listener_alloc(struct opt *user_opt, int count)
+{
+	struct listener *l;
+
+	l = calloc(1, sizeof(*l));
+	if (!l)
+		error("[TSQ-L] Out of memory\n");
+	l->count = count;
+	l->stats_interval = user_opt->stats_interval;
+
+	glob_fp = fopen(user_opt->output_file, "w");
+	if (glob_fp == NULL)
+		error("[TSQ-L] Error opening file: %s\n", user_opt->output_file);
+
+	printf("[TSQ-L] Saving output in %s\n", user_opt->output_file);
+	return l;
+}
+
+/* Listener - wait for N talkers to connect and receive. Align their
+ * timestamps per PPS second and write the pairwise deltas. TCP talkers
+ * may drop and reconnect; the listener ends once none is connected.
+ */
+void listener(struct opt *user_opt) {
+
+	char *server_ip;
+	struct sockaddr_in serv;
+	struct epoll_event ev, events[TSQ_MAX_TALKERS + 1];
+	struct listener *l;
+	socklen_t len;
+	bool closed = false;
+	int nfds;
+	int i = 0;
+	int open_conns;
+	int verbose;
+	int efd;
+
+	if(user_opt == NULL)
+		error("[TSQ-L] User option is NULL");
+
+	verbose = user_opt->verbose;
+
+	server_ip = user_opt->server_ip;
+
+	l = listener_alloc(user_opt, user_opt->talkers);
+
+	// Create listener socket
+	glob_sockfd = socket(AF_INET, user_opt->udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (glob_sockfd < 0)
+		error("[TSQ-L] Error opening listening socket\n");
+
+	// connection settings
+	memset(&serv, 0, sizeof(serv));
+	serv.sin_family = AF_INET;
+	serv.sin_addr.s_addr = inet_addr(server_ip);
+	if (user_opt->port != 0)
+		serv.sin_port = htons(user_opt->port);
+	else
+		serv.sin_port = 0;
+
+	// bind the socket and start listening
+	if (bind(glob_sockfd, (struct sockaddr *)&serv, sizeof(serv)) < 0)
+		error("[TSQ-L] Error binding listening socket\n");
+
+	if (!user_opt->udp)
+		listen(glob_sockfd, l->count);
+
+	len = sizeof(serv);
+	if (getsockname(glob_sockfd, (struct sockaddr *)&serv, &len) == -1)
+		error("[TSQ-L] getsockname() failed");
+	else
+		if (verbose)
+			printf("[TSQ-L] Started listening on %s:%d (%s) for %d talkers\n",
+			server_ip, ntohs(serv.sin_port),
+			user_opt->udp ? "udp" : "tcp", l->count);
+
+	efd = epoll_create1(0);
+	if (efd < 0)
+		error("[TSQ-L] epoll_create1() failed\n");
+
+	if (user_opt->udp) {
+		listener_register_udp(l, verbose);
+		ev.events = EPOLLIN;
+		ev.data.u32 = 0;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, glob_sockfd, &ev) < 0)
+			error("[TSQ-L] epoll_ctl() failed\n");
+	} else {
+		listener_register_tcp(l, efd, verbose);
+		ev.events = EPOLLIN;
+		ev.data.u32 = TSQ_LISTEN_EVENT;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, glob_sockfd, &ev) < 0)
+			error("[TSQ-L] epoll_ctl() failed\n");
+	}
+
+	while (get_signal() == 0 && !closed) {
+
+		// write to file everytime
+		fflush(glob_fp);
+
+		nfds = epoll_wait(efd, events, TSQ_MAX_TALKERS + 1, -1);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			error("[TSQ-L] epoll_wait error\n");
+		}
+
+		for (int e = 0; e < nfds && get_signal() == 0; e++) {
+			i = events[e].data.u32;
+			if (user_opt->udp) {
+				listener_udp(l, verbose);
+			} else if (i == TSQ_LISTEN_EVENT) {
+				i = listener_accept(l, efd, verbose);
+				if (i >= 0)
+					tsq_send(l->conns[i].fd, TSQ_MSG_START, 0, NULL, 0);
+			} else if (!listener_tcp(l, i, verbose)) {
+				epoll_ctl(efd, EPOLL_CTL_DEL, l->conns[i].fd, NULL);
+				close(l->conns[i].fd);
+				l->conns[i].fd = -1;
+
+				open_conns = 0;
+				for (int c = 0; c < l->nconns; c++)
+					open_conns += l->conns[c].fd >= 0;
+				if (!open_conns) {
+					closed = true;
+					break;
+				}
+			}
+		}
+	}
+
+	listener_print_matrix(l);
+	listener_print_stability(l);
+	listener_print_losses(l);
+
+	if (!user_opt->udp)
+		for (i = 0; i < l->nconns; i++)
+			if (l->conns[i].fd >= 0)
+				close(l->conns[i].fd);
+	close(efd);
+	close(glob_sockfd);
+	fclose(glob_fp);
+	free(l);
+}
+
+/**
+ *  @brief Register with the listener and wait for START
+ *
+ *  @param hello	one zero-timestamp record per reported channel
+ */
+void talker_handshake(int uid, payload *hello, int count, int udp, int verbose)
+{
+	struct tsq_rxbuf rb = { .len = 0 };
+	uint8_t buf[TSQ_MAX_MSG];
+	struct pollfd pfd;
+	struct tsq_msg msg;
+	ssize_t n;
+
+	tsq_send(glob_sockfd, TSQ_MSG_HELLO, uid, hello, count);
+	if (verbose)
+		printf("[TSQ-T] Sent HELLO %d to tsq-listener\n", uid);
+
+	if (!udp) {
+		tsq_recv_blocking(glob_sockfd, &rb, &msg);
+		if (msg.type != TSQ_MSG_START)
+			error("[TSQ-T] Connection aborted\n");
+		return;
+	}
+
+	pfd.fd = glob_sockfd;
+	pfd.events = POLLIN;
+	while (get_signal() == 0) {
+		if (poll(&pfd, 1, TSQ_HELLO_RETRY_MS) <= 0) {
+			tsq_send(glob_sockfd, TSQ_MSG_HELLO, uid, hello, count);
+			continue;
+		}
+		n = recv(glob_sockfd, buf, sizeof(buf), 0);
+		if (n > 0 && tsq_unpack(buf, n, &msg) == n &&
+		    msg.type == TSQ_MSG_START)
+			return;
+	}
+	error("[TSQ-T] Connection aborted\n");
+}
+
+/**
+ *  @brief Enable or disable EXTTS on a channel of the talker's PHC
+ */
+void talker_extts(struct phc_source *src, int channel, bool enable)
+{
+	if (phc_source_extts_enable(src, channel, enable))
+		error("[TSQ-T] PTP_EXTTS_REQUEST on channel %d failed: %s\n",
+		      channel, strerror(errno));
+}
+
+/**
+ *  @brief Start or stop a periodic output of rate Hz on the source PHC
+ *
+ *  The first edge is placed on a whole second 2s ahead, so every pulse
+ *  keeps a fixed phase within the PPS second.
+ */
+void talker_perout(int fd, int index, long rate, bool enable)
+{
+	struct ptp_perout_request req;
+	struct timespec now;
+
+	memset(&req, 0, sizeof(req));
+	req.index = index;
+	if (enable) {
+		if (clock_gettime(FD_TO_CLOCKID(fd), &now))
+			error("[TSQ-T] Failed to read the source PHC\n");
+		req.start.sec = now.tv_sec + 2;
+		req.period.sec = (NSEC_PER_SEC / rate) / NSEC_PER_SEC;
+		req.period.nsec = (NSEC_PER_SEC / rate) % NSEC_PER_SEC;
+	}
+	if (ioctl(fd, PTP_PEROUT_REQUEST, &req))
+		error("[TSQ-T] PTP_PEROUT_REQUEST on channel %d failed: %s\n",
+		      index, strerror(errno));
+}
+
+/* One second of edges on one EXTTS channel, or of PHC offset reads
+ * (-r above 1)
+ */
+struct extts_acc {
+	long long second;	//0 until the first edge
+	long count;
+	long long base;		//First phase of the second
+	long long sum;		//Phases in ns relative to base
+	double sumsq;
+	long long min;		//Phases in ns relative to second
+	long long max;
+};
+
+static long clamp_i32(long long v)
+{
+	return v < INT32_MIN ? INT32_MIN : v > INT32_MAX ? INT32_MAX : v;
+}
+
+/**
+ *  @brief Turn a finished second into a STATS sample
+ */
+static void extts_acc_flush(struct extts_acc *acc, int uid, int channel,
+			    int seq, payload *out)
+{
+	double dmean = (double)acc->sum / acc->count;
+	double var = acc->sumsq / acc->count - dmean * dmean;
+	long long mean = acc->base + llround(dmean);
+	long long t = acc->second * NSEC_PER_SEC + mean;
+	long long rel;
+
+	memset(out, 0, sizeof(*out));
+	out->uid = uid;
+	out->seq = seq;
+	out->channel = channel;
+	out->secs = t / NSEC_PER_SEC;
+	out->nsecs = t % NSEC_PER_SEC;
+	out->count = acc->count;
+	out->jitter = var > 0 ? lround(sqrt(var)) : 0;
+
+	/* min and max against the same second as the mean on the wire, so a
+	 * PHC offset of seconds (sysoff) still fits the 32-bit fields
+	 */
+	rel = (acc->second - pps_second(out)) * NSEC_PER_SEC;
+	out->min = clamp_i32(acc->min + rel);
+	out->max = clamp_i32(acc->max + rel);
+}
+
+/**
+ *  @brief Add one phase to its second
+ *
+ *  @return true with out filled when the phase starts a new second
+ */
+static bool acc_add(struct extts_acc *acc, long long second, long long phase,
+		    int uid, int channel, int seq, payload *out)
+{
+	bool done = false;
+
+	if (acc->count && second != acc->second) {
+		extts_acc_flush(acc, uid, channel, seq, out);
+		done = true;
+	}
+	if (!acc->count || done) {
+		memset(acc, 0, sizeof(*acc));
+		acc->second = second;
+		acc->base = phase;
+		acc->min = phase;
+		acc->max = phase;
+	}
+
+	/* Relative to the first phase, so a large offset keeps its precision */
+	acc->count++;
+	acc->sum += phase - acc->base;
+	acc->sumsq += (double)(phase - acc->base) * (phase - acc->base);
+	if (phase < acc->min)
+		acc->min = phase;
+	if (phase > acc->max)
+		acc->max = phase;
+	return done;
+}
+
+/**
+ *  @brief Add one edge to its channel's second
+ *
+ *  The phase is the offset from the nearest nominal edge (k * period), so
+ *  every edge of the train measures the same clock offset.
+ *
+ *  @return true with out filled when the edge starts a new second
+ */
+static bool extts_acc_add(struct extts_acc *acc, struct ptp_extts_event *e,
+			  long period, int uid, int seq, payload *out)
+{
+	long long t = e->t.sec * NSEC_PER_SEC + e->t.nsec;
+	long long phase = t % period;
+
+	if (phase >= period / 2)
+		phase -= period;
+	return acc_add(acc, (t - phase) / NSEC_PER_SEC, phase, uid, e->index,
+		       seq, out);
+}
+
+/**
+ *  @brief Turn an EXTTS event into a sample: the raw edge at 1 Hz, the
+ *  statistics of the previous second above
+ *
+ *  @return true with out filled when there is a sample to send
+ */
+static bool extts_sample(struct extts_acc *acc, struct ptp_extts_event *e,
+			 long rate, int uid, int seq, payload *out)
+{
+	if (rate > 1)
+		return extts_acc_add(acc, e, NSEC_PER_SEC / rate, uid, seq, out);
+
+	memset(out, 0, sizeof(*out));
+	out->uid = uid;
+	out->seq = seq;
+	out->channel = e->index;
+	out->secs = e->t.sec;
+	out->nsecs = e->t.nsec;
+	return true;
+}
+
+/**
+ *  @brief Turn a PHC offset read into a sample: the PHC time at the TAI
+ *  second, so PHCs compare like EXTTS edges of a common PPS
+ *
+ *  Like an EXTTS edge, only the offset within +-0.5 s is kept, so a PHC
+ *  whole seconds off (e.g. still on UTC) stays aligned with the others.
+ *
+ *  @return true with out filled when there is a sample to send
+ */
+static bool sysoff_sample(struct extts_acc *acc, long long offset,
+			  long long tai, long rate, int uid, int seq,
+			  payload *out)
+{
+	long long second = (tai + NSEC_PER_SEC / 2) / NSEC_PER_SEC;
+	long long phase = offset % NSEC_PER_SEC;
+	static bool warned;
+	long long t;
+
+	if (phase >= NSEC_PER_SEC / 2)
+		phase -= NSEC_PER_SEC;
+	else if (phase < -NSEC_PER_SEC / 2)
+		phase += NSEC_PER_SEC;
+	if (phase != offset && !warned) {
+		printf("[TSQ] %d: PHC is %lld ns off CLOCK_TAI, comparing the %lld ns within the second only\n",
+		       uid, offset, phase);
+		warned = true;
+	}
+
+	if (rate > 1)
+		return acc_add(acc, tai / NSEC_PER_SEC, phase, uid, 0, seq, out);
+
+	t = second * NSEC_PER_SEC + phase;
+	memset(out, 0, sizeof(*out));
+	out->uid = uid;
+	out->seq = seq;
+	out->secs = t / NSEC_PER_SEC;
+	out->nsecs = t % NSEC_PER_SEC;
+	return true;
+}
+
+/**
+ *  @brief Read the next PHC offset, saying once when the driver made the
+ *  source fall back to another read method
+ */
+static int sysoff_read(struct phc_source *src, int uid, int *method,
+		       long long *offset, long long *tai, long long *delay)
+{
+	static const char *const names[] = {
+		[PHC_SYSOFF_EXTENDED] = "PTP_SYS_OFFSET_EXTENDED",
+		[PHC_SYSOFF_PRECISE] = "PTP_SYS_OFFSET_PRECISE",
+		[PHC_SYSOFF_BASIC] = "PTP_SYS_OFFSET",
+	};
+
+	if (phc_source_sys_offset(src, offset, tai, delay))
+		return -1;
+	if (src->method != *method) {
+		printf("[TSQ] %d: no %s in the driver, using %s\n",
+		       uid, names[*method], names[src->method]);
+		*method = src->method;
+	}
+	return 0;
+}
+
+/**
+ *  @brief Queue a sample, sending the batch once it holds -b samples
+ */
+static void talker_queue(struct opt *user_opt, payload *batch, int *queued,
+			 payload *data, int msg_type, int uid)
+{
+	batch[(*queued)++] = *data;
+	if (*queued >= user_opt->batch) {
+		tsq_send(glob_sockfd, msg_type, uid, batch, *queued);
+		*queued = 0;
+	}
+}
+
+/**
+ *  @brief Open a talker or local mode device with the sysoff options applied
+ */
+static struct phc_source *tsq_source_open(struct opt *user_opt,
+					  const char *device)
+{
+	struct phc_source *src;
+
+	src = phc_source_open(device, NSEC_PER_SEC / user_opt->rate);
+	if (!src)
+		return NULL;
+	src->method = user_opt->sysoff_method;
+	src->samples = user_opt->burst;
+	return src;
+}
+
+/**
+ *  @brief Name of the sample source, for verbose output
+ */
+static const char *tsq_source_name(struct opt *user_opt)
+{
+	if (user_opt->source == SOURCE_EXTTS)
+		return "extts";
+	return user_opt->sysoff_method == PHC_SYSOFF_PRECISE ? "precise" : "sysoff";
+}
+
+void talker(struct opt *user_opt){
+	char *server_ip;
+	int verbose;
+	int uid;
+	int port;
+	struct sockaddr_in serv;
+	struct phc_source *src;
+	int n;
+	payload data;
+	payload batch[TSQ_MAX_BATCH];
+	payload hello[TSQ_MAX_CHANNELS];
+	struct extts_acc acc[TSQ_MAX_CHANNELS];
+	int queued = 0;
+	int seq = 0;
+	char *device;
+	int timeout_ms;
+	struct ptp_extts_event ev[TSQ_EVENTS_PER_READ], *e;
+	int msg_type;
+	int perout_fd = -1;
+	long long offset, tai, delay;
+	int method;
+	int ch, i;
 
 	if(user_opt == NULL)
 		error("[TSQ-T] User option is NULL");
@@ -534,18 +1896,29 @@ void talker(struct opt *user_opt){
 	device = user_opt->device;
 	verbose = user_opt->verbose;
 	uid = user_opt->uid;
+	msg_type = user_opt->rate > 1 ? TSQ_MSG_STATS : TSQ_MSG_SAMPLES;
+	method = user_opt->sysoff_method;
 	glob_sockfd = 0;
 
 	if (verbose)
 		printf("[TSQ-T] Assigned uid %d\n", uid);
 
+	/* sysoff reads have no channel: one member, channel 0 */
+	if (user_opt->source == SOURCE_SYSOFF)
+		user_opt->nchannels = 1;
+
+	memset(hello, 0, sizeof(hello));
+	memset(acc, 0, sizeof(acc));
+	for (i = 0; i < user_opt->nchannels && user_opt->source == SOURCE_EXTTS; i++)
+		hello[i].channel = user_opt->channels[i];
+
 	/* Set up the socket for transmission */
 	memset(&serv, 0, sizeof(serv));
 	serv.sin_family = AF_INET;
 	serv.sin_addr.s_addr = inet_addr(server_ip);
 	serv.sin_port = htons(port);
 
-	glob_sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	glob_sockfd = socket(AF_INET, user_opt->udp ? SOCK_DGRAM : SOCK_STREAM, 0);
 	if (glob_sockfd < 0)
 		error("[TSQ-T] Could not create socket\n");
 
@@ -555,89 +1928,337 @@ void talker(struct opt *user_opt){
 	if (verbose)
 		printf("[TSQ-T] Connection established with %s\n", server_ip);
 
-	bzero(send_buff, BUFFER_SIZE);
-
-	// send uid
-	snprintf(send_buff, sizeof(send_buff), "%d\n", uid);
-	ret = write(glob_sockfd, send_buff, sizeof(send_buff));
-	if (ret < 0)
-		error("[TSQ-T] ERROR writing UID to socket\n");
-
-	if (verbose)
-		printf("[TSQ-T] Sent %s to tsq-listener\n", send_buff);
-
-	bzero(send_buff, BUFFER_SIZE);
-	n = read(glob_sockfd, send_buff, sizeof(send_buff) - 1);
-
-	if (n < 0)
-		error("[TSQ-T] ERROR reading command from socket\n");
-
-	if (strcmp(send_buff, "start\n") != 0)
-		error("[TSQ-T] Connection aborted\n");
+	talker_handshake(uid, hello, user_opt->nchannels, user_opt->udp, verbose);
 
 	if (verbose)
 		printf("[TSQ-T] Reading from %s\n", device);
 
-	glob_ptpfd = open(device, O_RDWR);
-	if (glob_ptpfd < 0) 
+	src = tsq_source_open(user_opt, device);
+	if (!src)
 		error("[TSQ-T] ERROR to open ptp device %s\n", device);
+	glob_ptpfd = src->fd;
 	if (verbose)
-		printf("[TSQ-T] PTP device : %s is now opened\n", device);
-
-	pfd.fd = glob_ptpfd;
-	pfd.events = PTP_PF_EXTTS;
-	pfd.revents = 0;
+		printf("[TSQ-T] PTP device : %s is now opened (%s, %s)\n", device,
+		       src->ops->name, tsq_source_name(user_opt));
+
+	if (user_opt->enable_channels && user_opt->source == SOURCE_EXTTS)
+		for (i = 0; i < user_opt->nchannels; i++)
+			talker_extts(src, user_opt->channels[i], true);
+
+	if (user_opt->perout_device) {
+		perout_fd = open(user_opt->perout_device, O_RDWR);
+		if (perout_fd < 0)
+			error("[TSQ-T] ERROR to open ptp device %s\n",
+			      user_opt->perout_device);
+		talker_perout(perout_fd, user_opt->perout_index,
+			      user_opt->rate, true);
+		if (verbose)
+			printf("[TSQ-T] PEROUT %ld at %ld Hz on %s\n",
+			       user_opt->perout_index, user_opt->rate,
+			       user_opt->perout_device);
+	}
 
 	timeout_ms = user_opt-> timeout;
 	if (verbose)
 		printf("[TSQ-T] Setting timeout to %dms\n", timeout_ms);
 
-	while (get_signal() == 0) {
-		ready = poll(&pfd, 1, timeout_ms);
-		if (ready < 0)
-			error("[TSQ-T] Failed to poll\n");
-		e.t.sec = 0;
-		e.t.nsec = 0;
-
-		while (ready-- > 0) {
-			n = read(glob_ptpfd, &e, sizeof(e));
-			if (n != sizeof(e)) {
-				error("[TSQ-T] read returns %lu bytes, expecting %lu bytes\n",
-					n, sizeof(e));
-			}
+	while (get_signal() == 0 && user_opt->source == SOURCE_SYSOFF) {
+		if (sysoff_read(src, uid, &method, &offset, &tai, &delay)) {
+			if (src->eof)
+				break;
+			error("[TSQ-T] Failed to read the PHC offset: %s\n",
+			      strerror(errno));
 		}
-		data.uid = uid;
-		data.seq = seq;
-		data.secs = e.t.sec;
-		data.nsecs = e.t.nsec;
-
-		bzero(send_buff, BUFFER_SIZE);
-		memcpy(send_buff, &data, sizeof(data));
+		if (!sysoff_sample(&acc[0], offset, tai, user_opt->rate, uid,
+				   seq, &data))
+			continue;
+		if (verbose)
+			printf("[TSQ-T:%d] Sending %d: %lld#%ld, last PHC - TAI %lldns (read delay %lldns)\n",
+			       uid, seq, data.secs, data.nsecs, offset, delay);
+		talker_queue(user_opt, batch, &queued, &data, msg_type, uid);
+		seq++;
+	}
 
-		/*
-		 * If secs / nsecs turns out to be zero, it wont be sent over,
-		 * because the values read are not valid.
-		 */
-		if ( (data.secs != 0) && (data.nsecs != 0) ) {
+	while (get_signal() == 0 && user_opt->source == SOURCE_EXTTS) {
+		/* Drains every queued event in one read */
+		n = phc_source_read_extts(src, ev, TSQ_EVENTS_PER_READ, timeout_ms);
+		if (n < 0)
+			error("[TSQ-T] Failed to read EXTTS events: %s\n",
+			      strerror(errno));
+		if (n == 0 && src->eof) {
+			if (verbose)
+				printf("[TSQ-T] End of %s after %d samples\n",
+				       device, seq);
+			break;
+		}
+		if (n == 0) {
 			if (verbose)
-				printf("[TSQ-T:%d] Sending %d: %lld#%ld\n",
-					uid, seq, data.secs, data.nsecs);
+				printf("[TSQ-T] No EXTTS event in %dms, seq: %d\n",
+				       timeout_ms, seq);
+			continue;
+		}
 
-			ret = write(glob_sockfd, send_buff, sizeof(send_buff));
-			if (ret < 0)
-				error("[TSQ-T] Erorr writing to socket.\n");
+		for (e = ev; e < ev + n; e++) {
+			for (ch = 0; ch < user_opt->nchannels; ch++)
+				if (user_opt->channels[ch] == (int)e->index)
+					break;
+			if (ch == user_opt->nchannels)
+				continue;
 
+			/*
+			 * If secs turns out to be zero, it wont be sent over,
+			 * because the values read are not valid.
+			 */
+			if (e->t.sec == 0)
+				continue;
+
+			if (!extts_sample(&acc[ch], e, user_opt->rate, uid, seq, &data))
+				continue;
+			if (verbose && msg_type == TSQ_MSG_STATS)
+				printf("[TSQ-T:%d] Sending %d ch %d: %lld#%ld %d edges jitter %ldns\n",
+				       uid, seq, data.channel, data.secs,
+				       data.nsecs, data.count, data.jitter);
+			else if (verbose)
+				printf("[TSQ-T:%d] Sending %d ch %d: %lld#%ld\n",
+				       uid, seq, data.channel, data.secs, data.nsecs);
+
+			talker_queue(user_opt, batch, &queued, &data, msg_type, uid);
 			seq++;
-		} else {
-			if (verbose)
-				printf ("[TSQ-T] sec:%lld nsec:%ld seq: %d\n",
-					 data.secs, data.nsecs, seq);
 		}
 	}
 
+	if (queued)
+		tsq_send(glob_sockfd, msg_type, uid, batch, queued);
+
+	if (perout_fd >= 0) {
+		talker_perout(perout_fd, user_opt->perout_index, user_opt->rate, false);
+		close(perout_fd);
+	}
+	if (user_opt->enable_channels && user_opt->source == SOURCE_EXTTS)
+		for (i = 0; i < user_opt->nchannels; i++)
+			talker_extts(src, user_opt->channels[i], false);
+	phc_source_close(src);
+	glob_ptpfd = -1;
+
 	close(glob_sockfd);
 }
 
+/* Local mode: one reader thread per PHC, all feeding one alignment */
+struct local_reader {
+	int index;		//Member index
+	char *device;
+	struct phc_source *src;
+	struct listener *l;
+	struct opt *opt;
+	pthread_t thread;
+	unsigned long reads;	//EXTTS events or offset reads
+	bool done;
+};
+
+pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t local_cond = PTHREAD_COND_INITIALIZER;
+int local_running;
+
+/**
+ *  @brief Hand a sample to the alignment
+ *
+ *  A source that is not paced in real time (mock or replay at speed 0)
+ *  waits while it is half a ring ahead of the oldest open second, so fast
+ *  readers do not overrun the ring of slower or not yet started ones.
+ *  Waiting stops once any reader has ended.
+ */
+static void local_feed(struct local_reader *r, payload *pl)
+{
+	struct listener *l = r->l;
+
+	pthread_mutex_lock(&local_lock);
+	while (!r->src->paced && l->started && get_signal() == 0 &&
+	       local_running == l->count &&
+	       pps_second(pl) - l->next_sec >= TSQ_RING_SECONDS / 2)
+		pthread_cond_wait(&local_cond, &local_lock);
+	listener_sample(l, r->index, pl, r->opt->verbose);
+	pthread_cond_broadcast(&local_cond);
+	pthread_mutex_unlock(&local_lock);
+}
+
+/**
+ *  @brief Drain EXTTS events of the first -c channel
+ */
+static void local_extts(struct local_reader *r)
+{
+	struct ptp_extts_event ev[TSQ_EVENTS_PER_READ], *e;
+	struct extts_acc acc = { 0 };
+	int channel = r->opt->channels[0];
+	int uid = r->l->talkers[r->index].uid;
+	int seq = 0;
+	payload pl;
+	int n;
+
+	while (get_signal() == 0) {
+		n = phc_source_read_extts(r->src, ev, TSQ_EVENTS_PER_READ,
+					  r->opt->timeout);
+		if (n < 0)
+			error("[TSQ-X] %s: Failed to read EXTTS events: %s\n",
+			      r->device, strerror(errno));
+		if (n == 0 && r->src->eof)
+			return;
+		r->reads += n;
+
+		for (e = ev; e < ev + n; e++) {
+			if ((int)e->index != channel || e->t.sec == 0)
+				continue;
+			if (extts_sample(&acc, e, r->opt->rate, uid, seq, &pl)) {
+				local_feed(r, &pl);
+				seq++;
+			}
+		}
+	}
+}
+
+/**
+ *  @brief Read the PHC offset to CLOCK_TAI at every 1 / rate of TAI
+ */
+static void local_sysoff(struct local_reader *r)
+{
+	int uid = r->l->talkers[r->index].uid;
+	struct extts_acc acc = { 0 };
+	int method = r->opt->sysoff_method;
+	long long offset, tai, delay;
+	int seq = 0;
+	payload pl;
+
+	while (get_signal() == 0) {
+		if (sysoff_read(r->src, uid, &method, &offset, &tai, &delay)) {
+			if (r->src->eof)
+				return;
+			error("[TSQ-X] %s: Failed to read the PHC offset: %s\n",
+			      r->device, strerror(errno));
+		}
+		r->reads++;
+		if (sysoff_sample(&acc, offset, tai, r->opt->rate, uid, seq, &pl)) {
+			local_feed(r, &pl);
+			seq++;
+		}
+	}
+}
+
+static void *local_reader_thread(void *arg)
+{
+	struct local_reader *r = arg;
+
+	if (r->opt->source == SOURCE_SYSOFF)
+		local_sysoff(r);
+	else
+		local_extts(r);
+
+	pthread_mutex_lock(&local_lock);
+	r->done = true;
+	local_running--;
+	pthread_cond_broadcast(&local_cond);
+	pthread_mutex_unlock(&local_lock);
+	return NULL;
+}
+
+static void start_pinned_thread(pthread_t *thread, void *(*fn)(void *),
+				void *arg, int cpu)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	if (pthread_create(thread, &attr, fn, arg))
+		error("[TSQ-X] pthread_create failed\n");
+	pthread_attr_destroy(&attr);
+}
+
+/* Local - compare the PHCs of one machine. Each device gets a reader
+ * thread pinned to its own CPU; samples go straight into the listener
+ * alignment, so output and statistics match the networked mode.
+ */
+void local(struct opt *user_opt)
+{
+	struct local_reader r[TSQ_MAX_TALKERS];
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct timespec t0, t1;
+	unsigned long reads = 0;
+	struct listener *l;
+	int n = user_opt->ndevices;
+	double elapsed;
+	bool running;
+	int i, phc;
+
+	if (n < 2)
+		error("[TSQ-X] Local mode needs at least 2 devices (-d)\n");
+
+	l = listener_alloc(user_opt, n);
+	for (i = 0; i < n; i++) {
+		r[i].index = i;
+		r[i].device = user_opt->devices[i];
+		r[i].l = l;
+		r[i].opt = user_opt;
+		r[i].reads = 0;
+		r[i].done = false;
+		r[i].src = tsq_source_open(user_opt, r[i].device);
+		if (!r[i].src)
+			error("[TSQ-X] ERROR to open ptp device %s\n", r[i].device);
+
+		/* Members are named after the PHC index, /dev/ptp3 -> 3 */
+		if (sscanf(r[i].device, "/dev/ptp%d", &phc) != 1)
+			phc = i;
+		l->talkers[i].uid = phc;
+		if (user_opt->source == SOURCE_EXTTS) {
+			l->talkers[i].channel = user_opt->channels[0];
+			if (user_opt->enable_channels)
+				talker_extts(r[i].src, user_opt->channels[0], true);
+		}
+	}
+	l->nmembers = n;
+	local_running = n;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (i = 0; i < n; i++) {
+		start_pinned_thread(&r[i].thread, local_reader_thread, &r[i],
+				    (user_opt->cpu + i) % ncpus);
+		if (user_opt->verbose)
+			printf("[TSQ-X] Reading %s (%s, %s) on CPU %ld\n", r[i].device,
+			       r[i].src->ops->name, tsq_source_name(user_opt),
+			       (user_opt->cpu + i) % ncpus);
+	}
+
+	/* Run until a signal, or until every finite source has ended */
+	running = true;
+	while (get_signal() == 0 && running) {
+		usleep(100000);
+		pthread_mutex_lock(&local_lock);
+		fflush(glob_fp);
+		running = local_running > 0;
+		pthread_mutex_unlock(&local_lock);
+	}
+
+	for (i = 0; i < n; i++) {
+		pthread_join(r[i].thread, NULL);
+		if (user_opt->source == SOURCE_EXTTS && user_opt->enable_channels)
+			talker_extts(r[i].src, user_opt->channels[0], false);
+		reads += r[i].reads;
+		phc_source_close(r[i].src);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("[TSQ-X] %lu reads in %.3f s (%.0f/s)\n", reads, elapsed,
+	       elapsed > 0 ? reads / elapsed : 0.0);
+
+	listener_print_matrix(l);
+	listener_print_stability(l);
+	listener_print_losses(l);
+	fclose(glob_fp);
+	glob_fp = NULL;
+	free(l);
+}
+
 int main(int argc, char *argv[])
 {
 	struct opt user_opt;
@@ -650,6 +2271,21 @@ int main(int argc, char *argv[])
 	user_opt.uid = 1234;
 	user_opt.port = 5678;
 	user_opt.output_file = DEFAULT_LISTENER_OUTFILE;
+	user_opt.talkers = DEFAULT_TALKERS;
+	user_opt.stats_interval = DEFAULT_STATS_INTERVAL;
+	user_opt.batch = 1;
+	user_opt.udp = 0;
+	user_opt.rate = 1;
+	user_opt.perout_device = NULL;
+	user_opt.perout_index = 0;
+	user_opt.channels[0] = 0;
+	user_opt.nchannels = 1;
+	user_opt.enable_channels = 0;
+	user_opt.ndevices = 0;
+	user_opt.source = SOURCE_EXTTS;
+	user_opt.sysoff_method = PHC_SYSOFF_EXTENDED;
+	user_opt.burst = PHC_SYSOFF_SAMPLES;
+	user_opt.cpu = 1;
 	glob_fp = NULL;
 	glob_ptpfd = -1;
 	halt_sig = 0;
@@ -669,6 +2305,10 @@ int main(int argc, char *argv[])
 		/* IP (itself), PORT*/
 		listener(&user_opt);
 		break;
+	case MODE_LOCAL:
+		/* devices */
+		local(&user_opt);
+		break;
 	default:
 		error("Invalid mode selected\n");
 		break;
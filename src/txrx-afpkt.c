@@ -33,6 +33,7 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -58,7 +59,7 @@
 #define MSG_BUFLEN  1500
 #define RCVBUF_SIZE (MSG_BUFLEN * MAX_PACKETS)
 
-extern uint32_t glob_rx_seq;
+extern uint64_t glob_rx_seq;
 
 /* Signal handler */
 void afpkt_sigint_handler(int signum)
@@ -68,7 +69,7 @@ void afpkt_sigint_handler(int signum)
 }
 
 /* Retrieve the hardware timestamp stored in CMSG */
-static uint64_t get_timestamp(struct msghdr *msg)
+uint64_t get_timestamp(struct msghdr *msg)
 {
 	struct timespec *ts = NULL;
 	struct cmsghdr *cmsg;
@@ -155,9 +156,11 @@ int init_tx_socket(struct user_opt *opt, int *sockfd,
 	hwconfig.tx_type = HWTSTAMP_TX_ON;
 	hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
 
+	/* Interfaces without a PHC (e.g. veth) are fine unless -h is used */
 	if (ioctl(sock, SIOCSHWTSTAMP, &hwtstamp) < 0) {
 		fprintf(stderr, "%s: %s\n", "ioctl", strerror(errno));
-		exit(1);
+		if (opt->enable_hwts)
+			exit(1);
 	}
 
 	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &timestamping_flags,
@@ -190,19 +193,23 @@ void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk
 	fd_set readfs, errorfs;
 	uint64_t tx_timestampA;
 	uint64_t tx_timestampB;
+	uint64_t prev_hw_txtime = 0;
 	uint64_t looping_ts;
 	struct timespec ts;
 	tsn_packet *tsn_pkt;
 	void *payload_ptr;
 	uint8_t *offset;
+	int late;
 	int res;
 	int ret;
 
 	int interval_ns = opt->interval_ns;
-	int count = opt->frames_to_send;
+	uint64_t count = opt->frames_to_send;
+	uint64_t end_ts;
 	clockid_t clkid = opt->clkid;
 	int sock = *sockfd;
-	uint32_t seq = 1;
+	uint64_t seq = 1;
+	struct metrics_block *mx = opt->mx_tx;
 
 	/* Create packet template */
 	tsn_pkt = alloca(opt->packet_size);
@@ -210,30 +217,36 @@ void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk
 
 	/* TODO SO_TXTIME option but requires sendmsg which breaks sendto()*/
 	
-	looping_ts = get_time_sec(CLOCK_REALTIME) + (2 * NSEC_PER_SEC);
+	looping_ts = get_time_sec(clkid) + (2 * NSEC_PER_SEC);
 	looping_ts += opt->offset_ns;
 	ts.tv_sec = looping_ts / NSEC_PER_SEC;
 	ts.tv_nsec = looping_ts % NSEC_PER_SEC;
+	end_ts = opt->duration_ns ? looping_ts + opt->duration_ns : UINT64_MAX;
 
 	payload_ptr = (void *) (&tsn_pkt->payload);
 	payload = (struct custom_payload *) payload_ptr;
 
 	offset = (uint8_t *) &tsn_pkt->vlan_prio;
 
-	memcpy(&payload->tx_queue, &opt->socket_prio, sizeof(uint32_t));
+	tsn_payload_init(opt, payload);
 
-	while (count && !halt_tx_sig) {
-		ret = clock_nanosleep(clkid, TIMER_ABSTIME, &ts, NULL);
+	while (count && !halt_tx_sig && looping_ts < end_ts) {
+		ret = clock_domain_nanosleep(clkid, &ts, &opt->tai_offset_ns);
 		if (ret) {
 			fprintf(stderr, "Error: failed to sleep %d: %s", ret, strerror(ret));
 			break;
 		}
 
-		tx_timestampA = get_time_nanosec(CLOCK_REALTIME);
+		TSN_PROBE2(tx_wakeup, seq, looping_ts);
+		tx_timestampA = get_user_time_nanosec(opt);
 
-		memcpy(&payload->seq, &seq, sizeof(uint32_t));
-		memcpy(&payload->tx_timestampA, &tx_timestampA, sizeof(uint64_t));
+		payload->seq = seq;
+		payload->tx_timestampA = tx_timestampA;
+		payload->prev_hw_txtime = prev_hw_txtime;
+		tsn_payload_seal(payload);
+		TSN_PROBE2(payload_stamp, seq, tx_timestampA);
 
+		TSN_PROBE1(send_enter, seq);
 		ret = sendto(sock,
 				offset, /* AF_PACKET generates its own ETH HEADER */
 				(size_t) (opt->packet_size) - 14,
@@ -241,9 +254,14 @@ void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk
 				(struct sockaddr *) sk_addr,
 				sizeof(struct sockaddr_ll));
 
+		TSN_PROBE2(send_exit, seq, ret);
 		if (ret < 0)
 			exit_with_error("sendto() failed");
 
+		/* Woke up after the next cycle had already started */
+		late = tx_timestampA >= looping_ts + interval_ns;
+		metrics_tx(mx, late);
+
 		looping_ts += interval_ns;
 		ts.tv_sec = looping_ts / NSEC_PER_SEC;
 		ts.tv_nsec = looping_ts % NSEC_PER_SEC;
@@ -269,10 +287,12 @@ void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk
 				fprintf(stderr, "CSMG txtimestamp has error\n");
 
 			tx_timestampB = extract_ts_from_cmsg(sock, MSG_ERRQUEUE);
+			prev_hw_txtime = tx_timestampB;
+			TSN_PROBE2(tx_complete, seq - 1, tx_timestampB);
 
 			/* Result format: seq, user txtime, hw txtime */
 			if (verbose)
-				fprintf(stdout, "%u\t%lu\t%lu\n",
+				fprintf(stdout, "%lu\t%lu\t%lu\n",
 					seq - 1,
 					tx_timestampA,
 					tx_timestampB);
@@ -281,11 +301,16 @@ void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk
 			 * either indicating hwtstamp is not enabled OR
 			 * packet failed to transmit.
 			 */
+			prev_hw_txtime = 0;
 			if (verbose)
-				fprintf(stdout, "%u %lu 0\n",
+				fprintf(stdout, "%lu %lu 0\n",
 					seq - 1, tx_timestampA);
 		}
 		fflush(stdout);
+
+		flightrec_tx(opt->frec, seq - 1, looping_ts - interval_ns,
+			     tx_timestampA, 0, prev_hw_txtime, 0,
+			     opt->socket_prio, late);
 	}
 
 	close(sock);
@@ -303,18 +328,22 @@ void afpkt_send_thread_etf(struct user_opt *opt, int *sockfd, struct sockaddr_ll
 	uint64_t tx_timestamp;
 	uint64_t tx_timestampA;
 	uint64_t tx_timestampB;
+	uint64_t prev_hw_txtime = 0;
 	uint64_t looping_ts;
 	struct timespec ts;
 	tsn_packet *tsn_pkt;
 	void *payload_ptr;
+	int late;
 	int res;
 	int ret;
 
 	int interval_ns = opt->interval_ns;
-	int count = opt->frames_to_send;
+	uint64_t count = opt->frames_to_send;
+	uint64_t end_ts;
 	clockid_t clkid = opt->clkid;
 	int sock = *sockfd;
-	uint32_t seq = 1;
+	uint64_t seq = 1;
+	struct metrics_block *mx = opt->mx_tx;
 
 	/* Create packet template */
 	tsn_pkt = alloca(opt->packet_size);
@@ -344,35 +373,52 @@ void afpkt_send_thread_etf(struct user_opt *opt, int *sockfd, struct sockaddr_ll
 
 	/* CMSG end? */
 
-	looping_ts = get_time_sec(CLOCK_REALTIME) + (2 * NSEC_PER_SEC);
+	looping_ts = get_time_sec(clkid) + (2 * NSEC_PER_SEC);
 	looping_ts += opt->offset_ns;
 	looping_ts -= opt->early_offset_ns;
 	ts.tv_sec = looping_ts / NSEC_PER_SEC;
 	ts.tv_nsec = looping_ts % NSEC_PER_SEC;
+	end_ts = opt->duration_ns ? looping_ts + opt->duration_ns : UINT64_MAX;
 
 	payload_ptr = (void *) (&tsn_pkt->payload);
 	payload = (struct custom_payload *) payload_ptr;
 
-	memcpy(&payload->tx_queue, &opt->socket_prio, sizeof(uint32_t));
+	tsn_payload_init(opt, payload);
+	payload->flags = TSN_PAYLOAD_F_TXTIME;
 
-	while (count && !halt_tx_sig) {
-		ret = clock_nanosleep(clkid, TIMER_ABSTIME, &ts, NULL);
+	while (count && !halt_tx_sig && looping_ts < end_ts) {
+		ret = clock_domain_nanosleep(clkid, &ts, &opt->tai_offset_ns);
 		if (ret) {
 			fprintf(stderr, "Error: failed to sleep %d: %s", ret, strerror(ret));
 			break;
 		}
 
-		tx_timestampA = get_time_nanosec(CLOCK_REALTIME);
-		memcpy(&payload->seq, &seq, sizeof(uint32_t));
-		memcpy(&payload->tx_timestampA, &tx_timestampA, sizeof(uint64_t));
+		TSN_PROBE2(tx_wakeup, seq, looping_ts);
+		tx_timestampA = get_user_time_nanosec(opt);
 
 		/* Update CMSG tx_timestamp and payload before sending */
-		tx_timestamp = looping_ts + opt->early_offset_ns;
+		tx_timestamp = looping_ts + opt->early_offset_ns + opt->tai_offset_ns;
 		*((__u64 *) CMSG_DATA(cmsg)) = tx_timestamp;
 
+		payload->seq = seq;
+		payload->launch_time = tx_timestamp;
+		payload->tx_timestampA = tx_timestampA;
+		payload->prev_hw_txtime = prev_hw_txtime;
+		tsn_payload_seal(payload);
+		TSN_PROBE2(payload_stamp, seq, tx_timestampA);
+
+		TSN_PROBE1(send_enter, seq);
 		ret = sendmsg(sock, &msg, 0);
-		if (ret < 1)
+		TSN_PROBE2(send_exit, seq, ret);
+		if (ret < 1) {
 			printf("sendmsg failed: %m");
+			if (mx)
+				metrics_add(&mx->drops, 1);
+		}
+
+		/* Stamped after its own launch time, ETF will drop it */
+		late = tx_timestampA > looping_ts + opt->early_offset_ns;
+		metrics_tx(mx, late);
 
 		looping_ts += interval_ns;
 		ts.tv_sec = looping_ts / NSEC_PER_SEC;
@@ -399,23 +445,35 @@ void afpkt_send_thread_etf(struct user_opt *opt, int *sockfd, struct sockaddr_ll
 				fprintf(stderr, "CSMG txtimestamp has error\n");
 
 			tx_timestampB = extract_ts_from_cmsg(sock, MSG_ERRQUEUE);
+			prev_hw_txtime = tx_timestampB;
+			TSN_PROBE2(tx_complete, seq - 1, tx_timestampB);
 
-			/* Result format: seq, user txtime, hw txtime */
+			/* Result format:
+			 *   seq, user txtime, hw txtime, launch txtime, queue
+			 */
 			if (verbose)
-				fprintf(stdout, "%u\t%lu\t%lu\n",
+				fprintf(stdout, "%lu\t%lu\t%lu\t%lu\t%u\n",
 					seq - 1,
 					tx_timestampA,
-					tx_timestampB);
+					tx_timestampB,
+					tx_timestamp,
+					opt->socket_prio);
 		} else {
 			/* Print 0 if txtimestamp failed to return in time,
 			 * either indicating hwtstamp is not enabled OR
 			 * packet failed to transmit.
 			 */
+			prev_hw_txtime = 0;
 			if (verbose)
-				fprintf(stdout, "%u %lu 0\n",
-					seq - 1, tx_timestampA);
+				fprintf(stdout, "%lu %lu 0 %lu %u\n",
+					seq - 1, tx_timestampA, tx_timestamp,
+					opt->socket_prio);
 		}
 		fflush(stdout);
+
+		flightrec_tx(opt->frec, seq - 1, looping_ts - interval_ns,
+			     tx_timestampA, tx_timestamp, prev_hw_txtime, 0,
+			     opt->socket_prio, late);
 	}
 
 	close(sock);
@@ -423,7 +481,7 @@ void afpkt_send_thread_etf(struct user_opt *opt, int *sockfd, struct sockaddr_ll
 }
 
 /* Create a RAW socket to receive all incoming packets from an interface. */
-int init_rx_socket(uint16_t etype, int *sock, char *interface)
+int init_rx_socket(uint16_t etype, int *sock, char *interface, int enable_hwts)
 {
 	struct sockaddr_ll addr;
 	struct ifreq if_request;
@@ -497,7 +555,8 @@ int init_rx_socket(uint16_t etype, int *sock, char *interface)
 
 	if (ioctl(rsock, SIOCSHWTSTAMP, &if_request) < 0) {
 		fprintf(stderr, "%s: %s\n", "ioctl", strerror(errno));
-		exit(1);
+		if (enable_hwts)
+			exit(1);
 	}
 
 	timestamping_flags = SOF_TIMESTAMPING_RX_HARDWARE |
@@ -511,21 +570,18 @@ int init_rx_socket(uint16_t etype, int *sock, char *interface)
 	return 0;
 }
 
-int afpkt_recv_pkt(int sock, struct user_opt *opt)
+/* Non-blocking receive of one frame into buffer. Returns the frame length,
+ * or 0 if none is pending, with the user and (if -h) hw rx timestamps.
+ */
+static int afpkt_recv_frame(int sock, struct user_opt *opt, char *buffer,
+			    uint64_t *rx_hwtime, uint64_t *rx_usertime)
 {
-	uint64_t rx_timestampC, rx_timestampD;
 	struct sockaddr_in host_address;
-	struct custom_payload *payload;
 	struct msghdr msg;
 	struct iovec iov;
-	char buffer[MSG_BUFLEN];
 	char control[1024];
-	tsn_packet *tsn_pkt;
-	void *payload_ptr;
 	int ret;
 
-	ret = 0;
-
 	/* Initialize empty msghdrs and buffers */
 	bzero(&host_address, sizeof(struct sockaddr_in));
 	host_address.sin_family = AF_INET;
@@ -548,40 +604,294 @@ int afpkt_recv_pkt(int sock, struct user_opt *opt)
 		usleep(1); /*No message in buffer, do nothing*/
 		return 0;
 	}
-	rx_timestampD = get_time_nanosec(CLOCK_REALTIME);
-
-	/* Point to payload's location in received packet's buffer */
-	tsn_pkt = (tsn_packet *) (buffer - 4);
-	payload_ptr = (void *) (&tsn_pkt->payload);
-	payload = (struct custom_payload *) payload_ptr;
+	*rx_usertime = get_user_time_nanosec(opt);
+	TSN_PROBE2(rx_pop, ret, *rx_usertime);
 
 	if (opt->enable_hwts)
-		rx_timestampC = get_timestamp(&msg);
+		*rx_hwtime = get_timestamp(&msg);
 	else
-		rx_timestampC = 0;
+		*rx_hwtime = 0;
 
-	/* Do simple checks and filtering */
-	if (payload->tx_queue > 8 || payload->seq > (50 * 1000 * 1000)) {
-		if (verbose)
-			fprintf(stderr, "Warn: Skipping invalid packet\n");
-		return -1;
-	} else if (rx_timestampC == 0) {
+	return ret;
+}
+
+/* Round-trip mode: print a frame that came back from a reflector */
+static void afpkt_print_reflected(struct custom_payload *payload,
+				  void *ext_ptr, int ext_len,
+				  uint64_t rx_hwtime, uint64_t rx_usertime)
+{
+	struct reflect_ext ext;
+	int64_t rtt, residence;
+
+	if (tsn_reflect_parse(ext_ptr, ext_len, &ext) != TSN_PAYLOAD_OK) {
 		if (verbose)
-			fprintf(stderr, "Warn: No RX HW timestamp.\n");
+			fprintf(stderr, "Warn: Skipping invalid reflected packet\n");
+		return;
 	}
 
+	rtt = rx_usertime - payload->tx_timestampA;
+	residence = ext.tx_time - ext.rx_time;
+
 	/* Result format:
-	 *   u2u latency, seq, queue, user txtime, hw rxtime, user rxtime
+	 *   rtt, seq, queue, user txtime, reflector rxtime, reflector txtime,
+	 *   user rxtime, reflector residence, rtt - residence,
+	 *   outbound leg, return leg, hw rxtime, reflector hw rxtime
+	 * Only the legs depend on the two hosts being time synchronized.
 	 */
-	fprintf(stdout, "%ld\t%d\t%d\t%ld\t%ld\t%ld\n",
-			rx_timestampD - payload->tx_timestampA,
+	fprintf(stdout, "%ld\t%lu\t%u\t%lu\t%lu\t%lu\t%lu\t%ld\t%ld\t%ld\t%ld\t%lu\t%lu\n",
+			rtt,
 			payload->seq,
 			payload->tx_queue,
 			payload->tx_timestampA,
-			rx_timestampC,
-			rx_timestampD);
+			ext.rx_time,
+			ext.tx_time,
+			rx_usertime,
+			residence,
+			rtt - residence,
+			(int64_t)(ext.rx_time - payload->tx_timestampA),
+			(int64_t)(rx_usertime - ext.tx_time),
+			rx_hwtime,
+			ext.rx_hw_time);
 	fflush(stdout);
 	glob_rx_seq = payload->seq;
+}
+
+/* Hand a validated frame to the pcapng writer, timestamped with the hw
+ * rxtime when available
+ */
+static void afpkt_pcap_record(struct user_opt *opt, void *frame, int len,
+			      struct custom_payload *payload,
+			      uint64_t rx_hwtime, uint64_t rx_usertime)
+{
+	if (!opt->pcap)
+		return;
+
+	pcapng_record(opt->pcap, frame, len,
+		      rx_hwtime ? rx_hwtime : rx_usertime,
+		      opt->socket_prio, payload->tx_timestampA,
+		      rx_usertime - payload->tx_timestampA);
+}
+
+int afpkt_recv_pkt(int sock, struct user_opt *opt)
+{
+	uint64_t rx_timestampC, rx_timestampD;
+	struct custom_payload payload;
+	char buffer[MSG_BUFLEN];
+	void *payload_ptr;
+	int frame_len;
+	int len;
+	int ret;
+
+	len = afpkt_recv_frame(sock, opt, buffer, &rx_timestampC, &rx_timestampD);
+	if (len <= 0)
+		return 0;
+	frame_len = len;
+
+	/* Point to payload's location in received packet's buffer. The VLAN
+	 * tag is stripped on receive, so the payload sits 4 bytes earlier
+	 * than in tsn_packet.
+	 */
+	payload_ptr = (void *) (buffer + offsetof(tsn_packet, payload) - 4);
+	len -= offsetof(tsn_packet, payload) - 4;
+
+	/* Validate magic, version, CRC and fields in one pass */
+	ret = tsn_payload_parse(payload_ptr, len, &payload);
+	if (ret != TSN_PAYLOAD_OK) {
+		if (verbose)
+			fprintf(stderr, "Warn: Skipping invalid packet (%d)\n", ret);
+		return -1;
+	}
+
+	TSN_PROBE3(rx_timestamp, payload.seq, rx_timestampC, rx_timestampD);
+
+	/* Round-trip mode also sees its own outgoing frames, skip those */
+	if (opt->mode == MODE_ROUNDTRIP) {
+		if (payload.flags & TSN_PAYLOAD_F_REFLECTED) {
+			afpkt_pcap_record(opt, buffer, frame_len, &payload,
+					  rx_timestampC, rx_timestampD);
+			metrics_rx(metrics_rx_block(opt->mx_rx, opt->mx_rx_other,
+								    payload.stream_id),
+				   payload.seq, rx_timestampD - payload.tx_timestampA);
+			if (opt->telem)
+				telemetry_update(opt->telem, payload.seq,
+						 rx_timestampD - payload.tx_timestampA,
+						 rx_timestampD);
+			if (opt->summary)
+				summary_update(opt->summary, payload.seq,
+					       rx_timestampD - payload.tx_timestampA,
+					       rx_timestampD);
+			flightrec_rx(opt->frec, payload.seq, payload.tx_timestampA,
+				     payload.launch_time, payload.prev_hw_txtime,
+				     rx_timestampC, rx_timestampD, 0,
+				     payload.tx_queue);
+			if (opt->quiet)
+				glob_rx_seq = payload.seq;
+			else
+				afpkt_print_reflected(&payload,
+						      (char *)payload_ptr + sizeof(payload),
+						      len - sizeof(payload),
+						      rx_timestampC, rx_timestampD);
+		}
+		return 0;
+	}
+
+	if (rx_timestampC == 0) {
+		if (verbose)
+			fprintf(stderr, "Warn: No RX HW timestamp.\n");
+	}
+
+	/* Result format:
+	 *   u2u latency, seq, queue, user txtime, hw rxtime, user rxtime,
+	 *   stream id, launch time, hw txtime of seq - 1
+	 */
+	if (!opt->quiet) {
+		fprintf(stdout, "%ld\t%lu\t%u\t%lu\t%lu\t%lu\t%u\t%lu\t%lu\n",
+				rx_timestampD - payload.tx_timestampA,
+				payload.seq,
+				payload.tx_queue,
+				payload.tx_timestampA,
+				rx_timestampC,
+				rx_timestampD,
+				payload.stream_id,
+				payload.launch_time,
+				payload.prev_hw_txtime);
+		fflush(stdout);
+	}
+	glob_rx_seq = payload.seq;
+
+	if (opt->summary)
+		summary_update(opt->summary, payload.seq,
+			       rx_timestampD - payload.tx_timestampA,
+			       rx_timestampD);
+
+	flightrec_rx(opt->frec, payload.seq, payload.tx_timestampA,
+		     payload.launch_time, payload.prev_hw_txtime,
+		     rx_timestampC, rx_timestampD, 0, payload.tx_queue);
+
+	afpkt_pcap_record(opt, buffer, frame_len, &payload,
+			  rx_timestampC, rx_timestampD);
+	metrics_rx(metrics_rx_block(opt->mx_rx, opt->mx_rx_other,
+				    payload.stream_id),
+		   payload.seq, rx_timestampD - payload.tx_timestampA);
+	if (opt->telem)
+		telemetry_update(opt->telem, payload.seq,
+				 rx_timestampD - payload.tx_timestampA,
+				 rx_timestampD);
 
 	return 0;
 }
+
+/* Reflector mode: send every measurement frame straight back to its sender
+ * on this socket's priority (-q), with the reflector's own rx and tx
+ * timestamps appended.
+ */
+void afpkt_reflect(struct user_opt *opt)
+{
+	struct sockaddr_ll sk_addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_8021Q),
+		.sll_halen = ETH_ALEN,
+	};
+	uint32_t reply_size = offsetof(tsn_packet, payload) +
+			      sizeof(struct custom_payload) +
+			      sizeof(struct reflect_ext);
+	struct custom_payload payload;
+	uint64_t rx_hwtime, rx_time;
+	struct reflect_ext ext;
+	char buffer[MSG_BUFLEN];
+	tsn_packet *tsn_pkt;
+	uint8_t *reply_ptr;
+	int rsock, tsock;
+	int len;
+
+	if (opt->packet_size > reply_size)
+		reply_size = opt->packet_size;
+
+	tsn_pkt = alloca(reply_size);
+	opt->packet_size = reply_size;
+	setup_tsn_vlan_packet(opt, tsn_pkt);
+	reply_ptr = (uint8_t *) &tsn_pkt->payload;
+
+	init_tx_socket(opt, &tsock, &sk_addr);
+	if (init_rx_socket(0xb62c, &rsock, opt->ifname, opt->enable_hwts))
+		exit_with_error("init_rx_socket failed");
+
+	while (!halt_tx_sig) {
+		len = afpkt_recv_frame(rsock, opt, buffer, &rx_hwtime, &rx_time);
+		if (len <= 0)
+			continue;
+
+		/* Already reflected frames include our own outgoing ones */
+		if (tsn_payload_parse(buffer + offsetof(tsn_packet, payload) - 4,
+				      len - (offsetof(tsn_packet, payload) - 4),
+				      &payload) != TSN_PAYLOAD_OK ||
+		    (payload.flags & TSN_PAYLOAD_F_REFLECTED))
+			continue;
+
+		/* Reply to the frame's source MAC */
+		memcpy(&sk_addr.sll_addr, &buffer[ETH_ALEN], ETH_ALEN);
+
+		payload.flags |= TSN_PAYLOAD_F_REFLECTED;
+		tsn_payload_seal(&payload);
+		memcpy(reply_ptr, &payload, sizeof(payload));
+
+		ext.rx_hw_time = rx_hwtime;
+		ext.rx_time = rx_time;
+		ext.tx_time = get_user_time_nanosec(opt);
+		tsn_reflect_seal(&ext);
+		memcpy(reply_ptr + sizeof(payload), &ext, sizeof(ext));
+
+		if (sendto(tsock, &tsn_pkt->vlan_prio, reply_size - 14, 0,
+			   (struct sockaddr *) &sk_addr,
+			   sizeof(struct sockaddr_ll)) < 0)
+			exit_with_error("sendto() failed");
+
+		if (verbose)
+			fprintf(stdout, "%lu\t%lu\n", payload.seq,
+				ext.tx_time - ext.rx_time);
+	}
+
+	close(rsock);
+	close(tsock);
+}
+
+/* Loopback mode TX thread: same as -t but started by run_loopback() */
+void *afpkt_tx_thread(void *arg)
+{
+	struct user_opt *opt = (struct user_opt *)arg;
+	struct sockaddr_ll sk_addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_8021Q),
+		.sll_halen = ETH_ALEN,
+	};
+	int sockfd;
+
+	init_tx_socket(opt, &sockfd, &sk_addr);
+
+	if (!opt->enable_txtime)
+		afpkt_send_thread(opt, &sockfd, &sk_addr);
+	else
+		afpkt_send_thread_etf(opt, &sockfd, &sk_addr);
+
+	return NULL;
+}
+
+/* Loopback mode RX thread: same as -r but started by run_loopback() */
+void *afpkt_rx_thread(void *arg)
+{
+	struct user_opt *opt = (struct user_opt *)arg;
+	int sockfd;
+
+	if (init_rx_socket(0xb62c, &sockfd, opt->ifname, opt->enable_hwts))
+		exit_with_error("init_rx_socket failed");
+
+	rx_start(opt);
+	while (!halt_tx_sig) {
+		afpkt_recv_pkt(sockfd, opt);
+		if (rx_done(opt))
+			break;
+	}
+
+	close(sockfd);
+	return NULL;
+}
@@ -41,8 +41,12 @@ extern int halt_tx_sig;
 extern int verbose;
 
 void afpkt_sigint_handler(int signum);
+uint64_t get_timestamp(struct msghdr *msg);
 int init_tx_socket(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk_addr);
 void afpkt_send_thread(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk_addr);
 void afpkt_send_thread_etf(struct user_opt *opt, int *sockfd, struct sockaddr_ll *sk_addr);
-int init_rx_socket(uint16_t etype, int *sock, char *interface);
+int init_rx_socket(uint16_t etype, int *sock, char *interface, int enable_hwts);
 int afpkt_recv_pkt(int sock, struct user_opt *opt);
+void afpkt_reflect(struct user_opt *opt);
+void *afpkt_tx_thread(void *arg);
+void *afpkt_rx_thread(void *arg);
@@ -73,7 +73,7 @@
 extern uint32_t glob_xdp_flags;
 extern int glob_ifindex;
 extern int verbose;
-extern uint32_t glob_rx_seq;
+extern uint64_t glob_rx_seq;
 
 /* User Defines */
 #define DEFAULT_NUM_FLUSH_PACKETS 10 //for socket flushing
@@ -92,6 +92,13 @@ void xdpsock_cleanup(void)
 	xsk_socket__delete(glob_xskinfo_ptr->xskfd);
 	(void)xsk_umem__delete(umem);
 
+	/* Loopback mode RX socket on the peer interface */
+	if (glob_xskinfo_peer_ptr) {
+		umem = glob_xskinfo_peer_ptr->pktbuff->umem;
+		xsk_socket__delete(glob_xskinfo_peer_ptr->xskfd);
+		(void)xsk_umem__delete(umem);
+	}
+
 	exit(EXIT_SUCCESS);
 }
 
@@ -180,6 +187,8 @@ static struct xsk_info *create_xsk_info(struct user_opt *opt, struct pkt_buffer
 	if (ret)
 		afxdp_exit_with_error(-ret);
 
+	metrics_add_xdp_socket(opt->ifname, xsk_socket__fd(temp_xsk->xskfd));
+
 	ret = bpf_xdp_query_id(opt->ifindex, opt->x_opt.xdp_flags, &temp_xsk->prog_id);
 	if (ret)
 		afxdp_exit_with_error(-ret);
@@ -262,12 +271,16 @@ static void update_txstats(struct xsk_info *xsk)
 		xsk_ring_cons__release(&xsk->pktbuff->tx_comp_ring, rcvd);
 		xsk->outstanding_tx -= rcvd;
 		xsk->tx_npkts += rcvd;
+		TSN_PROBE2(tx_complete, xsk->tx_npkts, 0);
 	}
 }
 
-static void afxdp_send_pkt(struct xsk_info *xsk, struct user_opt *opt,
-			 uint32_t header_size, uint32_t packet_size,
-			 void *payload, uint64_t tx_timestamp)
+/* Returns the kick's sendto() result, or -1 with errno set when the frame
+ * could not be queued
+ */
+static int afxdp_send_pkt(struct xsk_info *xsk, struct user_opt *opt,
+			  uint32_t header_size, uint32_t packet_size,
+			  void *payload, uint64_t tx_timestamp)
 {
 	uint64_t cur_tx = xsk->cur_tx;	//packet_count  * frame_size
 	uint32_t pkt_per_send = 1;	//Dont do bactching for now.
@@ -285,11 +298,10 @@ static void afxdp_send_pkt(struct xsk_info *xsk, struct user_opt *opt,
 		fds[0].events = POLLOUT;
 
 		ret = poll(fds, nfds, timeout);
-		if (ret <= 0)
-			return; //TODO: Return a EBUSY or EAGAIN
-
-		if (!(fds[0].revents & POLLOUT))
-			return; //TODO: Return a EBUSY or EAGAIN
+		if (ret <= 0 || !(fds[0].revents & POLLOUT)) {
+			errno = ret < 0 ? errno : EBUSY;
+			return -1;
+		}
 	}
 
 	/* Actual filling of payload into umem. Start a loop here if batching. */
@@ -297,8 +309,10 @@ static void afxdp_send_pkt(struct xsk_info *xsk, struct user_opt *opt,
 
 	memcpy(umem_data + header_size, payload, packet_size - header_size);
 
-	if (xsk_ring_prod__reserve(&xsk->tx_ring, pkt_per_send, &idx) != pkt_per_send)
-		return; //TODO return EGAGIN or ENOBUFF
+	if (xsk_ring_prod__reserve(&xsk->tx_ring, pkt_per_send, &idx) != pkt_per_send) {
+		errno = ENOBUFS;
+		return -1;
+	}
 
 	if (!opt->enable_txtime)
 		tx_timestamp = 0; //Just in case
@@ -321,10 +335,11 @@ static void afxdp_send_pkt(struct xsk_info *xsk, struct user_opt *opt,
 	ret = sendto(xsk_socket__fd(xsk->xskfd), NULL, 0, MSG_DONTWAIT, NULL, 0);
 	if (ret >= 0 || errno == ENOBUFS || errno == EAGAIN || errno == EBUSY) {
 		update_txstats(xsk);
-		return; //TODO: Return ESUCCESS?
+		return ret;
 	}
 
 	afxdp_exit_with_error(errno);
+	return ret;
 }
 
 void *afxdp_send_thread(void *arg)
@@ -335,12 +350,15 @@ void *afxdp_send_thread(void *arg)
 	char buff[opt->packet_size];
 	uint64_t sleep_timestamp;
 	uint64_t tx_timestamp;
+	uint64_t end_ts;
 	tsn_packet *tsn_pkt;
 	struct timespec ts;
 
 	struct xsk_info *xsk = opt->xsk;
 	uint64_t seq_num = 0;
 	uint64_t i = 0;
+	struct metrics_block *mx = opt->mx_tx;
+	int ret;
 
 	/* Create packet template */
 	tsn_pkt = alloca(opt->packet_size);
@@ -351,33 +369,59 @@ void *afxdp_send_thread(void *arg)
 				opt->x_opt.frame_size);
 
 	payload = (struct custom_payload *) buff;
+	tsn_payload_init(opt, payload);
+	payload->tx_queue = opt->x_opt.queue;
+	if (opt->enable_txtime)
+		payload->flags = TSN_PAYLOAD_F_TXTIME;
 
-	tx_timestamp = get_time_sec(CLOCK_REALTIME);    //0.5s ahead (stmmac limitation)
+	tx_timestamp = get_time_sec(opt->clkid);    //0.5s ahead (stmmac limitation)
 	tx_timestamp += opt->offset_ns;
 	tx_timestamp += 2 * NSEC_PER_SEC;
+	end_ts = opt->duration_ns ? tx_timestamp + opt->duration_ns : UINT64_MAX;
 
-	while(!halt_tx_sig && (i < opt->frames_to_send + DEFAULT_NUM_FLUSH_PACKETS) ) {
+	while(!halt_tx_sig && (i < opt->frames_to_send + DEFAULT_NUM_FLUSH_PACKETS) &&
+	      tx_timestamp < end_ts) {
 
 		sleep_timestamp = tx_timestamp - opt->early_offset_ns;
 		ts.tv_sec = sleep_timestamp / NSEC_PER_SEC;
 		ts.tv_nsec = sleep_timestamp % NSEC_PER_SEC;
-		clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL);
+		clock_domain_nanosleep(opt->clkid, &ts, &opt->tai_offset_ns);
 
-		payload->tx_queue = opt->x_opt.queue;
+		TSN_PROBE2(tx_wakeup, seq_num, sleep_timestamp);
 		payload->seq = seq_num;
-		payload->tx_timestampA = get_time_nanosec(CLOCK_REALTIME);
+		payload->tx_timestampA = get_user_time_nanosec(opt);
+		if (opt->enable_txtime)
+			payload->launch_time = tx_timestamp + opt->tai_offset_ns;
+		tsn_payload_seal(payload);
+		TSN_PROBE2(payload_stamp, seq_num, payload->tx_timestampA);
 
 		//Send one packet without caring about descriptors, make it look normal.
+		TSN_PROBE1(send_enter, seq_num);
 		if (opt->enable_txtime)
-			afxdp_send_pkt(xsk, opt, 18, opt->packet_size, &buff, tx_timestamp);
+			ret = afxdp_send_pkt(xsk, opt, 18, opt->packet_size, &buff,
+					     tx_timestamp + opt->tai_offset_ns);
 		else
-			afxdp_send_pkt(xsk, opt, 18, opt->packet_size, &buff, 0);
+			ret = afxdp_send_pkt(xsk, opt, 18, opt->packet_size, &buff, 0);
+		TSN_PROBE2(send_exit, seq_num, ret);
+
+		/* Stamped after its own launch/cycle time */
+		metrics_tx(mx, payload->tx_timestampA > tx_timestamp);
+		flightrec_tx(opt->frec, payload->seq, sleep_timestamp,
+			     payload->tx_timestampA,
+			     opt->enable_txtime ? tx_timestamp + opt->tai_offset_ns : 0,
+			     0, xsk->outstanding_tx, opt->x_opt.queue,
+			     payload->tx_timestampA > tx_timestamp);
 
 		/* Result format:
-		 *   seq, user txtime, hw txtime is via trace for now
+		 *   seq, user txtime, hw txtime, launch txtime, queue
+		 * hw txtime is via trace for now and logged as 0, launch txtime
+		 * is 0 without -T.
 		 */
 		if (verbose)
-			fprintf(stdout, "%d\t%ld\n", payload->seq, payload->tx_timestampA);
+			fprintf(stdout, "%lu\t%lu\t0\t%lu\t%u\n", payload->seq,
+				payload->tx_timestampA,
+				opt->enable_txtime ? tx_timestamp + opt->tai_offset_ns : 0,
+				opt->x_opt.queue);
 		seq_num++;
 		tx_timestamp += opt->interval_ns;
 		fflush(stdout);
@@ -392,9 +436,10 @@ void *afxdp_send_thread(void *arg)
 }
 
 // Receive 1 packet at a time and print it.
-void afxdp_recv_pkt(struct xsk_info *xsk, void *rbuff)
+void afxdp_recv_pkt(struct user_opt *opt, void *rbuff)
 {
-	struct custom_payload *payload;
+	struct xsk_info *xsk = opt->xsk;
+	struct custom_payload payload;
 	uint64_t rx_timestampD;
 	tsn_packet *tsn_pkt;
 	void *payload_ptr;
@@ -426,25 +471,65 @@ void afxdp_recv_pkt(struct xsk_info *xsk, void *rbuff)
 			continue;
 		}
 
-		rx_timestampD = get_time_nanosec(CLOCK_REALTIME);
+		rx_timestampD = get_user_time_nanosec(opt);
+		TSN_PROBE2(rx_pop, len, rx_timestampD);
 
 		tsn_pkt = (tsn_packet *) pkt;
 		payload_ptr = (void *) (&tsn_pkt->payload);
-		payload = (struct custom_payload *) payload_ptr;
 
 		if ((tsn_pkt->vlan_hdr == 0x81 || tsn_pkt->vlan_hdr == 0x08) &&
 		    (tsn_pkt->eth_hdr == htons(0xb62c)) &&
-		    (payload->seq > 0 && payload->seq < (50 * 1000 * 1000)) &&
-		    (tsn_pkt->vlan_prio / 32) < 8) {
-
-			fprintf(stdout, "%lu\t%u\t%u\t%lu\t%lu\t%lu\n",
-					rx_timestampD - payload->tx_timestampA,
-					payload->seq,
-					payload->tx_queue,
-					payload->tx_timestampA,
-					*(uint64_t *)(pkt - sizeof(uint64_t)),
-					rx_timestampD);
-			glob_rx_seq = payload->seq;
+		    (tsn_pkt->vlan_prio / 32) < 8 &&
+		    tsn_payload_parse(payload_ptr, len - 18, &payload) == TSN_PAYLOAD_OK) {
+
+			TSN_PROBE3(rx_timestamp, payload.seq,
+				   *(uint64_t *)(pkt - sizeof(uint64_t)),
+				   rx_timestampD);
+
+			/* Result format: see afpkt_recv_pkt() */
+			if (!opt->quiet)
+				fprintf(stdout, "%lu\t%lu\t%u\t%lu\t%lu\t%lu\t%u\t%lu\t%lu\n",
+						rx_timestampD - payload.tx_timestampA,
+						payload.seq,
+						payload.tx_queue,
+						payload.tx_timestampA,
+						*(uint64_t *)(pkt - sizeof(uint64_t)),
+						rx_timestampD,
+						payload.stream_id,
+						payload.launch_time,
+						payload.prev_hw_txtime);
+			glob_rx_seq = payload.seq;
+
+			if (opt->summary)
+				summary_update(opt->summary, payload.seq,
+					       rx_timestampD - payload.tx_timestampA,
+					       rx_timestampD);
+
+			metrics_rx(metrics_rx_block(opt->mx_rx, opt->mx_rx_other,
+								    payload.stream_id),
+				   payload.seq, rx_timestampD - payload.tx_timestampA);
+
+			flightrec_rx(opt->frec, payload.seq, payload.tx_timestampA,
+				     payload.launch_time, payload.prev_hw_txtime,
+				     *(uint64_t *)(pkt - sizeof(uint64_t)),
+				     rx_timestampD,
+				     xsk->rx_ring.cached_prod - xsk->rx_ring.cached_cons,
+				     payload.tx_queue);
+
+			if (opt->telem)
+				telemetry_update(opt->telem, payload.seq,
+						 rx_timestampD - payload.tx_timestampA,
+						 rx_timestampD);
+
+			if (opt->pcap) {
+				uint64_t rx_hwtime = *(uint64_t *)(pkt - sizeof(uint64_t));
+
+				pcapng_record(opt->pcap, pkt, len,
+					      rx_hwtime ? rx_hwtime : rx_timestampD,
+					      opt->socket_prio,
+					      payload.tx_timestampA,
+					      rx_timestampD - payload.tx_timestampA);
+			}
 		} else if (verbose) {
 			fprintf(stderr, "Info: packet received type: 0x%x\n",
 				tsn_pkt->eth_hdr);
@@ -460,3 +545,19 @@ void afxdp_recv_pkt(struct xsk_info *xsk, void *rbuff)
 	//TODO:implement for all threads incl afpkt?
 	sched_yield();
 }
+
+/* Loopback mode RX thread: same as -r but started by run_loopback() */
+void *afxdp_recv_thread(void *arg)
+{
+	struct user_opt *opt = (struct user_opt *)arg;
+	char buff[opt->packet_size];
+
+	rx_start(opt);
+	while (!halt_tx_sig) {
+		afxdp_recv_pkt(opt, buff);
+		if (rx_done(opt))
+			break;
+	}
+
+	return NULL;
+}
@@ -35,6 +35,7 @@
 #include "txrx.h"
 
 extern struct xsk_info *glob_xskinfo_ptr;
+extern struct xsk_info *glob_xskinfo_peer_ptr;
 extern uint32_t glob_xdp_flags;
 extern int glob_ifindex;
 extern int halt_tx_sig;
@@ -45,6 +46,7 @@ void afxdp_sigint_handler(int sig);
 void __afxdp_exit_with_error(int error, const char *file, const char *func, int line);
 void init_xdp_socket(struct user_opt *opt);
 void *afxdp_send_thread(void *arg);
-void afxdp_recv_pkt(struct xsk_info *xsk, void *rbuff);
+void afxdp_recv_pkt(struct user_opt *opt, void *rbuff);
+void *afxdp_recv_thread(void *arg);
 
 #define afxdp_exit_with_error(error) __afxdp_exit_with_error(error, __FILE__, __func__, __LINE__)
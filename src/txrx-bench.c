@@ -0,0 +1,366 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "txrx-afpkt.h"
+#ifdef WITH_XDP
+#include "txrx-afxdp.h"
+#endif
+
+/* Microbenchmarks of the txrx-tsn software paths, run by `make bench`.
+ * Each benchmark is repeated BENCH_REPEATS times; the fastest and median
+ * ns/op are reported as one JSON object per line.
+ */
+
+#define BENCH_REPEATS		5
+#define BENCH_DEFAULT_ITERS	1000000
+#define BENCH_RING_SIZE		4096
+#define BENCH_BATCH		64
+
+struct bench_opt {
+	uint64_t iterations;
+	char *filter;
+};
+
+struct bench {
+	const char *name;
+	void (*setup)(void);
+	void (*run)(uint64_t iterations);
+};
+
+/* Keeps results alive without a store per iteration being optimized out */
+static volatile uint64_t sink;
+
+static struct user_opt bench_user_opt;
+static tsn_packet *bench_pkt;
+static struct custom_payload bench_payload;
+static struct tsc_clock bench_tsc;
+static int bench_tsc_ok;
+static FILE *bench_log;
+
+static struct {
+	struct cmsghdr cm;
+	char control[512];
+} bench_control;
+static struct msghdr bench_msg;
+
+static void setup_packet(void)
+{
+	memset(&bench_user_opt, 0, sizeof(bench_user_opt));
+	bench_user_opt.packet_size = 64;
+	bench_user_opt.clkid = CLOCK_REALTIME;
+	if (!bench_pkt)
+		bench_pkt = malloc(1500);
+	if (!bench_pkt)
+		exit_with_error("Out of memory");
+	tsn_payload_init(&bench_user_opt, &bench_payload);
+}
+
+static void run_setup_packet(uint64_t n)
+{
+	uint64_t i;
+
+	for (i = 0; i < n; i++)
+		setup_tsn_vlan_packet(&bench_user_opt, bench_pkt);
+	sink = bench_pkt->vlan_prio;
+}
+
+/* Per-packet fields + CRC32C seal, as done by every send thread */
+static void run_payload_stamp(uint64_t n)
+{
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		bench_payload.seq = i;
+		bench_payload.tx_timestampA = i * 1000;
+		bench_payload.prev_hw_txtime = i * 999;
+		tsn_payload_seal(&bench_payload);
+	}
+	sink = bench_payload.crc;
+}
+
+static void run_payload_parse(uint64_t n)
+{
+	struct custom_payload pl;
+	uint64_t i, ok = 0;
+
+	tsn_payload_seal(&bench_payload);
+	for (i = 0; i < n; i++)
+		ok += tsn_payload_parse(&bench_payload, sizeof(bench_payload), &pl) == TSN_PAYLOAD_OK;
+	sink = ok;
+}
+
+static void run_clock_realtime(uint64_t n)
+{
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += get_time_nanosec(CLOCK_REALTIME);
+	sink = sum;
+}
+
+static void run_clock_tai(uint64_t n)
+{
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += get_time_nanosec(CLOCK_TAI);
+	sink = sum;
+}
+
+static void setup_tsc(void)
+{
+	bench_tsc_ok = !tsc_clock_init(&bench_tsc, CLOCK_REALTIME);
+}
+
+static void run_tsc_clock(uint64_t n)
+{
+	uint64_t i, sum = 0;
+
+	if (!bench_tsc_ok)
+		return;
+	for (i = 0; i < n; i++)
+		sum += tsc_clock_now(&bench_tsc);
+	sink = sum;
+}
+
+/* SO_TIMESTAMPING cmsg as delivered on RX and on the TX error queue */
+static void setup_cmsg(void)
+{
+	struct timespec *ts;
+	struct cmsghdr *cmsg;
+
+	memset(&bench_msg, 0, sizeof(bench_msg));
+	bench_msg.msg_control = &bench_control;
+	bench_msg.msg_controllen = CMSG_SPACE(3 * sizeof(struct timespec));
+
+	cmsg = CMSG_FIRSTHDR(&bench_msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SO_TIMESTAMPING;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(struct timespec));
+
+	ts = (struct timespec *)CMSG_DATA(cmsg);
+	memset(ts, 0, 3 * sizeof(*ts));
+	ts[2].tv_sec = 1600000000;
+	ts[2].tv_nsec = 123456789;
+}
+
+static void run_cmsg_timestamp(uint64_t n)
+{
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += get_timestamp(&bench_msg);
+	sink = sum;
+}
+
+/* Per-packet RX result line, formatted and flushed like afpkt_recv_pkt() */
+static void setup_log(void)
+{
+	if (!bench_log)
+		bench_log = fopen("/dev/null", "w");
+	if (!bench_log)
+		exit_with_error("Cannot open /dev/null");
+}
+
+static void run_result_log(uint64_t n)
+{
+	uint64_t i;
+
+	for (i = 0; i < n; i++) {
+		fprintf(bench_log, "%ld\t%lu\t%u\t%lu\t%lu\t%lu\t%u\t%lu\t%lu\n",
+			(int64_t)12345, i, 1, i * 1000, i * 1000 + 500,
+			i * 1000 + 12345, 0, (uint64_t)0, i * 999);
+		fflush(bench_log);
+	}
+}
+
+#ifdef WITH_XDP
+/* UMEM fill/completion ring handling without a socket: the "kernel" side
+ * is emulated by moving the shared producer/consumer indices directly.
+ */
+static struct xsk_ring_prod bench_fq;
+static struct xsk_ring_cons bench_cq;
+static uint32_t fq_prod, fq_cons, cq_prod, cq_cons;
+static uint64_t fq_ring[BENCH_RING_SIZE], cq_ring[BENCH_RING_SIZE];
+
+static void setup_umem_rings(void)
+{
+	memset(&bench_fq, 0, sizeof(bench_fq));
+	memset(&bench_cq, 0, sizeof(bench_cq));
+	fq_prod = fq_cons = cq_prod = cq_cons = 0;
+
+	bench_fq.mask = BENCH_RING_SIZE - 1;
+	bench_fq.size = BENCH_RING_SIZE;
+	bench_fq.cached_cons = BENCH_RING_SIZE;
+	bench_fq.producer = &fq_prod;
+	bench_fq.consumer = &fq_cons;
+	bench_fq.ring = fq_ring;
+
+	bench_cq.mask = BENCH_RING_SIZE - 1;
+	bench_cq.size = BENCH_RING_SIZE;
+	bench_cq.producer = &cq_prod;
+	bench_cq.consumer = &cq_cons;
+	bench_cq.ring = cq_ring;
+}
+
+static void run_umem_fill_complete(uint64_t n)
+{
+	uint32_t idx, got, j;
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < n; i += BENCH_BATCH) {
+		/* App: refill the fill ring */
+		while (xsk_ring_prod__reserve(&bench_fq, BENCH_BATCH, &idx) != BENCH_BATCH)
+			;
+		for (j = 0; j < BENCH_BATCH; j++)
+			*xsk_ring_prod__fill_addr(&bench_fq, idx + j) = (uint64_t)j << 12;
+		xsk_ring_prod__submit(&bench_fq, BENCH_BATCH);
+
+		/* Kernel: consume fills, complete as many tx frames */
+		__atomic_store_n(&fq_cons, fq_cons + BENCH_BATCH, __ATOMIC_RELEASE);
+		for (j = 0; j < BENCH_BATCH; j++)
+			cq_ring[(cq_prod + j) & (BENCH_RING_SIZE - 1)] = (uint64_t)j << 12;
+		__atomic_store_n(&cq_prod, cq_prod + BENCH_BATCH, __ATOMIC_RELEASE);
+
+		/* App: reap completions */
+		got = xsk_ring_cons__peek(&bench_cq, BENCH_BATCH, &idx);
+		for (j = 0; j < got; j++)
+			sum += *xsk_ring_cons__comp_addr(&bench_cq, idx + j);
+		xsk_ring_cons__release(&bench_cq, got);
+	}
+	sink = sum;
+}
+#endif
+
+static struct bench benches[] = {
+	{ "setup_tsn_vlan_packet",	setup_packet,	run_setup_packet },
+	{ "payload_stamp_seal",		setup_packet,	run_payload_stamp },
+	{ "payload_parse",		setup_packet,	run_payload_parse },
+	{ "clock_gettime_realtime",	NULL,		run_clock_realtime },
+	{ "clock_gettime_tai",		NULL,		run_clock_tai },
+	{ "tsc_clock_now",		setup_tsc,	run_tsc_clock },
+	{ "cmsg_timestamp_extract",	setup_cmsg,	run_cmsg_timestamp },
+	{ "result_log_line",		setup_log,	run_result_log },
+#ifdef WITH_XDP
+	{ "umem_fill_complete",		setup_umem_rings, run_umem_fill_complete },
+#endif
+};
+
+static struct argp_option options[] = {
+	{"iterations",	'i', "NUM",	0, "iterations per repeat\n"
+					   "	Def: 1000000 | Min: 1000"},
+	{"filter",	'f', "NAME",	0, "only run benchmarks whose name contains NAME"},
+	{ 0 }
+};
+
+static error_t parser(int key, char *arg, struct argp_state *state)
+{
+	struct bench_opt *opt = state->input;
+	char *str_end = NULL;
+	long long res;
+
+	switch (key) {
+	case 'i':
+		errno = 0;
+		res = strtoll(arg, &str_end, 10);
+		if (errno || res < 1000 || *str_end)
+			exit_with_error("Invalid iterations. Check --help");
+		opt->iterations = (uint64_t)res;
+		break;
+	case 'f':
+		opt->filter = arg;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static char summary[] = "  txrx-tsn software path microbenchmarks (JSON lines output)";
+
+static struct argp argp = { options, parser, NULL, summary };
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+	double ns_per_op[BENCH_REPEATS];
+	struct bench_opt opt;
+	struct timespec t0, t1;
+	unsigned int b;
+	int r;
+
+	opt.iterations = BENCH_DEFAULT_ITERS;
+	opt.filter = NULL;
+	argp_parse(&argp, argc, argv, 0, 0, &opt);
+
+	for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		if (opt.filter && !strstr(benches[b].name, opt.filter))
+			continue;
+		if (benches[b].setup)
+			benches[b].setup();
+		if (!strcmp(benches[b].name, "tsc_clock_now") && !bench_tsc_ok)
+			continue;
+
+		benches[b].run(opt.iterations / 10);	//Warm up
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			benches[b].run(opt.iterations);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			ns_per_op[r] = ((t1.tv_sec - t0.tv_sec) * 1e9 +
+					(t1.tv_nsec - t0.tv_nsec)) / opt.iterations;
+		}
+		qsort(ns_per_op, BENCH_REPEATS, sizeof(double), cmp_double);
+
+		printf("{\"bench\":\"%s\",\"iterations\":%lu,\"repeats\":%d,"
+		       "\"ns_per_op_min\":%.2f,\"ns_per_op_median\":%.2f}\n",
+		       benches[b].name, opt.iterations, BENCH_REPEATS,
+		       ns_per_op[0], ns_per_op[BENCH_REPEATS / 2]);
+		fflush(stdout);
+	}
+
+	return 0;
+}
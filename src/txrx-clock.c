@@ -0,0 +1,368 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timex.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "txrx.h"
+#include "phc-source.h"
+#ifdef HAVE_TSC_CLOCK
+#include <cpuid.h>
+#endif
+
+#define SELFCHECK_READS		1000000
+#define SELFCHECK_SAMPLE_NS	(10 * 1000 * 1000)
+
+/* Resolve a clock domain name: "realtime", "tai" or a PHC device path such
+ * as /dev/ptp0. The PHC fd is kept open for the lifetime of the process.
+ */
+clockid_t clock_domain_open(const char *name)
+{
+	int fd;
+
+	if (!strcmp(name, "realtime"))
+		return CLOCK_REALTIME;
+	if (!strcmp(name, "tai"))
+		return CLOCK_TAI;
+
+	fd = open(name, O_RDWR);
+	if (fd < 0)
+		return CLOCK_INVALID;
+
+	return FD_TO_CLOCKID(fd);
+}
+
+/* Offset to add to a time in clkid's domain to get CLOCK_TAI. SO_TXTIME and
+ * the ETF qdisc always work in CLOCK_TAI.
+ */
+int64_t clock_domain_tai_offset(clockid_t clkid)
+{
+	struct timex tx = { 0 };
+	uint64_t tai0, tai1, phc;
+
+	switch (clkid) {
+	case CLOCK_TAI:
+		return 0;
+	case CLOCK_REALTIME:
+		if (adjtimex(&tx) < 0)
+			return 0;
+		return (int64_t)tx.tai * NSEC_PER_SEC;
+	default:
+		tai0 = get_time_nanosec(CLOCK_TAI);
+		phc = get_time_nanosec(clkid);
+		tai1 = get_time_nanosec(CLOCK_TAI);
+		return (int64_t)(tai0 + (tai1 - tai0) / 2 - phc);
+	}
+}
+
+/* clock_nanosleep() does not accept dynamic (PHC) clocks, so translate the
+ * wake-up time into CLOCK_TAI using a fresh PHC offset. The offset is
+ * returned so the caller's txtime stays in step with the sleep.
+ */
+int clock_domain_nanosleep(clockid_t clkid, const struct timespec *ts,
+			   int64_t *tai_offset_ns)
+{
+	struct timespec tai_ts;
+	uint64_t wake;
+
+	if (clkid == CLOCK_REALTIME || clkid == CLOCK_TAI)
+		return clock_nanosleep(clkid, TIMER_ABSTIME, ts, NULL);
+
+	*tai_offset_ns = clock_domain_tai_offset(clkid);
+	wake = ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec + *tai_offset_ns;
+	tai_ts.tv_sec = wake / NSEC_PER_SEC;
+	tai_ts.tv_nsec = wake % NSEC_PER_SEC;
+
+	return clock_nanosleep(CLOCK_TAI, TIMER_ABSTIME, &tai_ts, NULL);
+}
+
+/* Print the offset between a PHC and CLOCK_REALTIME to stderr. The PHC is
+ * spec (a phc_source device string such as /dev/ptp1 or mock:offset=N), or
+ * the interface's own when spec is NULL. Cross-timestamping
+ * (PTP_SYS_OFFSET_PRECISE) is used where the driver has it, otherwise the
+ * offset of the lowest-delay PTP_SYS_OFFSET_EXTENDED (or, on older drivers,
+ * PTP_SYS_OFFSET) sample is reported together with the spread of the
+ * host-to-NIC read delay.
+ */
+void phc_sys_offset_report(const char *ifname, const char *spec,
+			   const char *tag)
+{
+	struct ethtool_ts_info info = { .cmd = ETHTOOL_GET_TS_INFO };
+	struct phc_source *src;
+	struct ifreq ifr = { 0 };
+	struct phc_offset po;
+	char dev[32];
+	int sock;
+
+	if (!spec) {
+		sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock < 0)
+			return;
+
+		strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+		ifr.ifr_data = (void *)&info;
+		if (ioctl(sock, SIOCETHTOOL, &ifr) < 0 || info.phc_index < 0) {
+			fprintf(stderr, "PHC offset %s: %s has no PHC\n", tag, ifname);
+			close(sock);
+			return;
+		}
+		close(sock);
+
+		snprintf(dev, sizeof(dev), "/dev/ptp%d", info.phc_index);
+		spec = dev;
+	}
+
+	src = phc_source_open(spec, NSEC_PER_SEC);
+	if (!src) {
+		fprintf(stderr, "PHC offset %s: open %s: %s\n", tag, spec,
+			strerror(errno));
+		return;
+	}
+
+	src->method = PHC_SYSOFF_PRECISE;
+	src->samples = PHC_SYSOFF_SAMPLES;
+	if (phc_source_read_offset(src, &po)) {
+		fprintf(stderr, "PHC offset %s: %s: %s\n", tag, spec,
+			strerror(errno));
+		phc_source_close(src);
+		return;
+	}
+	phc_source_close(src);
+
+	if (po.method == PHC_SYSOFF_PRECISE) {
+		fprintf(stderr, "PHC offset %s: %s precise phc-sys %lld ns\n",
+			tag, spec, po.offset);
+		return;
+	}
+
+	fprintf(stderr, "PHC offset %s: %s %s phc-sys %lld ns "
+		"(range %lld..%lld) delay %lld..%lld ns over %u samples\n",
+		tag, spec, po.method == PHC_SYSOFF_BASIC ? "basic" : "extended",
+		po.offset, po.min, po.max, po.delay, po.delay_max, po.samples);
+}
+
+/* Sample clock_gettime() bracketed by two TSC reads and keep the midpoint of
+ * the tightest bracket, so a preemption during the sample is not mistaken
+ * for an offset.
+ */
+static void tsc_sample(clockid_t clkid, uint64_t *tsc, uint64_t *ns)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t t0, t1, now;
+	int i;
+
+	*tsc = *ns = 0;
+
+	for (i = 0; i < 5; i++) {
+		t0 = tsc_read();
+		now = get_time_nanosec(clkid);
+		t1 = tsc_read();
+
+		if (t1 - t0 < best) {
+			best = t1 - t0;
+			*tsc = t0 + (t1 - t0) / 2;
+			*ns = now;
+		}
+	}
+}
+
+static uint64_t tsc_calc_mult(uint64_t dns, uint64_t dtsc)
+{
+	return (uint64_t)(((unsigned __int128)dns << 32) / dtsc);
+}
+
+int tsc_clock_init(struct tsc_clock *tc, clockid_t clkid)
+{
+#ifdef HAVE_TSC_CLOCK
+	struct timespec delay = { 0, TSC_CALIBRATE_NS };
+	unsigned int eax, ebx, ecx, edx;
+	uint64_t tsc, ns;
+
+	/* CPUID.80000007H:EDX[8]: TSC ticks at a constant rate in all states */
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+		return -1;
+
+	memset(tc, 0, sizeof(*tc));
+	tc->clkid = clkid;
+
+	tsc_sample(clkid, &tc->calib_tsc, &tc->calib_ns);
+	nanosleep(&delay, NULL);
+	tsc_sample(clkid, &tsc, &ns);
+
+	if (tsc <= tc->calib_tsc || ns <= tc->calib_ns)
+		return -1;
+
+	tc->mult = tsc_calc_mult(ns - tc->calib_ns, tsc - tc->calib_tsc);
+	tc->anchor_period = (uint64_t)(((unsigned __int128)TSC_REANCHOR_NS << 32) / tc->mult);
+	tc->tsc_base = tsc;
+	tc->ns_base = ns;
+	tc->next_anchor = tsc + tc->anchor_period;
+
+	return 0;
+#else
+	(void) tc;
+	(void) clkid;
+	return -1;
+#endif
+}
+
+/* Called by the first reader past next_anchor. Others keep spinning on the
+ * seqlock for the few hundred nanoseconds this takes.
+ */
+void tsc_clock_anchor(struct tsc_clock *tc)
+{
+	uint32_t seq = __atomic_load_n(&tc->seq, __ATOMIC_RELAXED);
+	uint64_t tsc, ns;
+
+	if ((seq & 1) || !__atomic_compare_exchange_n(&tc->seq, &seq, seq + 1, 0,
+						       __ATOMIC_ACQUIRE,
+						       __ATOMIC_RELAXED))
+		return;
+
+	tsc_sample(tc->clkid, &tsc, &ns);
+
+	/* Refine the frequency over the whole baseline since calibration */
+	if (tsc > tc->calib_tsc && ns > tc->calib_ns)
+		tc->mult = tsc_calc_mult(ns - tc->calib_ns, tsc - tc->calib_tsc);
+
+	tc->tsc_base = tsc;
+	tc->ns_base = ns;
+	tc->next_anchor = tsc + tc->anchor_period;
+
+	__atomic_store_n(&tc->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+struct read_cost {
+	double avg;
+	double stddev;
+	uint64_t max;
+};
+
+/* Time each read individually in TSC cycles to get the cost distribution */
+static void measure_read_cost(struct tsc_clock *tc, int use_tsc,
+			      struct read_cost *cost)
+{
+	double sum = 0, sumsq = 0, ns;
+	volatile uint64_t sink;
+	uint64_t t0, t1;
+	int i;
+
+	cost->max = 0;
+	for (i = 0; i < SELFCHECK_READS; i++) {
+		t0 = tsc_read();
+		if (use_tsc)
+			sink = tsc_clock_now(tc);
+		else
+			sink = get_time_nanosec(tc->clkid);
+		t1 = tsc_read();
+
+		ns = (double)(((unsigned __int128)(t1 - t0) * tc->mult) >> 32);
+		sum += ns;
+		sumsq += ns * ns;
+		if (ns > cost->max)
+			cost->max = ns;
+	}
+	(void) sink;
+
+	cost->avg = sum / SELFCHECK_READS;
+	cost->stddev = sqrt(sumsq / SELFCHECK_READS - cost->avg * cost->avg);
+}
+
+/* Compare the TSC clock against clock_gettime() for a number of seconds and
+ * report the per-read cost of both and the drift between them.
+ */
+void tsc_clock_selfcheck(clockid_t clkid, uint32_t seconds)
+{
+	struct timespec delay = { 0, SELFCHECK_SAMPLE_NS };
+	struct read_cost tsc_cost, sys_cost;
+	int64_t drift, dmin, dmax;
+	uint64_t ref, t0, t1;
+	struct tsc_clock tc;
+	double dsum, dsumsq;
+	uint32_t sec, n, i;
+
+	if (tsc_clock_init(&tc, clkid))
+		exit_with_error("Invariant TSC is not available on this CPU");
+
+	fprintf(stdout, "TSC frequency: %.3f MHz\n",
+		(double)(1ULL << 32) * 1000.0 / tc.mult);
+
+	measure_read_cost(&tc, 1, &tsc_cost);
+	measure_read_cost(&tc, 0, &sys_cost);
+
+	fprintf(stdout, "Read cost\tAvg(ns)\tStddev(ns)\tMax(ns)\n");
+	fprintf(stdout, "tsc\t%.1f\t%.1f\t%lu\n",
+		tsc_cost.avg, tsc_cost.stddev, tsc_cost.max);
+	fprintf(stdout, "clock_gettime\t%.1f\t%.1f\t%lu\n",
+		sys_cost.avg, sys_cost.stddev, sys_cost.max);
+
+	/* Drift: tsc - clock_gettime, reference bracketed by two TSC reads */
+	fprintf(stdout, "Drift\tAvg(ns)\tStddev(ns)\tMin(ns)\tMax(ns)\n");
+	for (sec = 0; sec < seconds; sec++) {
+		n = NSEC_PER_SEC / SELFCHECK_SAMPLE_NS;
+		dsum = dsumsq = 0;
+		dmin = INT64_MAX;
+		dmax = INT64_MIN;
+
+		for (i = 0; i < n; i++) {
+			nanosleep(&delay, NULL);
+			t0 = tsc_clock_now(&tc);
+			ref = get_time_nanosec(clkid);
+			t1 = tsc_clock_now(&tc);
+
+			drift = (int64_t)(t0 + (t1 - t0) / 2 - ref);
+			dsum += drift;
+			dsumsq += (double)drift * drift;
+			if (drift < dmin)
+				dmin = drift;
+			if (drift > dmax)
+				dmax = drift;
+		}
+
+		fprintf(stdout, "%u\t%.1f\t%.1f\t%ld\t%ld\n", sec,
+			dsum / n, sqrt(dsumsq / n - (dsum / n) * (dsum / n)),
+			dmin, dmax);
+		fflush(stdout);
+	}
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2020, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ *  3. Neither the name of the copyright holder nor the names of its
+ *     contributors may be used to endorse or promote products derived from
+ *     this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****************************************************************************/
+#ifndef TXRX_CLOCK_HEADER
+#define TXRX_CLOCK_HEADER
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC_CLOCK 1
+#endif
+
+/* Dynamic POSIX clock of a PHC character device */
+#define CLOCKFD			3
+#define FD_TO_CLOCKID(fd)	((clockid_t) ((((unsigned int) ~(fd)) << 3) | CLOCKFD))
+#define CLOCK_INVALID		((clockid_t) -1)
+
+/* Re-anchor the TSC clock against clock_gettime() once per second */
+#define TSC_REANCHOR_NS		NSEC_PER_SEC
+/* Duration of the initial frequency calibration */
+#define TSC_CALIBRATE_NS	(100 * 1000 * 1000)
+
+/* Calibrated invariant-TSC clock.
+ *
+ * Readers convert rdtsc into the anchored clock domain using a 32.32
+ * fixed-point ns-per-cycle multiplier. Once per TSC_REANCHOR_NS the first
+ * reader past the deadline re-anchors the clock against clock_gettime() and
+ * refines the multiplier over the whole run's baseline. The seqlock lets
+ * several threads share one clock without taking a lock in the hot path.
+ */
+struct tsc_clock {
+	clockid_t clkid;	//Clock domain the TSC is anchored to
+	uint32_t seq;		//Seqlock, odd while re-anchoring
+
+	uint64_t tsc_base;	//Last anchor point
+	uint64_t ns_base;
+	uint64_t mult;		//ns per cycle, 32.32 fixed point
+	uint64_t next_anchor;	//TSC value at which to re-anchor
+	uint64_t anchor_period;	//TSC cycles between anchors
+
+	uint64_t calib_tsc;	//First anchor, used to refine mult
+	uint64_t calib_ns;
+};
+
+clockid_t clock_domain_open(const char *name);
+int64_t clock_domain_tai_offset(clockid_t clkid);
+int clock_domain_nanosleep(clockid_t clkid, const struct timespec *ts,
+			   int64_t *tai_offset_ns);
+void phc_sys_offset_report(const char *ifname, const char *spec,
+			   const char *tag);
+
+int tsc_clock_init(struct tsc_clock *tc, clockid_t clkid);
+void tsc_clock_anchor(struct tsc_clock *tc);
+void tsc_clock_selfcheck(clockid_t clkid, uint32_t seconds);
+
+#ifdef HAVE_TSC_CLOCK
+static inline uint64_t tsc_read(void)
+{
+	return __rdtsc();
+}
+#else
+static inline uint64_t tsc_read(void)
+{
+	return 0;
+}
+#endif
+
+static inline uint64_t tsc_clock_now(struct tsc_clock *tc)
+{
+	uint64_t tsc, ns;
+	uint32_t seq;
+	int64_t delta;
+
+	while (1) {
+		seq = __atomic_load_n(&tc->seq, __ATOMIC_ACQUIRE);
+		tsc = tsc_read();
+
+		if (tsc >= tc->next_anchor && !(seq & 1)) {
+			tsc_clock_anchor(tc);
+			continue;
+		}
+
+		delta = (int64_t)(tsc - tc->tsc_base);
+		ns = tc->ns_base + (int64_t)(((__int128)delta * tc->mult) >> 32);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!(seq & 1) && seq == __atomic_load_n(&tc->seq, __ATOMIC_RELAXED))
+			return ns;
+	}
+}
+
+#endif
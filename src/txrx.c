@@ -42,6 +42,7 @@
 #include <pthread.h>
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include "txrx-afpkt.h"
 #ifdef WITH_XDP
@@ -50,6 +51,7 @@
 
 #define VLAN_ID 3
 #define DEFAULT_NUM_FRAMES 1000
+#define DEFAULT_SUMMARY_WINDOW 60
 #define DEFAULT_TX_PERIOD 100000
 #define DEFAULT_PACKETS 10
 #define DEFAULT_SOCKET_PRIORITY 0
@@ -67,11 +69,13 @@ unsigned char dst_mac_addr[] = { 0x22, 0xbb, 0x22, 0xbb, 0x22, 0xbb};
 unsigned char src_ip_addr[] = { 169, 254, 1, 11};
 unsigned char dst_ip_addr[] = { 169, 254, 1, 22};
 struct xsk_info *glob_xskinfo_ptr;
+struct xsk_info *glob_xskinfo_peer_ptr;
 uint32_t glob_xdp_flags;
 int glob_ifindex;
 int halt_tx_sig;
 int verbose;
-uint32_t glob_rx_seq;
+uint64_t glob_rx_seq;
+struct tsc_clock glob_tsc;
 
 uint64_t get_time_nanosec(clockid_t clkid)
 {
@@ -111,6 +115,104 @@ void setup_tsn_vlan_packet(struct user_opt *opt, tsn_packet *pkt)
 	pkt->eth_hdr = htons(0xb62c);
 }
 
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	int k;
+
+	while (len--) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+	}
+	return crc;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t crc64 = crc;
+	uint64_t word;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&word, p, sizeof(word));
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	return crc;
+}
+#endif
+
+static uint32_t crc32c(const void *buf, size_t len)
+{
+#ifdef __x86_64__
+	if (__builtin_cpu_supports("sse4.2"))
+		return ~crc32c_hw(~0U, buf, len);
+#endif
+	return ~crc32c_sw(~0U, buf, len);
+}
+
+/* Fill the per-run constant payload fields */
+void tsn_payload_init(struct user_opt *opt, struct custom_payload *pl)
+{
+	memset(pl, 0, sizeof(*pl));
+	pl->magic = TSN_PAYLOAD_MAGIC;
+	pl->version = TSN_PAYLOAD_VERSION;
+	pl->stream_id = opt->stream_id;
+	pl->tx_queue = (uint16_t)opt->socket_prio;
+}
+
+/* Call after updating the per-packet fields, right before sending */
+void tsn_payload_seal(struct custom_payload *pl)
+{
+	pl->crc = crc32c(pl, offsetof(struct custom_payload, crc));
+}
+
+/* Copy the payload out of a received frame and validate it in one go */
+int tsn_payload_parse(const void *buf, size_t len, struct custom_payload *pl)
+{
+	if (len < sizeof(*pl))
+		return TSN_PAYLOAD_ESHORT;
+
+	memcpy(pl, buf, sizeof(*pl));
+
+	if (pl->magic != TSN_PAYLOAD_MAGIC || pl->version != TSN_PAYLOAD_VERSION)
+		return TSN_PAYLOAD_EMAGIC;
+	if (pl->crc != crc32c(pl, offsetof(struct custom_payload, crc)))
+		return TSN_PAYLOAD_ECRC;
+	if (pl->tx_queue > 8)
+		return TSN_PAYLOAD_EFIELD;
+
+	return TSN_PAYLOAD_OK;
+}
+
+void tsn_reflect_seal(struct reflect_ext *ext)
+{
+	ext->crc = crc32c(ext, offsetof(struct reflect_ext, crc));
+}
+
+int tsn_reflect_parse(const void *buf, size_t len, struct reflect_ext *ext)
+{
+	if (len < sizeof(*ext))
+		return TSN_PAYLOAD_ESHORT;
+
+	memcpy(ext, buf, sizeof(*ext));
+
+	if (ext->crc != crc32c(ext, offsetof(struct reflect_ext, crc)))
+		return TSN_PAYLOAD_ECRC;
+
+	return TSN_PAYLOAD_OK;
+}
+
+/* Everything below is main() and its helpers. txrx-bench links the same
+ * objects with its own main(), so it builds without them.
+ */
+#ifndef TXRX_BENCH
+
 /* Argparse */
 static struct argp_option options[] = {
 	{"interface",	'i',	"NAME",	0, "interface name"},
@@ -122,6 +224,11 @@ static struct argp_option options[] = {
 	{0,0,0,0, "Mode:" },
 	{"transmit",	't',	0,	0, "transmit only"},
 	{"receive",	'r',	0,	0, "receive only"},
+	{"reflect",	'R',	0,	0, "send received packets back to their sender on -q\n"
+					   "	with reflector rx/tx timestamps appended (AF_PACKET)"},
+	{"round-trip",	'B',	0,	0, "transmit and receive reflected packets, print RTT (AF_PACKET)"},
+	{"loopback",	'L',	"PEER",	0, "transmit on -i and receive on PEER (e.g. veth pair)\n"
+					   "	in one process, threads pinned to the last 2 CPUs"},
 
 	{0,0,0,0, "XDP Mode:" },
 	{"zero-copy",	'z',	0,	0, "zero-copy mode"},
@@ -142,9 +249,13 @@ static struct argp_option options[] = {
 	{"cycle-time",	'y',	"NSEC",	0, "tx period/interval/cycle-time\n"
 					   "	Def: 100000ns | Min: 25000ns | Max: 50000000ns"},
 	{"frames-to-send", 'n', "NUM",	0, "number of packets to transmit\n"
-					   "	Def: 1000 | Min: 1 | Max: 10000000"},
+					   "	Def: 1000 | Min: 1 | Max: 1000000000000"},
+	{"duration",	'D',	"SEC",	0, "soak mode: run for SEC seconds, not with -n\n"
+					   "	Min: 0 (until SIGINT) | Max: 31536000"},
 	{"dst-mac-addr",   'd', "MAC_ADDR",	0, "destination mac address\n"
 						   "	Def: 22:bb:22:bb:22:bb"},
+	{"stream-id",	'S',	"NUM",	0, "stream ID carried in every packet\n"
+					   "	Def: 0 | Min: 0 | Max: 65535"},
 
 	{0,0,0,0, "LaunchTime/TBS-specific:\n(where base is the 0th ns of current second)" },
 	{"transmit-offset",'o', "NSEC",	0, "packet txtime positive offset\n"
@@ -153,7 +264,27 @@ static struct argp_option options[] = {
 					   "	Def: 100000ns | Min: 0ns | Max: 10000000ns"},
 
 	{0,0,0,0, "Misc:" },
+	{"clock",	'C',	"CLOCK",	0, "clock domain for sleep, timestamps and txtime\n"
+					   "	Def: realtime | Opt: realtime, tai, /dev/ptpN"},
+	{"phc",		'H',	"DEV",	0, "PHC for the start/end PHC offset report\n"
+					   "	Def: -i's PHC | Opt: /dev/ptpN, mock[:key=val,..]"},
 	{"hw-timestamps",	'h',	0,	0, "retrieve per-packet hardware timestamps (AF_PACKET)"},
+	{"tsc-clock",	'k',	0,	0, "use calibrated invariant TSC for user timestamps"},
+	{"tsc-check",	'K',	"SEC",	0, "report TSC clock drift and read cost vs clock_gettime, then exit\n"
+					   "	Min: 1 | Max: 3600"},
+	{"summary",	'F',	"FILE",	0, "write per-window latency histogram and loss summary to FILE"},
+	{"window",	'N',	"SEC",	0, "summary window\n"
+					   "	Def: 60 | Min: 1 | Max: 86400"},
+	{"quiet",	'Q',	0,	0, "do not print per-packet results (use with -F)"},
+	{"flight-recorder", 'G', "FILE", 0, "keep the last per-packet records and dump a window\n"
+					   "	around latency spikes, gaps and TX deadline misses to FILE"},
+	{"trigger",	'g',	"NSEC",	0, "flight recorder u2u latency trigger\n"
+					   "	Def: cycle-time | Min: 1ns | Max: 1000000000ns"},
+	{"pcapng",	'W',	"FILE",	0, "write received frames to a pcapng file with hw rx\n"
+					   "	timestamps, queue, app txtime and latency"},
+	{"metrics",	'U',	"PATH",	0, "serve Prometheus/JSON counters on unix socket PATH"},
+	{"telemetry",	'M',	"NAME",	0, "publish live latency telemetry in /dev/shm/NAME\n"
+					   "	(read with tsn-telemetry)"},
 	{"verbose",	'v',	0,	0, "verbose & print warnings"},
 	{ 0 }
 };
@@ -176,6 +307,35 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 	case 'h':
 		opt->enable_hwts = 1;
 		break;
+	case 'C':
+		opt->clkid = clock_domain_open(arg);
+		if (opt->clkid == CLOCK_INVALID)
+			exit_with_error("Invalid clock domain. Check --help");
+		break;
+	case 'H':
+		opt->phc_spec = arg;
+		break;
+	case 'U':
+		opt->metrics_path = arg;
+		break;
+	case 'M':
+		opt->telem = telemetry_create(arg);
+		if (!opt->telem)
+			exit_with_error("Failed to create telemetry segment");
+		break;
+	case 'W':
+		opt->pcap_file = arg;
+		break;
+	case 'k':
+		opt->tsc = &glob_tsc;
+		break;
+	case 'K':
+		len = strlen(arg);
+		res = strtol((const char *)arg, &str_end, 10);
+		if (errno || res < 1 || res > 3600 || str_end != &arg[len])
+			exit_with_error("Invalid TSC self-check duration. Check --help");
+		opt->tsc_check_sec = (uint32_t)res;
+		break;
 	case 'i':
 		opt->ifname = strdup(arg);
 		break;
@@ -202,6 +362,16 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 	case 'r':
 		opt->mode = MODE_RX;
 		break;
+	case 'R':
+		opt->mode = MODE_REFLECT;
+		break;
+	case 'B':
+		opt->mode = MODE_ROUNDTRIP;
+		break;
+	case 'L':
+		opt->mode = MODE_LOOPBACK;
+		opt->peer_ifname = strdup(arg);
+		break;
 	case 'z':
 		opt->xdp_mode = XDP_MODE_ZERO_COPY;
 		break;
@@ -237,9 +407,52 @@ static error_t parser(int key, char *arg, struct argp_state *state)
 	case 'n':
 		len = strlen(arg);
 		res = strtol((const char *)arg, &str_end, 10);
-		if (errno || res < 1 || res > 10000000 || str_end != &arg[len])
+		if (errno || res < 1 || res > 1000000000000L || str_end != &arg[len])
 			exit_with_error("Invalid number of frames to send. Check --help");
-		opt->frames_to_send = (uint32_t)res;
+		if (opt->frames_to_send == FRAMES_UNBOUNDED)
+			exit_with_error("-n and -D cannot be combined. Check --help");
+		opt->frames_to_send = (uint64_t)res;
+		break;
+	case 'D':
+		len = strlen(arg);
+		res = strtol((const char *)arg, &str_end, 10);
+		if (errno || res < 0 || res > 31536000L || str_end != &arg[len])
+			exit_with_error("Invalid duration. Check --help");
+		if (opt->frames_to_send && opt->frames_to_send != FRAMES_UNBOUNDED)
+			exit_with_error("-n and -D cannot be combined. Check --help");
+		/* Unbounded frames and no end time (-D 0): run until SIGINT */
+		opt->frames_to_send = FRAMES_UNBOUNDED;
+		opt->duration_ns = (uint64_t)res * NSEC_PER_SEC;
+		break;
+	case 'F':
+		opt->summary_file = arg;
+		break;
+	case 'N':
+		len = strlen(arg);
+		res = strtol((const char *)arg, &str_end, 10);
+		if (errno || res < 1 || res > 86400 || str_end != &arg[len])
+			exit_with_error("Invalid summary window. Check --help");
+		opt->summary_window = (uint32_t)res;
+		break;
+	case 'Q':
+		opt->quiet = 1;
+		break;
+	case 'G':
+		opt->flightrec_file = arg;
+		break;
+	case 'g':
+		len = strlen(arg);
+		res = strtol((const char *)arg, &str_end, 10);
+		if (errno || res < 1 || res > 1000000000 || str_end != &arg[len])
+			exit_with_error("Invalid flight recorder trigger. Check --help");
+		opt->flightrec_threshold = res;
+		break;
+	case 'S':
+		len = strlen(arg);
+		res = strtol((const char *)arg, &str_end, 10);
+		if (errno || res < 0 || res > 65535 || str_end != &arg[len])
+			exit_with_error("Invalid stream ID. Check --help");
+		opt->stream_id = (uint16_t)res;
 		break;
 	case 'o':
 		len = strlen(arg);
@@ -276,6 +489,31 @@ static char summary[] = "  AF_XDP & AF_PACKET Transmit-Receive Application";
 
 static struct argp argp = { options, parser, usage, summary };
 
+static struct pcapng_writer *glob_pcap;
+
+/* Flush pcapng output on every exit path, incl. xdpsock_cleanup() */
+static void pcap_close_atexit(void)
+{
+	pcapng_close(glob_pcap);
+	glob_pcap = NULL;
+}
+
+static struct summary_writer *glob_summary;
+
+static void summary_close_atexit(void)
+{
+	summary_close(glob_summary);
+	glob_summary = NULL;
+}
+
+static struct flightrec *glob_frec;
+
+static void flightrec_close_atexit(void)
+{
+	flightrec_close(glob_frec);
+	glob_frec = NULL;
+}
+
 static void copy_file(char *src_file, char *dst_file, bool clear_src)
 {
 	int ch;
@@ -324,6 +562,97 @@ void ts_log_stop()
 	copy_file("/var/log/phc2sys.log", "/var/log/captured_phc2sys.log", 0);
 }
 
+static void start_pinned_thread(pthread_t *thread, void *(*fn)(void *),
+				void *arg, int cpu)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	if (pthread_create(thread, &attr, fn, arg))
+		exit_with_error("pthread_create failed");
+	pthread_attr_destroy(&attr);
+}
+
+/* Transmit on opt->ifname and receive on opt->peer_ifname from one process.
+ * Both threads stamp with opt's clock (and TSC clock if enabled), so the
+ * u2u latency needs no PTP sync and no TSN NIC. Round-trip mode uses the
+ * same interface for both and only accepts reflected frames.
+ */
+static void run_loopback(struct user_opt *opt)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	struct user_opt rx_opt = *opt;
+	pthread_t tx_thread, rx_thread;
+	void *(*tx_fn)(void *);
+	void *(*rx_fn)(void *);
+	struct timespec deadline;
+
+	opt->mode = MODE_TX;
+	if (rx_opt.mode == MODE_LOOPBACK)
+		rx_opt.mode = MODE_RX;
+	rx_opt.ifname = opt->peer_ifname;
+	rx_opt.ifindex = if_nametoindex(opt->peer_ifname);
+	if (!rx_opt.ifindex) {
+		fprintf(stderr, "ERROR: interface \"%s\" do not exist\n",
+			opt->peer_ifname);
+		exit(EXIT_FAILURE);
+	}
+
+	switch (opt->socket_mode) {
+	case MODE_AFPKT:
+		signal(SIGINT, afpkt_sigint_handler);
+		signal(SIGTERM, afpkt_sigint_handler);
+		signal(SIGABRT, afpkt_sigint_handler);
+		tx_fn = afpkt_tx_thread;
+		rx_fn = afpkt_rx_thread;
+		break;
+	case MODE_AFXDP:
+		#ifndef WITH_XDP
+			exit_with_error("AF_XDP functionality is disabled/not supported. Mode_AFXDP is not usable. Exiting.");
+		#else
+		init_xdp_socket(&rx_opt);
+		glob_xskinfo_peer_ptr = rx_opt.xsk;
+		init_xdp_socket(opt);
+
+		if (!opt->xsk || !rx_opt.xsk)
+			afxdp_exit_with_error(EXIT_FAILURE);
+
+		signal(SIGINT, afxdp_sigint_handler);
+		signal(SIGTERM, afxdp_sigint_handler);
+		signal(SIGABRT, afxdp_sigint_handler);
+		tx_fn = afxdp_send_thread;
+		rx_fn = afxdp_recv_thread;
+		#endif /* WITH_XDP */
+		break;
+	default:
+		exit_with_error("Invalid socket type: Please specify -X or -P.");
+		break;
+	}
+
+	start_pinned_thread(&rx_thread, rx_fn, &rx_opt, ncpu - 1);
+	start_pinned_thread(&tx_thread, tx_fn, opt, ncpu > 1 ? ncpu - 2 : 0);
+
+	pthread_join(tx_thread, NULL);
+
+	/* Give in-flight frames 1s to arrive, then stop the receiver */
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 1;
+	if (pthread_timedjoin_np(rx_thread, NULL, &deadline)) {
+		halt_tx_sig = SIGTERM;
+		pthread_join(rx_thread, NULL);
+	}
+
+#ifdef WITH_XDP
+	if (opt->socket_mode == MODE_AFXDP)
+		xdpsock_cleanup();
+#endif
+}
+
 int main(int argc, char *argv[])
 {
 	struct user_opt opt;
@@ -339,7 +668,7 @@ int main(int argc, char *argv[])
 
 	opt.socket_prio = DEFAULT_SOCKET_PRIORITY;
 	opt.vlan_prio = DEFAULT_SOCKET_PRIORITY;
-	opt.frames_to_send = DEFAULT_NUM_FRAMES;
+	opt.summary_window = DEFAULT_SUMMARY_WINDOW;
 	opt.packet_size = DEFAULT_PACKET_SIZE;
 	opt.interval_ns = DEFAULT_TX_PERIOD;
 
@@ -359,6 +688,15 @@ int main(int argc, char *argv[])
 
 	argp_parse(&argp, argc, argv, 0, 0, &opt);
 
+	/* Left 0 by the parser unless -n or -D was given */
+	if (!opt.frames_to_send)
+		opt.frames_to_send = DEFAULT_NUM_FRAMES;
+
+	if (opt.tsc_check_sec) {
+		tsc_clock_selfcheck(opt.clkid, opt.tsc_check_sec);
+		return 0;
+	}
+
 	/* Parse user inputs */
 
 	if (!opt.ifname)
@@ -371,6 +709,83 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	opt.tai_offset_ns = clock_domain_tai_offset(opt.clkid);
+
+	if (opt.tsc && tsc_clock_init(opt.tsc, opt.clkid))
+		exit_with_error("Invariant TSC is not available, run without -k");
+
+	if (opt.metrics_path && metrics_server_start(opt.metrics_path))
+		exit_with_error("Failed to start metrics endpoint");
+
+	/* All blocks are registered here, the RT threads never take the
+	 * metrics lock. Frames of another stream id count as "other".
+	 */
+	opt.mx_tx = metrics_get("tx", opt.stream_id);
+	opt.mx_rx = metrics_get(opt.mode == MODE_ROUNDTRIP ? "rtt" : "rx",
+				opt.stream_id);
+	opt.mx_rx_other = metrics_get(opt.mode == MODE_ROUNDTRIP ? "rtt" : "rx",
+				      METRICS_STREAM_OTHER);
+
+	if (opt.pcap_file && opt.mode != MODE_TX && opt.mode != MODE_REFLECT) {
+		opt.pcap = pcapng_open(opt.pcap_file, "txrx-tsn",
+				       opt.peer_ifname ? opt.peer_ifname : opt.ifname,
+				       LINKTYPE_ETHERNET);
+		if (!opt.pcap)
+			exit_with_error("Failed to open pcapng file");
+		glob_pcap = opt.pcap;
+		atexit(pcap_close_atexit);
+	}
+
+	if (opt.summary_file && opt.mode != MODE_TX && opt.mode != MODE_REFLECT) {
+		char info[128];
+
+		snprintf(info, sizeof(info), "if=%s cycle_ns=%u offset_ns=%u",
+			 opt.peer_ifname ? opt.peer_ifname : opt.ifname,
+			 opt.interval_ns, opt.offset_ns);
+		opt.summary = summary_open(opt.summary_file, opt.summary_window, info);
+		if (!opt.summary)
+			exit_with_error("Failed to open summary file");
+		glob_summary = opt.summary;
+		atexit(summary_close_atexit);
+	}
+
+	if (opt.flightrec_file && opt.mode != MODE_REFLECT) {
+		char info[128];
+
+		if (!opt.flightrec_threshold)
+			opt.flightrec_threshold = opt.interval_ns;
+		snprintf(info, sizeof(info), "if=%s cycle_ns=%u offset_ns=%u",
+			 opt.peer_ifname ? opt.peer_ifname : opt.ifname,
+			 opt.interval_ns, opt.offset_ns);
+		opt.frec = flightrec_open(opt.flightrec_file,
+					  opt.flightrec_threshold, info);
+		if (!opt.frec)
+			exit_with_error("Failed to open flight recorder file");
+		glob_frec = opt.frec;
+		atexit(flightrec_close_atexit);
+	}
+
+	if (opt.mode == MODE_LOOPBACK) {
+		run_loopback(&opt);
+		return 0;
+	}
+
+	if (opt.mode == MODE_REFLECT || opt.mode == MODE_ROUNDTRIP) {
+		if (opt.socket_mode != MODE_AFPKT)
+			exit_with_error("Reflector/round-trip mode needs -P");
+		signal(SIGINT, afpkt_sigint_handler);
+		signal(SIGTERM, afpkt_sigint_handler);
+		signal(SIGABRT, afpkt_sigint_handler);
+
+		if (opt.mode == MODE_REFLECT) {
+			afpkt_reflect(&opt);
+		} else {
+			opt.peer_ifname = opt.ifname;
+			run_loopback(&opt);
+		}
+		return 0;
+	}
+
 #ifdef WITH_XDP
 	char buff[opt.packet_size];
 	pthread_t thread1;
@@ -390,6 +805,7 @@ int main(int argc, char *argv[])
 		int sockfd;
 
 		ts_log_start();
+		phc_sys_offset_report(opt.ifname, opt.phc_spec, "start");
 
 		switch (opt.mode) {
 		case MODE_TX:
@@ -409,16 +825,15 @@ int main(int argc, char *argv[])
 			 *  always steered into RX Q0 regardless of its VLAN
 			 *  priority
 			 */
-			ret = init_rx_socket(0xb62c, &sockfd, opt.ifname);
+			ret = init_rx_socket(0xb62c, &sockfd, opt.ifname, opt.enable_hwts);
 			if (ret != 0)
 				perror("initrx_socket failed");
 
-			glob_rx_seq = 0;
+			rx_start(&opt);
 			while (!halt_tx_sig) {
 				afpkt_recv_pkt(sockfd, &opt);
-				if (glob_rx_seq >= opt.frames_to_send) {
+				if (rx_done(&opt))
 					break;
-				}
 			}
 			close(sockfd);
 			break;
@@ -427,6 +842,7 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		phc_sys_offset_report(opt.ifname, opt.phc_spec, "end");
 		ts_log_stop();
 
 		close(sockfd);
@@ -448,6 +864,7 @@ int main(int argc, char *argv[])
 		usleep(45000000);
 
 		ts_log_start();
+		phc_sys_offset_report(opt.ifname, opt.phc_spec, "start");
 
 		switch (opt.mode) {
 		case MODE_TX:
@@ -455,12 +872,11 @@ int main(int argc, char *argv[])
 
 			break;
 		case MODE_RX:
-			glob_rx_seq = 0;
+			rx_start(&opt);
 			while (!halt_tx_sig) {
-				afxdp_recv_pkt(opt.xsk, buff);
-				if (glob_rx_seq >= opt.frames_to_send) {
+				afxdp_recv_pkt(&opt, buff);
+				if (rx_done(&opt))
 					break;
-				}
 			}
 			break;
 		default:
@@ -468,6 +884,7 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		phc_sys_offset_report(opt.ifname, opt.phc_spec, "end");
 		ts_log_stop();
 
 		/* Close XDP Application */
@@ -481,3 +898,4 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
+#endif /* TXRX_BENCH */
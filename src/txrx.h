@@ -52,6 +52,12 @@
 
 #define MODE_TX 0
 #define MODE_RX 1
+#define MODE_LOOPBACK 2
+#define MODE_REFLECT 3
+#define MODE_ROUNDTRIP 4
+
+/* -D soak runs: far beyond any real run, with headroom for flush packets */
+#define FRAMES_UNBOUNDED (UINT64_MAX >> 1)
 
 #define XDP_MODE_SKB_COPY 0
 #define XDP_MODE_NATIVE_COPY 1
@@ -59,17 +65,53 @@
 
 #define exit_with_error(s) {fprintf(stderr, "Error: %s\n", s); exit(EXIT_FAILURE);}
 
+#include "txrx-clock.h"
+#include "pcapng.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "tsn-probes.h"
+#include "summary.h"
+#include "flightrec.h"
+
 extern unsigned char src_mac_addr[];
 extern unsigned char dst_mac_addr[];
 extern unsigned char src_ip_addr[];
 extern unsigned char dst_ip_addr[];
 
+#define TSN_PAYLOAD_MAGIC	0x7453
+#define TSN_PAYLOAD_VERSION	1
+#define TSN_PAYLOAD_F_TXTIME	(1 << 0)	//launch_time is valid
+#define TSN_PAYLOAD_F_REFLECTED	(1 << 1)	//reflect_ext follows payload
+
+/* Versioned measurement payload, placed right after the ethertype. Fits in a
+ * minimum-sized (64B) frame. The CRC32C covers every field before it.
+ */
 struct custom_payload {
-	uint32_t tx_queue;
-	uint32_t seq;
-	uint64_t tx_timestampA;
-	uint64_t rx_timestampD;
-};
+	uint16_t magic;
+	uint8_t version;
+	uint8_t flags;
+	uint16_t stream_id;
+	uint16_t tx_queue;
+	uint64_t seq;
+	uint64_t launch_time;		//txtime handed to SO_TXTIME/XDP TBS
+	uint64_t tx_timestampA;		//user txtime
+	uint64_t prev_hw_txtime;	//hw txtime of seq - 1, 0 if unknown
+	uint32_t crc;
+} __attribute__((packed));
+
+/* Appended after the payload by a reflector (-R) */
+struct reflect_ext {
+	uint64_t rx_hw_time;	//reflector hw rxtime, 0 if unknown
+	uint64_t rx_time;	//reflector user rxtime
+	uint64_t tx_time;	//reflector user txtime
+	uint32_t crc;
+} __attribute__((packed));
+
+#define TSN_PAYLOAD_OK		0
+#define TSN_PAYLOAD_ESHORT	-1
+#define TSN_PAYLOAD_EMAGIC	-2
+#define TSN_PAYLOAD_ECRC	-3
+#define TSN_PAYLOAD_EFIELD	-4
 
 #ifdef WITH_XDP
 /* Where we keep and track umem descriptor counters */
@@ -116,14 +158,36 @@ struct user_opt {
 
 	char *ifname;
 	uint32_t ifindex;
-	clockid_t clkid;
+	char *peer_ifname;	//Loopback mode: receive on this interface
+	clockid_t clkid;	//Clock domain for sleeping, stamping and txtime
+	char *phc_spec;		//PHC offset report source, NULL for -i's PHC
+	int64_t tai_offset_ns;	//clkid to CLOCK_TAI offset, applied to txtime
 	int enable_hwts;
+	struct tsc_clock *tsc;	//TSC clock for user timestamps, NULL if unused
+	uint32_t tsc_check_sec;	//Run TSC clock self-check for N seconds
+	uint16_t stream_id;
+	char *pcap_file;		//pcapng export of received frames
+	struct pcapng_writer *pcap;
+	struct telemetry *telem;	//Live shm telemetry, NULL if unused
+	char *metrics_path;		//Unix socket for the metrics endpoint
+	struct metrics_block *mx_tx;	//This thread's counters, see metrics.h
+	struct metrics_block *mx_rx;
+	struct metrics_block *mx_rx_other;	//RX frames of other stream ids
+	char *summary_file;		//Windowed summary output, see summary.h
+	uint32_t summary_window;	//Summary window in seconds
+	struct summary_writer *summary;
+	char *flightrec_file;		//Flight recorder dumps, see flightrec.h
+	int64_t flightrec_threshold;	//RX latency trigger in ns
+	struct flightrec *frec;
+	uint8_t quiet;			//No per-packet result lines
 
 	/* TX control */
 	uint32_t socket_prio;
 	uint8_t vlan_prio;
 	uint32_t packet_size;
-	uint32_t frames_to_send;
+	uint64_t frames_to_send;
+	uint64_t duration_ns;		//Run for this long instead of -n, 0 if unused
+	uint64_t rx_end_ns;		//RX stops at this clkid time, 0 if unused
 	uint32_t interval_ns;		//Cycle time or time between packets
 	uint32_t offset_ns;		//TXTIME transmission target offset from 0th second
 	uint32_t early_offset_ns;	//TXTIME early offset before transmission
@@ -161,5 +225,41 @@ typedef struct __attribute__ ((packed)) {
 uint64_t get_time_nanosec(clockid_t clkid);
 uint64_t get_time_sec(clockid_t clkid);
 void setup_tsn_vlan_packet(struct user_opt *opt, tsn_packet *pkt);
+void tsn_payload_init(struct user_opt *opt, struct custom_payload *pl);
+void tsn_payload_seal(struct custom_payload *pl);
+int tsn_payload_parse(const void *buf, size_t len, struct custom_payload *pl);
+void tsn_reflect_seal(struct reflect_ext *ext);
+int tsn_reflect_parse(const void *buf, size_t len, struct reflect_ext *ext);
+
+/* User (software) timestamp used for payload stamping and rx time */
+static inline uint64_t get_user_time_nanosec(struct user_opt *opt)
+{
+	if (opt->tsc)
+		return tsc_clock_now(opt->tsc);
+
+	return get_time_nanosec(opt->clkid);
+}
+
+extern uint64_t glob_rx_seq;
+
+/* Reset RX progress and arm the -D deadline, allowing for the sender's 2s
+ * start delay and frames still in flight
+ */
+static inline void rx_start(struct user_opt *opt)
+{
+	glob_rx_seq = 0;
+	if (opt->duration_ns)
+		opt->rx_end_ns = get_time_nanosec(opt->clkid) + opt->duration_ns +
+				 3 * NSEC_PER_SEC;
+}
+
+/* RX loop exit: all -n frames seen, or the -D deadline has passed */
+static inline int rx_done(struct user_opt *opt)
+{
+	if (glob_rx_seq >= opt->frames_to_send)
+		return 1;
+
+	return opt->rx_end_ns && get_time_nanosec(opt->clkid) >= opt->rx_end_ns;
+}
 
 #endif